@@ -16,8 +16,26 @@
 * 6) Support input and output redirection
 * 7) Support running commands in foreground and background processes
 * 8) Implement custom handlers for 2 signals, SIGINT and SIGTSTP
+* 9) Support pipelines of any number of stages ( cmd1 | cmd2 | ... )
+* 10) Built-in parallel command for bounded fan-out of jobs
+* 11) time prefix reporting rusage of commands (via wait4)
+* 12) Prometheus textfile metrics of spawn/wait/parse latencies
+* 13) cgroup v2 resource limits for jobs (limit)
+* 14) optional pre-forked zygote pool for starting commands
+* 15) builtin registry with in-process echo, true, false, test, printf, cat
+* 16) here-strings (<<<) and here-documents (<<) fed from memory
+* 17) command lists (;) and for/while loops parsed once per line
+* 18) several > and >> targets per command, fanned out with tee()/splice()
+* 19) $(...) command substitution, run concurrently within a command
+* 20) $NAME, ${NAME}, $?, $! and $$ expanded from one variable table
+* 21) scripts compiled once to a relocatable image, cached and mmap'd
+* 22) job control: process groups, terminal hand-off, jobs, fg, bg, kill %n, wait
+* 23) per-command timeouts enforced with a timerfd and the command's pidfd
+* 24) server mode: command lines from many clients over a UNIX domain socket
 */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <unistd.h>
 #include <stdlib.h>
@@ -27,43 +45,316 @@
 #include <signal.h>
 #include <sys/wait.h>
 #include <sys/types.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <spawn.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <linux/sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <arpa/inet.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <ctype.h>
+#include <time.h>
+#include <limits.h>
+#include <stdint.h>
+#include <termios.h>
 
 
 // Constants
 #define IN "<"
 #define OUT ">"
 #define BKGRD "&"
+#define PIPE "|"
 #define COMMENT "#"
 #define EXP "$$"
-#define MAX_ARGS 512
-#define MAX_ARG_LENGTH 2048
+#define PID_STRING_LENGTH 24
+#define MAX_EVENTS 64
+#define INPUT_CHUNK_SIZE 65536
+#define USAGE_STRING_LENGTH 160
+#define METRIC_BUCKETS 26           // 1us .. 2^24us (~17s), then +Inf
+#define METRICS_INTERVAL_S 15
+#define CPU_PERIOD_US 100000        // cpu.max period for cpu= limits
+#define ZYGOTE_POOL_MAX 16
+#define BUILTIN_FALLBACK -1         // builtin handler: run the command as a process instead
+#define HERE_PIPE_MAX PIPE_BUF      // here-document bodies up to this size go through a pipe
+#define PRINTF_SPEC_MAX 40          // printf builtin: longest conversion spec, with "ll"
+#define FANOUT_CHUNK (1 << 20)      // most bytes one fan-out tee()/splice() moves
+#define PATH_CHECK_INTERVAL_MS 1000
+#define ARENA_BLOCK_SIZE 65536
+#define COMPILED_MAGIC "smshbc02"   // compiled script format; bump the digits on any change
+#define COMPILED_NONE UINT32_MAX    // compiled script: no string here
+#define COMPILED_BACKGROUND 0x01
+#define COMPILED_TIMED 0x02
+#define COMPILED_HERE_EXPAND 0x04
+#define COMPILED_VARIABLES 0x08
+#define COMPILED_SUBSTITUTIONS 0x10
+#define COMPILED_WHILE 0x20
+#define FINISHED_JOBS 64            // ended jobs whose status wait can still report
+#define TIMEOUT_GRACE_MS 5000       // from SIGTERM to SIGKILL for a command out of time
+#define SERVE_HEADER_SIZE 9         // server frame header: type, request id, payload length
+#define SERVE_OUTPUT_LIMIT (256 * 1024)  // output a client may fall behind by before workers wait
+#define FRAME_RUN 'R'               // client: run a command line, answer with its status
+#define FRAME_CAPTURE 'C'           // client: run a command line, send its output too
+#define FRAME_OUTPUT 'O'            // server: output of a request
+#define FRAME_STATUS 'S'            // server: a request's exit status, its last frame
+#define FRAME_ERROR 'E'             // server: a request that could not be run
+#define SERVE_LISTEN 1              // server epoll events: kind << 32 | index
+#define SERVE_SIGNAL 2
+#define SERVE_CLIENT 3
+#define SERVE_OUTPUT 4
+#define SERVE_EVENT(kind, index) (((uint64_t)(kind) << 32) | (uint32_t)(index))
 
 // Global variables
 bool foregroundOnlyMode = false;
+volatile sig_atomic_t interruptCount = 0;  // SIGINTs caught while a loop runs (see runLoop)
+bool forceForkSpawn = false;
+bool zygoteMode = false;      // SMALLSH_SPAWN=zygote: start commands from a helper pool
+int pipeBufferSize = 0;
+int teeBufferSize = 0;        // SMALLSH_TEE_SZ: pipe between fanned-out output targets
+bool alwaysTime = false;      // report resource usage for every command
+char* metricsPath = NULL;     // Prometheus textfile to dump metrics to
+int metricsTimerFd = -1;      // timerfd for the periodic metrics dump
+int shellCgroupFd = -1;       // this shell's cgroup (see openShellCgroup)
+int cgroupState = 0;          // 0 not tried yet, 1 usable, -1 unavailable
+unsigned int cgroupSequence = 0;
+const char* lastLimitHit = NULL;   // limit that killed the last foreground command
+bool lastTimedOut = false;    // the last foreground command ran out of time
+
+// Timeouts: commands without a timeout prefix get defaultTimeoutMs
+// (0: none). Background jobs share jobTimerFd, armed for the
+// earliest deadline among them (jobTimerDeadline, 0 if disarmed).
+long long defaultTimeoutMs = 0;
+long long timeoutGraceMs = TIMEOUT_GRACE_MS;
+int jobTimerFd = -1;
+long long jobTimerDeadline = 0;
+
+// Event loop state: epoll instance multiplexing stdin, the SIGCHLD
+// signalfd and one pidfd per background process
+int eventPollFd = -1;
+int childSignalFd = -1;
+bool inputPollable = false;
+sigset_t childSignalMask;     // signal mask children start with
+
+// Script mode: no banner or prompt, exit with the last command's status
+bool interactiveMode = true;
+
+// Command input. A regular file is mapped whole (scriptMap) and split
+// into lines in place. Anything else is read() in big chunks into
+// inputBuffer and split there, so epoll readiness on the input is
+// never hidden inside a stdio buffer.
+int inputFd = STDIN_FILENO;
+char* scriptMap = NULL;
+size_t scriptSize = 0;
+size_t scriptPos = 0;
+// inputBuffer grows to hold a line of up to argMax bytes.
+char* inputBuffer = NULL;
+int inputCapacity = 0;
+int inputStart = 0;
+int inputEnd = 0;
+int inputScanned = 0;         // bytes after inputStart known to hold no newline
+bool inputEOF = false;
+bool inputSkipping = false;   // dropping the rest of a line over argMax
+long argMax = 0;              // longest command line accepted: ARG_MAX
+int linesIgnored = 0;         // lines dropped for being longer than argMax
+
+// A script compiled by compileScript runs from its image instead
+// of having its lines parsed: mapped from the cache file next to
+// the script, or built in memory
+char* compiledImage = NULL;
+size_t compiledSize = 0;
+bool compiledMapped = false;
+uint32_t compiledNext = 0;    // next line of the compiled script to run
+bool lateBindPid = false;     // compiling: lexInput leaves $$ for bindVariables
+
+// Job control, when the shell is interactive on a terminal: each
+// foreground job is given the terminal (terminalFd) in turn and
+// the shell takes it back, with its own modes, when the job ends
+bool jobControl = false;
+int terminalFd = STDIN_FILENO;
+pid_t shellGroup = 0;         // the shell's process group
+struct termios shellModes;    // terminal modes the shell runs with
 
 // Struct definitions
 
 /**************************************************
-struct: pidNode
+struct: jobEntry
+
+One slot of the background job table. A job is everything
+started by one command line, so a background pipeline is
+a single job. pid is the process reported to the user
+(the last stage), liveProcs counts the job's processes not
+yet reaped and lastStatus holds the reported process's exit
+status once it is known. Free slots have pid 0 and are
+chained through nextFree. started is when the job was
+launched; for a timed job usage sums the rusage of its reaped
+processes (maxrss is the largest of them). A job placed in a
+cgroup of its own has its directory open in cgroupFd (-1 if
+none) and is named job-<cgroupId>.
+
+Every job runs in a process group of its own, pgid (-1 for a
+job left in the shell's group), so it is signalled as a
+whole. stopSignal is the signal that stopped it, 0 while it
+runs; sequence orders jobs by their last start or stop, for
+the current job. commandText is the command line shown by
+jobs and fg. A job brought back by fg is foreground and is
+not reported when it ends; a job stopped while it had the
+terminal keeps its terminal modes in terminalModes.
+
+A job with a timeout has its deadline (metricClock time, 0
+if none); timedOut is set once it has been sent SIGTERM for
+it, and the deadline then moves on to the end of the grace
+period.
+***************************************************/
+struct jobEntry {
+
+	pid_t pid;
+	int liveProcs;
+	int lastStatus;
+	int nextFree;
+	bool timed;
+	struct timespec started;
+	struct rusage usage;
+	int cgroupFd;
+	unsigned int cgroupId;
+	pid_t pgid;
+	int stopSignal;
+	unsigned int sequence;
+	char* commandText;
+	bool foreground;
+	bool hasModes;
+	struct termios terminalModes;
+	long long deadline;
+	bool timedOut;
+};
+
+/**************************************************
+struct: pidSlot
+
+Entry of the pid -> job index. Maps one background process
+to the slot of the job it belongs to, and keeps the pidfd
+registered for it with the event loop (-1 if none). pid 0
+marks an empty entry.
+***************************************************/
+struct pidSlot {
+
+	pid_t pid;
+	int slot;
+	int pidfd;
+};
+
+// A job that has ended: the pid it was reported under, and its status
+struct finishedJob {
+
+	pid_t pid;
+	int status;
+};
+
+/**************************************************
+struct: jobTable
+
+Tracks the jobs running in the background. jobs is a slot
+array indexed by job ID - 1; IDs are stable for the life
+of a job and freed slots are reused through the freeHead
+list. index is an open-addressing (linear probing) hash
+from pid to slot, kept at most half full, so adding,
+finding and removing a process are all O(1) and no memory
+is allocated per job once the arrays have grown.
+stoppedCount is how many of the jobs are stopped. The last
+FINISHED_JOBS jobs to end are kept in the finished ring
+(finishedCount counts every job that has ended), so wait
+can report a job that was reaped before it was waited for.
+***************************************************/
+struct jobTable {
+
+	struct jobEntry* jobs;
+	int jobCapacity;
+	int freeHead;
+	int jobCount;
+	int stoppedCount;
+	unsigned int sequence;
+	struct finishedJob finished[FINISHED_JOBS];
+	unsigned int finishedCount;
+
+	struct pidSlot* index;
+	int indexCapacity;     // always a power of two
+	int indexCount;
+};
+
+/**************************************************
+struct: arenaBlock
+
+One block of the line arena. Allocations are carved off
+data from the front; used is the number of bytes handed out.
+***************************************************/
+struct arenaBlock {
+
+	struct arenaBlock* next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+/**************************************************
+struct: lineArena
+
+Bump allocator for everything built from one command line
+(the expanded line and the commandStruct of every stage,
+with all of its strings). Nothing in it is freed on its own:
+arenaReset releases the whole line at once after it has
+been executed. The first block is kept across resets, so a
+typical line allocates nothing from the heap.
+***************************************************/
+struct lineArena {
+
+	struct arenaBlock* first;
+	struct arenaBlock* current;
+};
+
+// A point in the line arena to rewind to (arenaSave)
+struct arenaMark {
+
+	struct arenaBlock* block;
+	size_t used;
+};
+
+/**************************************************
+struct: cgroupPolicy
 
-Used as node in linked list to keep track of processes
-that are allocated to run in the background.
+Resource limits for a cgroup v2 directory. cpuQuota is the
+cpu.max quota in microseconds per CPU_PERIOD_US, memoryMax
+the memory.max in bytes, ioWeight the io.weight (1-10000).
+0 leaves a limit unset; -1 writes "max" (no limit).
 ***************************************************/
-struct pidNode {
+struct cgroupPolicy {
 
-	pid_t* process;
-	struct pidNode* next;
+	long cpuQuota;
+	long long memoryMax;
+	int ioWeight;
 };
 
+// Limits given to every background job, and to the shell's
+// cgroup as a whole (limit builtin)
+struct cgroupPolicy jobPolicy = { 0 };
+struct cgroupPolicy shellPolicy = { 0 };
+
 /**************************************************
-struct: pidListHead
+struct: outputTarget
 
-Used as head node in linked list to keep track of processes
-that are allocated to run in the background.
+One output redirect of a command: the file, and whether it
+was given with >> (append) rather than > (truncate).
 ***************************************************/
-struct pidListHead {
+struct outputTarget {
 
-	struct pidNode* next;
+	char* path;
+	bool append;
 };
 
 /**************************************************
@@ -72,68 +363,742 @@ struct: commandStruct
 Key structure to store all the elements that are
 included in the shell command. Syntax given for command is:
 
-command [arg1 arg2 ...] [< input_file] [> output_file] [&]
+command [arg1 arg2 ...] [< input_file] [> output_file ...] [>> output_file ...] [| command ...] [&]
 
-Members are: 1) command string; 2) arguments array;
+Members are: 1) command string; 2) arguments array, sized
+for exactly the command's arguments plus a NULL, and their
+count;
 3) string representing location to redirect input;
-4) string representing location to redirect output
+4) string representing location to redirect output (the
+first one, when there are several), and every > or >>
+target of the command with their count
 5) a bool representing whether the command is meant
 run in background mode
+6) pointer to the next stage when the command is part
+of a pipeline ( cmd1 | cmd2 | ... ), NULL for the last stage
+7) a bool set on the first stage when the line starts with
+the "time" prefix
+8) resource limits from a "limit" prefix (first stage only),
+NULL if there was none
+9) the delimiter of a here-document (<<WORD) whose body
+has not been read yet, and whether the body gets expanded
+(not when the delimiter was quoted)
+10) the here-string (<<<) or here-document body the command
+reads as its input instead of inputRedir, and its length
+11) the next command of a list ( cmd1 ; cmd2 ), NULL for
+the last one; set on the first stage of each pipeline
+12) for a for/while loop, its loop (command is then the
+keyword); and, in a loop body, whether any string of the
+stage refers to a variable, to be bound per iteration
+13) a bool set on the first stage when a word of the
+pipeline holds a $(...) command substitution, expanded by
+substituteCommands each time the pipeline runs
+14) the wall-clock limit in milliseconds from a "timeout"
+prefix (first stage only), 0 if there was none
 
 ***************************************************/
-typedef struct {
+typedef struct commandStruct {
 
 	char* command;
-	char* arguments[MAX_ARGS];
+	char** arguments;
+	int argCount;
 	char* inputRedir;
 	char* outputRedir;
+	struct outputTarget* outputTargets;
+	int outputCount;
 	bool bkgrdInd;
+	struct commandStruct* nextStage;
+	bool timed;
+	struct cgroupPolicy* policy;
+	char* hereDelimiter;
+	bool hereExpand;
+	char* hereData;
+	size_t hereLength;
+	struct commandStruct* nextCommand;
+	struct loopStruct* loop;
+	bool hasVariables;
+	bool hasSubstitutions;
+	long long timeoutMs;
 
 } commandStruct;
 
+/**************************************************
+struct: loopStruct
+
+A for or while loop as parsed by parseLoop: the for loop's
+variable and the words it takes in turn, or the while loop's
+condition list, and the body list. Both lists are parsed
+once and run again on every iteration. hasSubstitutions is
+set when a word is a $(...) to run before the first one.
+***************************************************/
+struct loopStruct {
+
+	bool isWhile;
+	char* variable;
+	char** words;
+	int wordCount;
+	bool hasSubstitutions;
+	commandStruct* condition;
+	commandStruct* body;
+};
+
+/**************************************************
+struct: loopBinding
+
+The current value of a running for loop's variable, and its
+length. Nested loops stack their bindings through outer,
+innermost first; they hide variables of the same name in
+the variable table while the loop runs.
+***************************************************/
+struct loopBinding {
+
+	const char* name;
+	const char* value;
+	size_t valueLength;
+	struct loopBinding* outer;
+};
+
+// Variables of the for loops running now, innermost first
+struct loopBinding* loopBindings = NULL;
+
+/**************************************************
+struct: substitution
+
+One $(...) being expanded: the command between the
+parentheses, the descriptor its output is read from (-1
+once it is at its end), the process writing it (-1 when a
+builtin ran in the shell) and the output captured so far,
+in a buffer that grows as it fills.
+***************************************************/
+struct substitution {
+
+	char* command;
+	int readFd;
+	pid_t pid;
+	char* output;
+	size_t length;
+	size_t capacity;
+};
+
+
+
+/**************************************************
+struct: lexToken
+
+One token of a command line as produced by lexInput. text
+is a NUL-terminated slice of the input line itself (or of
+the line's expansion buffer when the token contained $$).
+type tells a plain word from the operators < > & and |, so
+the parser never compares strings. The here-string and
+here-document operators may have their word attached
+(<<<word, <<EOF); text is then that word, else "". ";"
+ends a command wherever it appears. substitution is set on
+a word holding a $(...), kept whole up to its closing ')'.
+***************************************************/
+enum tokenType { TOKEN_WORD, TOKEN_IN, TOKEN_OUT, TOKEN_BKGRD, TOKEN_PIPE,
+	TOKEN_HERESTRING, TOKEN_HEREDOC, TOKEN_SEMI, TOKEN_APPEND };
+
+struct lexToken {
+
+	char* text;
+	enum tokenType type;
+	bool substitution;
+};
+
+// Shell pid as a string, for $$ -- formatted once at startup
+char shellPidString[PID_STRING_LENGTH];
+int shellPidLength = 0;
+
+/**************************************************
+struct: shellVariable
+
+One entry of the variable table: a name and its value, each
+with its length, so an expansion never measures either.
+Names and values point into environ, or into the shell's
+own buffers for $$, $? and $!.
+***************************************************/
+struct shellVariable {
+
+	const char* name;
+	size_t nameLength;
+	const char* value;
+	size_t valueLength;
+};
+
+/**************************************************
+struct: variableTable
+
+The name -> value table substituteVariables expands from:
+open addressing over a power-of-two array of slots (a NULL
+name is an empty slot), filled from the environment at
+startup. $$ is set once; $? is reformatted only when the
+status it was made from changes, and $! when a background
+job starts. longestValue bounds what any one reference can
+expand to, so every expansion buffer is sized before it is
+written.
+***************************************************/
+struct variableTable {
+
+	struct shellVariable* slots;
+	int capacity;
+	int count;
+	size_t longestValue;
+	int status;
+	char statusValue[PID_STRING_LENGTH];
+	char backgroundValue[PID_STRING_LENGTH];
+};
+
+// Variables $NAME and ${NAME} expand to
+struct variableTable variables = { NULL, 0, 0, 0, 0, "0", "" };
+
+/**************************************************
+struct: compiledHeader
+
+The start of a compiled script (see compileScript): the
+magic string, which carries the format version, the hash
+and size of the script it was compiled from, and where each
+section starts, in bytes from the start of the image. Every
+reference inside the image is an index or a pool offset,
+never a pointer, so the image runs from wherever it is
+mapped, unchanged.
+***************************************************/
+struct compiledHeader {
+
+	char magic[8];
+	uint64_t scriptHash;
+	uint64_t scriptSize;
+	uint32_t imageSize;
+	uint32_t lineCount;
+	uint32_t lineOffset;      // struct compiledLine[lineCount]
+	uint32_t commandOffset;   // struct compiledCommand[]
+	uint32_t loopOffset;      // struct compiledLoop[]
+	uint32_t argOffset;       // uint32_t pool offsets: argv and loop words
+	uint32_t targetOffset;    // struct compiledTarget[]
+	uint32_t policyOffset;    // struct cgroupPolicy[]
+	uint32_t poolOffset;      // NUL-terminated strings
+};
+
+/**************************************************
+struct: compiledLine
+
+One line of a compiled script: its list (a command index
++ 1), or 0 for a line that did not parse, whose text is
+kept in the pool to be parsed again, and its error shown,
+when the line's turn comes. Blank and comment lines have no
+entry.
+***************************************************/
+struct compiledLine {
+
+	uint32_t command;
+	uint32_t rawText;
+};
+
+/**************************************************
+struct: compiledCommand
+
+A commandStruct in a compiled script: argv as a run of
+entries in the argument table, the redirects and here-data
+as pool offsets (COMPILED_NONE if absent), the output
+targets as a run of the target table, and the policy, next
+stage, next command and loop as index + 1 (0 if none).
+timeoutMs is the timeout prefix's limit. flags holds the
+background, timed and here-expand bits and the late-binding
+sites: stages with variables or $(...) that are expanded
+each time the command runs.
+***************************************************/
+struct compiledCommand {
+
+	uint32_t arguments;
+	uint32_t argCount;
+	uint32_t inputRedir;
+	uint32_t targets;
+	uint32_t targetCount;
+	uint32_t hereData;
+	uint32_t hereLength;
+	uint32_t policy;
+	uint32_t nextStage;
+	uint32_t nextCommand;
+	uint32_t loop;
+	uint32_t flags;
+	uint32_t timeoutMs;
+};
+
+/**************************************************
+struct: compiledLoop
+
+A loopStruct in a compiled script: the variable as a pool
+offset, the words as a run of the argument table, and the
+condition and body lists as command index + 1.
+***************************************************/
+struct compiledLoop {
+
+	uint32_t variable;
+	uint32_t words;
+	uint32_t wordCount;
+	uint32_t condition;
+	uint32_t body;
+	uint32_t flags;
+};
+
+/**************************************************
+struct: compiledTarget
+
+An output target in a compiled script: its path as a pool
+offset, and whether it appends.
+***************************************************/
+struct compiledTarget {
+
+	uint32_t path;
+	uint32_t append;
+};
+
+/**************************************************
+struct: compileBuffer
+
+One section of a compiled script while it is being built:
+a byte buffer that doubles as it fills.
+***************************************************/
+struct compileBuffer {
+
+	char* data;
+	size_t length;
+	size_t capacity;
+};
+
+/**************************************************
+struct: compileSections
+
+Every section of a compiled script being built, written
+into one image by writeCompiledImage, and an open-addressing
+set of the pool's strings (offset + 1, 0 for an empty slot)
+so each distinct string is stored once.
+***************************************************/
+struct compileSections {
+
+	struct compileBuffer lines;
+	struct compileBuffer commands;
+	struct compileBuffer loops;
+	struct compileBuffer args;
+	struct compileBuffer targets;
+	struct compileBuffer policies;
+	struct compileBuffer pool;
+	uint32_t* strings;
+	size_t stringCapacity;
+	size_t stringCount;
+};
+
+/**************************************************
+struct: pathEntry
+
+Entry of the command location cache: a command name and the
+absolute path PATH lookup found for it, plus how often the
+entry was used. Both strings share one allocation. name
+NULL marks an empty entry.
+***************************************************/
+struct pathEntry {
+
+	char* name;
+	char* path;
+	int hits;
+};
+
+/**************************************************
+struct: pathCache
+
+Command location cache used instead of execvp's walk over
+PATH. entries is an open-addressing hash (linear probing,
+at most half full) keyed by command name. pathValue is the
+PATH the entries were found with, and dirTimes the mtime of
+each of its directories; adding or removing a file changes
+a directory's mtime, so comparing them tells whether any
+entry may be stale. That check costs a stat per PATH
+directory and is done at most once per PATH_CHECK_INTERVAL.
+***************************************************/
+struct pathCache {
+
+	struct pathEntry* entries;
+	int capacity;       // always a power of two
+	int count;
+	char* pathValue;
+	struct timespec* dirTimes;
+	int dirCount;
+	struct timespec lastCheck;
+	long hits;
+	long misses;
+};
+
+// Holds the parse results of the command line being executed
+struct lineArena lineArena = { NULL, NULL };
+
+// Where commands were last found on PATH (see resolveCommand)
+struct pathCache commandCache = { 0 };
+
+/**************************************************
+struct: metricHistogram
+
+Latency histogram with log2 buckets: bucket i counts the
+observations of at most 2^i microseconds, the last bucket
+everything longer. sum is in nanoseconds. Updated with
+relaxed atomics, so it never takes a lock.
+***************************************************/
+struct metricHistogram {
+
+	unsigned long count;
+	unsigned long sum;
+	unsigned long buckets[METRIC_BUCKETS];
+};
+
+/**************************************************
+struct: shellMetrics
+
+Counters and histograms for the shell's hot paths, written
+out by writeMetrics. Members are: 1) lines parsed;
+2) processes started and 3) failed to start; 4) background
+jobs started and 5) finished; 6) time spent in processInput
+per line; 7) time to start one process (posix_spawn returns
+once the child has exec'd, the fork path once fork returns);
+8) time the shell waits on a foreground command; 9) lifetime
+of a background job, from launch to its last reap.
+***************************************************/
+struct shellMetrics {
+
+	unsigned long linesParsed;
+	unsigned long processesStarted;
+	unsigned long startFailures;
+	unsigned long jobsStarted;
+	unsigned long jobsFinished;
+	struct metricHistogram parseTime;
+	struct metricHistogram spawnTime;
+	struct metricHistogram foregroundWait;
+	struct metricHistogram jobLifetime;
+};
+
+// Exported by the metrics builtin and SMALLSH_METRICS
+struct shellMetrics metrics = { 0 };
+
+/**************************************************
+struct: zygote
+
+A pre-forked helper process (SMALLSH_SPAWN=zygote, made by
+the zygote master, see zygoteMaster) waiting
+for a command on its end of a socketpair; socketFd is the
+shell's end. The helper's pid becomes the command's pid.
+***************************************************/
+struct zygote {
+
+	pid_t pid;
+	int socketFd;
+};
+
+/**************************************************
+struct: zygoteRequest
+
+Start of the message that hands a command to a helper. It
+is followed by the exec path, the working directory and
+argCount arguments, each NUL-terminated; the descriptors
+for stdin and stdout, when hasIn / hasOut, travel with it
+as SCM_RIGHTS.
+***************************************************/
+struct zygoteRequest {
+
+	int argCount;
+	int background;
+	int hasIn;
+	int hasOut;
+};
+
+// Helpers ready to use; zygoteTarget adapts to demand (see refillZygotes)
+struct zygote zygotePool[ZYGOTE_POOL_MAX];
+int zygoteCount = 0;
+int zygoteTarget = 1;
+int zygoteDemand = 0;         // helpers used since the last refill
+int zygoteRate = 0;           // smoothed demand per refill, times 4
+int zygotePending = 0;        // helpers asked for but not collected yet
+int zygoteControlFd = -1;     // socket to the zygote master
+pid_t zygoteMasterPid = -1;
+
+/**************************************************
+struct: shellState
+
+What a builtin may need from main: the status of the last
+foreground command (for status, and set by the utility
+builtins), the last foreground pid, the background job
+table and the SIGTSTP handler. exitRequested is set by exit.
+***************************************************/
+struct shellState {
+
+	int* childStatus;
+	int* lastForegroundPid;
+	struct jobTable* jobs;
+	struct sigaction SIGTSTP_action;
+	bool exitRequested;
+};
+
+/**************************************************
+struct: builtinEntry
+
+Entry of the builtin registry (see builtinTable): the
+command name and its handler. A utility (echo, cat, ...)
+stands in for a program of the same name: it runs in the
+shell only as a single foreground command, with its
+redirects applied to the shell's own stdin/stdout, and its
+return value becomes the status. Any handler may return
+BUILTIN_FALLBACK to have the program run instead.
+***************************************************/
+struct builtinEntry {
+
+	const char* name;
+	int (*handler)(commandStruct* currentCmdStruct, struct shellState* shell);
+	bool utility;
+};
+
+/**************************************************
+struct: serveClient
+
+A connection to the server (smallsh --serve). input holds
+bytes of frames not complete yet, output the answer frames
+not sent yet, from outputSent on. outstanding counts its
+requests queued or running; the connection is closed once
+the client has shut down its side and has nothing more
+coming.
+***************************************************/
+struct serveClient {
+
+	int fd;
+	char* input;
+	size_t inputLength;
+	size_t inputCapacity;
+	char* output;
+	size_t outputLength;
+	size_t outputSent;
+	size_t outputCapacity;
+	int outstanding;
+	bool readClosed;      // no more requests are read from it
+	bool broken;          // it went away: answers are dropped
+	bool writeWaiting;    // EPOLLOUT is on for it
+};
+
+/**************************************************
+struct: serveRequest
+
+A command line sent by a client, queued until one of the
+server's worker slots is free. Once started, pid is the
+worker process running it and outputFd the read end of its
+output pipe (-1 when the client did not ask for the output,
+or once the output has ended); held is set while the
+client is too far behind to be sent more of it. status is
+the worker's, as $? would show it.
+***************************************************/
+struct serveRequest {
+
+	int client;
+	uint32_t id;
+	bool capture;
+	char* line;
+	pid_t pid;
+	int outputFd;
+	bool held;
+	bool exited;
+	int status;
+	struct serveRequest* next;
+};
+
+/**************************************************
+struct: serverState
+
+State of smallsh --serve: the listening socket and its
+path, the server's own epoll instance and signalfd (for
+SIGCHLD and SIGTERM), the clients (a slot is free when its
+fd is -1), the queue of requests waiting for a worker slot
+and the limit slots themselves.
+***************************************************/
+struct serverState {
+
+	int listenFd;
+	int pollFd;
+	int signalFd;
+	const char* path;
+	sigset_t shellMask;           // signal mask workers go back to
+	struct serveClient* clients;
+	int clientCapacity;
+	struct serveRequest* queueHead;
+	struct serveRequest* queueTail;
+	struct serveRequest** running;
+	int limit;
+	int runningCount;
+	bool stopping;
+};
 
+struct serverState server = { -1, -1, -1 };
 
 // Function declarations
-char* expandInput(char* inputString);
-char* getInput();
+void* arenaAlloc(struct lineArena* arena, size_t size);
+void* arenaCalloc(struct lineArena* arena, size_t size);
+char* arenaStrdup(struct lineArena* arena, const char* source);
+void arenaReset(struct lineArena* arena);
+struct arenaMark arenaSave(struct lineArena* arena);
+void arenaRewind(struct lineArena* arena, struct arenaMark mark);
+void initVariables(void);
+struct shellVariable* findVariable(const char* name, size_t nameLength);
+void setVariable(const char* name, size_t nameLength, const char* value, size_t valueLength);
+void updateStatusVariable(int status);
+void setBackgroundVariable(pid_t processId);
+char* findClosingParen(char* open);
+int lexInput(char* inputString, struct lexToken* tokens);
+int tokenCapacity(const char* inputString);
+char* getInput(struct jobTable* jobs);
+void setupEventLoop(void);
+void initJobTable(struct jobTable* jobs);
+int addJob(struct jobTable* jobs, pid_t reportPid, bool timed);
+void addJobProcess(struct jobTable* jobs, int slot, pid_t processId);
+int findProcess(struct jobTable* jobs, pid_t processId);
+void removeProcess(struct jobTable* jobs, int position);
+void setupJobControl(void);
+void returnTerminal(struct jobEntry* job);
+char* describeCommand(commandStruct* currentCmdStruct);
+int trackJob(struct jobTable* jobs, commandStruct* currentCmdStruct, pid_t reportPid,
+	pid_t* processIds, int processCount, pid_t* pumpPids, int pumpCount);
+int currentJob(struct jobTable* jobs);
+int findJob(struct jobTable* jobs, const char* spec);
+void printJob(struct jobTable* jobs, int slot, int current);
+int signalJob(struct jobTable* jobs, int slot, int signo);
+bool reapNext(struct jobTable* jobs);
+bool parseDuration(const char* text, long long* durationMs);
+void startTimer(int timerFd, long long afterMs);
+void scheduleTimeout(struct jobTable* jobs, int slot, long long deadline);
+void checkJobTimeouts(struct jobTable* jobs);
+pid_t waitTimeout(pid_t processId, int* status, struct rusage* usage, int timerFd,
+	int* signalsSent, pid_t group, pid_t* processIds, int processCount, struct jobTable* jobs);
+int watchBackground(pid_t processId);
+void openInput(char* scriptPath);
+char* readInputLine(struct jobTable* jobs);
+int lastExitStatus(int* lastStatus);
 commandStruct* processInput(char* inputString);
+bool readHereDocuments(commandStruct* commandLine, struct jobTable* jobs);
+void openCompiledScript(const char* path, struct jobTable* jobs);
+bool nextCompiledLine(commandStruct** commandLine);
+void closeCompiledScript(void);
 void printCommandStruct(commandStruct* currentCmdStruct);
-void freeCommandStruct(commandStruct* currentCmdStruct);
-void exitProcess(char* inputString, commandStruct* currentCmdStruct);
+void freeCommandLine(void);
+void exitProcess(void);
+const struct builtinEntry* findBuiltin(const char* commandName);
+bool runBuiltin(commandStruct* currentCmdStruct, struct shellState* shell);
+bool runCommandList(commandStruct* commandList, struct shellState* shell);
 void cdProcess(char* pathString);
 void statusProcess(int* lastStatus, int* lastForegroundPid);
-void statusBackground(int* childStatus, int* childPid);
+void statusBackground(int* childStatus, int* childPid, bool timedOut, const char* limitHit, char* usageString);
+void addUsage(struct rusage* total, struct rusage* usage);
+void formatUsage(char* usageString, struct timespec* started, struct rusage* usage);
+void timeProcess(char** arguments);
+int timeoutProcess(char** arguments);
+long long metricClock(void);
+void countMetric(unsigned long* counter);
+void recordMetric(struct metricHistogram* histogram, long long elapsed);
+void setupMetrics(void);
+void writeMetrics(FILE* output, struct jobTable* jobs);
+void dumpMetrics(struct jobTable* jobs);
+void checkMetricsTimer(struct jobTable* jobs);
+void metricsProcess(struct jobTable* jobs);
 void handleSIGTSTP(int signo);
+void handleSIGINT(int signo);
+int openRedirects(commandStruct* currentCmdStruct, bool firstStage, bool lastStage,
+	int* inFd, int* outFd);
+int openHereInput(const char* data, size_t length);
+int openOutputTarget(struct outputTarget* target, bool spliced);
+int startFanOut(commandStruct* currentCmdStruct, int* outFd, pid_t* pumpPids);
+int openPipe(int pipeFds[2]);
+char* resolveCommand(char* commandName);
+void forgetCommand(char* commandName);
+char** shellArguments(char* execPath, char** arguments);
+void clearCommandCache(void);
+void hashProcess(char** arguments);
+bool spawnNeedsFork(commandStruct* currentCmdStruct);
+pid_t spawnCommand(commandStruct* currentCmdStruct, int inFd, int outFd, pid_t processGroup);
+void startZygotes(void);
+static commandStruct* parseList(struct lexToken* tokens, int* position, int tokenCount, bool nested, bool* failed);
+static commandStruct* parseLoop(struct lexToken* tokens, int* position, int tokenCount, bool* failed);
+static commandStruct* parsePipeline(struct lexToken* tokens, int start, int end);
+static void markVariables(commandStruct* commandList);
+static bool runLoop(struct loopStruct* loop, struct shellState* shell);
+static void requestZygotes(int requested);
+static void collectZygotes(void);
+static void discardZygote(struct zygote* helper);
+void refillZygotes(void);
+void closeZygotes(void);
+pid_t zygoteCommand(commandStruct* currentCmdStruct, char* execPath, int inFd, int outFd,
+	pid_t processGroup);
+pid_t forkCommand(commandStruct* currentCmdStruct, int inFd, int outFd,
+	int cgroupFd, pid_t processGroup, struct sigaction SIGTSTP_action);
+bool parseLimit(char* setting, struct cgroupPolicy* policy);
+bool policySet(struct cgroupPolicy* policy);
+int openShellCgroup(void);
+int applyPolicy(int cgroupFd, struct cgroupPolicy* policy);
+int createJobCgroup(struct cgroupPolicy* policy, unsigned int* cgroupId);
+const char* cgroupLimitHit(int cgroupFd);
+void removeJobCgroup(int cgroupFd, unsigned int cgroupId);
+void closeShellCgroup(void);
+void limitProcess(char** arguments);
 void executeAsChild(commandStruct* currentCmdStruct, int* statusCode,
-	int* lastForegroundPid, struct pidListHead* listHead,
+	int* lastForegroundPid, struct jobTable* jobs,
 	struct sigaction SIGTSTP_action);
-void processCheck(struct pidListHead* listHead);
+int processCheck(struct jobTable* jobs);
+int reapBackground(struct jobTable* jobs, pid_t processId, int processStatus,
+	struct rusage* usage);
+void parallelProcess(commandStruct* currentCmdStruct, int* statusCode,
+	struct jobTable* jobs, struct sigaction SIGTSTP_action);
+int serveClients(const char* path, int limit, struct shellState* shell);
+int connectServer(const char* path);
+int runClient(const char* path, bool capture);
+int runBenchmarks(int iterations, struct sigaction SIGTSTP_action);
 
 
 
-int main(void)
+int main(int argc, char* argv[])
 {
 	//pointer to command line structure
 	commandStruct* commandLine;
 	//raw input string from user
 	char* input;
 
-	//initialize pointer to head of linked list for tracking pids for 
-	// incomplete background processes
-	struct pidListHead* pidHead = malloc(sizeof(struct pidListHead));
-	pidHead->next = (void*)0;
+	// smallsh --client PATH [-o]: send stdin's lines to a server
+	if (argc > 2 && strcmp(argv[1], "--client") == 0)
+	{
+		return runClient(argv[2], argc > 3 && strcmp(argv[3], "-o") == 0);
+	}
+
+	//initialize table for tracking incomplete background jobs
+	struct jobTable* jobs = malloc(sizeof(struct jobTable));
+	initJobTable(jobs);
+
+	// smallsh --bench [iterations]: run the benchmark suite instead
+	bool benchMode = (argc > 1 && strcmp(argv[1], "--bench") == 0);
+	// smallsh --serve PATH [jobs]: run command lines sent to a socket
+	bool serveMode = (argc > 2 && strcmp(argv[1], "--serve") == 0);
+
+	// smallsh file.sh, or commands piped in: run as a script
+	openInput((argc > 1 && !benchMode && !serveMode) ? argv[1] : NULL);
+	if (benchMode || serveMode)
+	{
+		interactiveMode = false;
+	}
 
 	//intro header and intro display
-	printf("\n");
-	fflush(stdout);
-	printf("*************************************************\n");
-	fflush(stdout);
-	printf("$ smallsh\n");
-	fflush(stdout);
+	if (interactiveMode)
+	{
+		printf("\n");
+		fflush(stdout);
+		printf("*************************************************\n");
+		fflush(stdout);
+		printf("$ smallsh\n");
+		fflush(stdout);
+	}
 
 	int* childStatus = malloc(sizeof(int));
 	int* lastForegroundPid = malloc(sizeof(int));
 	bool active = true;
+	*childStatus = 0;
+	*lastForegroundPid = 0;
+	struct shellState shell = { childStatus, lastForegroundPid, jobs };
 
 	// set up custom signal handling for Ctrl-C /SIGINT: 
 	// shell/parent and child processes in background ignore SIGINT
@@ -148,13 +1113,112 @@ int main(void)
 	sigfillset(&SIGTSTP_action.sa_mask);
 	SIGTSTP_action.sa_flags = 0;
 	sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+	shell.SIGTSTP_action = SIGTSTP_action;
+
+	//SMALLSH_SPAWN=fork disables the posix_spawn fast path
+	char* spawnMode = getenv("SMALLSH_SPAWN");
+	if (spawnMode != NULL && strcmp(spawnMode, "fork") == 0)
+	{
+		forceForkSpawn = true;
+	}
+	//SMALLSH_SPAWN=zygote starts commands from pre-forked helpers
+	if (spawnMode != NULL && strcmp(spawnMode, "zygote") == 0)
+	{
+		zygoteMode = true;
+	}
+
+	//jobs get the terminal in turn when the shell runs on one
+	setupJobControl();
+	setupEventLoop();
+	initVariables();
+	if (zygoteMode)
+	{
+		startZygotes();
+	}
+
+	//SMALLSH_TIME=1 reports resource usage for every command
+	char* timeMode = getenv("SMALLSH_TIME");
+	if (timeMode != NULL && strcmp(timeMode, "1") == 0)
+	{
+		alwaysTime = true;
+	}
+
+	//SMALLSH_TIMEOUT=DURATION sets the default timeout of every command
+	char* timeoutSetting = getenv("SMALLSH_TIMEOUT");
+	long long timeoutDefault;
+	if (timeoutSetting != NULL && parseDuration(timeoutSetting, &timeoutDefault))
+	{
+		defaultTimeoutMs = timeoutDefault;
+	}
+
+	//SMALLSH_METRICS=file dumps metrics to a Prometheus textfile
+	metricsPath = getenv("SMALLSH_METRICS");
+	setupMetrics();
+
+	//SMALLSH_PIPE_SZ sets the buffer size (bytes) of pipeline pipes
+	char* pipeSize = getenv("SMALLSH_PIPE_SZ");
+	if (pipeSize != NULL)
+	{
+		pipeBufferSize = atoi(pipeSize);
+	}
+
+	//SMALLSH_TEE_SZ sets the buffer (bytes) a slow output target
+	//may fall behind by when output goes to several files
+	char* teeSize = getenv("SMALLSH_TEE_SZ");
+	if (teeSize != NULL)
+	{
+		teeBufferSize = atoi(teeSize);
+	}
+
+	if (benchMode)
+	{
+		return runBenchmarks(argc > 2 ? atoi(argv[2]) : 0, SIGTSTP_action);
+	}
+	if (serveMode)
+	{
+		return serveClients(argv[2], argc > 3 ? atoi(argv[3]) : 0, &shell);
+	}
+
+	//a script runs compiled, from its cache when it has not changed
+	if (argc > 1)
+	{
+		openCompiledScript(argv[1], jobs);
+	}
 
 	// main loop continues running until the user
 	// enters exit command
 	while (active)
 	{
-		input = getInput();
-		commandLine = processInput(input);
+		long long parseStart;
+		if (compiledImage != NULL)
+		{
+			// a compiled script's lines come ready to run
+			parseStart = metricClock();
+			if (!nextCompiledLine(&commandLine))
+			{
+				break;
+			}
+		}
+		else
+		{
+			input = getInput(jobs);
+
+			// end of input behaves like exit
+			if (input == NULL)
+			{
+				break;
+			}
+			parseStart = metricClock();
+			commandLine = processInput(input);
+		}
+		recordMetric(&metrics.parseTime, metricClock() - parseStart);
+		countMetric(&metrics.linesParsed);
+
+		// here-document bodies follow the line they belong to
+		if (compiledImage == NULL && commandLine != NULL && !readHereDocuments(commandLine, jobs))
+		{
+			commandLine = NULL;
+		}
 
 		// screens out unacceptable command line criteria
 		if (commandLine != NULL &&
@@ -165,807 +1229,10452 @@ int main(void)
 			//for testing
 			//printCommandStruct(commandLine);
 
-			//built-in command: cd
-			if (strcmp(commandLine->command, "cd") == 0)
-			{
-				cdProcess(commandLine->arguments[1]);
-			}
-			//built-in command: status
-			else if (strcmp(commandLine->command, "status") == 0)
-			{
-				statusProcess(childStatus, lastForegroundPid);
-			}
-			//built-in command: exit
-			else if (strcmp(commandLine->command, "exit") == 0)
+			//built-in commands (see builtinTable) run in the shell,
+			//loops through runLoop, the rest as child processes
+			runCommandList(commandLine, &shell);
+			if (shell.exitRequested)
 			{
-				exitProcess(input, commandLine);
 				break;
 			}
-			// execute as a child process
-			else
-			{
-				executeAsChild(commandLine, childStatus, lastForegroundPid, pidHead, SIGTSTP_action);
-			}
 		}
 
 		//checks for completion of background child processes
 		//in the tracking linked list and prints them out if completed
-		processCheck(pidHead);
+		processCheck(jobs);
+
+		//acts on background jobs out of time, which a script never
+		//waits at the prompt for
+		checkJobTimeouts(jobs);
+
+		//dumps metrics if the dump interval has passed
+		checkMetricsTimer(jobs);
 
 		//frees up the memory for command line structures
-		free(input);
-		if (commandLine != NULL)
-		{
-			freeCommandStruct(commandLine);
-		}
-		else
-		{
-			free(commandLine);
-		}
+		freeCommandLine();
+	}
+
+	int exitStatus = lastExitStatus(childStatus);
+	closeShellCgroup();
+	closeZygotes();
+	closeCompiledScript();
+	if (metricsPath != NULL)
+	{
+		dumpMetrics(jobs);
 	}
 
 	free(childStatus);
 	free(lastForegroundPid);
-	printf("\nMain program exiting. Goodbye!\n");
-	printf("\n");
-	return 0;
+	for (int slot = 0; slot < jobs->jobCapacity; slot++)
+	{
+		free(jobs->jobs[slot].commandText);
+	}
+	free(jobs->jobs);
+	free(jobs->index);
+	free(jobs);
+	if (interactiveMode)
+	{
+		printf("\nMain program exiting. Goodbye!\n");
+		printf("\n");
+		return 0;
+	}
+	// scripts report how their last command went
+	fflush(stdout);
+	return exitStatus;
 }
 
 /**************************************************
 Function: processCheck
 
-Function takes a pointer to the head of the
-background processes tracking list. Checks the list for
-completed background processes. Prints a message
-to terminal if any processes are found to be completed.
+Function takes a pointer to the background job table.
+Reaps every finished background process in one pass and
+prints a message to terminal for each job whose last
+process is done, or that has been stopped. The SIGCHLD
+signalfd is drained first so the event loop only wakes
+again for new exits.
+
+Returns the number of jobs reported.
 
 ***************************************************/
 
-void processCheck(struct pidListHead* listHead)
+int processCheck(struct jobTable* jobs)
 {
-	struct pidNode* currentNode;
-	struct pidNode* prevNode;
-	struct pidNode* tempNode;
+	struct signalfd_siginfo childInfo;
 
 	int processStatus;
+	int reported = 0;
 	pid_t processId;
+	struct rusage usage;
 
-	//if the list has been populated
-	if (listHead->next != (void*)0)
+	// SIGCHLDs coalesce, so the count read here means nothing:
+	// the waitpid loop below is what finds every exit
+	while (childSignalFd != -1 && read(childSignalFd, &childInfo, sizeof(childInfo)) > 0)
 	{
-		currentNode = listHead->next;
-		prevNode = currentNode;
-		tempNode = (void*)0;
+	}
 
-		//check for finished background processes
-		if ((processId = waitpid(-1, &processStatus, WNOHANG)) > 0)
-		{
-			// print messages about process status
-			statusBackground(&processStatus, &processId);
-
-			//check to see if first node is the match
-			if (*currentNode->process == processId)
-			{
-				if (currentNode->next != (void*)0)
-				{
-					tempNode = currentNode;
-					listHead->next = currentNode->next;
-					free(tempNode->process);
-					free(tempNode);
-				}
-			}
-			else
-				// check other elements in list
-			{
-				while ((currentNode != (void*)0))
-				{
-					if (*currentNode->process == processId)
-					{
-						tempNode = currentNode;
-						currentNode = currentNode->next;
-						prevNode->next = currentNode;
-
-						free(tempNode->process);
-						free(tempNode);
-						break;
-					}
-					else
-					{
-						prevNode = currentNode;
-						currentNode = currentNode->next;
-					}
-				}
-			}
-		}
+	//check for finished background processes
+	while (jobs->indexCount > 0
+		&& (processId = wait4(-1, &processStatus, WNOHANG | WUNTRACED | WCONTINUED, &usage)) > 0)
+	{
+		reported += reapBackground(jobs, processId, processStatus, &usage);
 	}
+
+	return reported;
 }
 
 /**************************************************
-Function: expandInput
-
-Function takes an input string and processes it to identify
-substitute the processID for the expansion variable '$$' wherever
-it occurs. Dynamically allocates a new string with the expanded
-command line. Returns pointer to new array.
-
-References:
-Strategy for using strstr() string function based on source:
-https://www.tutorialspoint.com/c_standard_library/c_function_strstr.htm
-
+Function: reapBackground
+
+Function takes a pointer to the background job table and
+a process that has just been reaped with its status and
+resource usage (from wait4). If it belongs to a background
+job it is dropped from the table, and once it was the job's
+last live process the job is reported, with the cgroup
+limit that killed it if any and its resource usage if it
+was timed, and its slot (and cgroup) freed. A job brought
+to the foreground by fg is not reported; its status is left
+in lastStatus. A process that was stopped or continued
+(WUNTRACED / WCONTINUED) stops or restarts its whole job
+instead, and a newly stopped job is listed as by jobs.
+
+Returns 1 if a job was reported, 0 otherwise (including
+for pids that are not background processes).
 ***************************************************/
 
-char* expandInput(char* inputString) {
+int reapBackground(struct jobTable* jobs, pid_t processId, int processStatus, struct rusage* usage)
+{
+	int position = findProcess(jobs, processId);
 
-	//Get count of how many times $$ appears in the string
-	//Convert pid to string and get length
-	int pidMaxLength = 12;
-	long processID = (long)getpid();
-	char pidString[pidMaxLength + 1];
-	snprintf(pidString, pidMaxLength, "%ld", processID);
-	long pidLength = (long)strlen(pidString);
-	
-	int i = 0;
-	char* ptrCur = inputString;
-	//char* ptrNext = inputString + 1;
-	int symbolCounter = 0;
-	
-	// iterate through the input string and count instances
-	// of the expansion variable -- Working Version
-	for (i = 0; inputString[i] != '\0'; i++) 
-	{
-		//strstr() returns address where substring begins if it is found
-		// as the array ptr moves forward, the string field gets smaller
-		if (strstr(&inputString[i], EXP) == &inputString[i]) {
-			symbolCounter++;
-			i++;
-		}
+	// not one of ours (nothing else should be left unreaped)
+	if (position == -1)
+	{
+		return 0;
 	}
-	//printf("$$ appeared %d times\n", symbolCounter); //for testing
-	//fflush(stdout);
-
-	//int inputStringLength = strlen(inputString);
-	int newStringLength = i + (((int)pidLength-2) * symbolCounter);
 
-	char* expandedString = calloc(newStringLength + 1, (int)sizeof(char));
+	int slot = jobs->index[position].slot;
+	struct jobEntry* job = &jobs->jobs[slot];
 
-	// go through the inputString and write to the expandedString with pid
-	ptrCur = inputString;
-	i = 0;
-	
-	while (*ptrCur)
+	// one stopped or continued process stands for the whole job
+	if (WIFSTOPPED(processStatus) || WIFCONTINUED(processStatus))
 	{
-		//strstr() returns address where substring begins if it is found
-		// as the array ptr moves forward, the string field gets smaller
-		if (ptrCur == strstr(ptrCur, EXP))
+		int stopSignal = WIFSTOPPED(processStatus) ? WSTOPSIG(processStatus) : 0;
+		if ((stopSignal != 0) == (job->stopSignal != 0))
 		{
-			strcpy(&expandedString[i], pidString);
-			i += (int)strlen(pidString);
-			ptrCur += 2;
+			return 0;
 		}
-		else 
+		jobs->stoppedCount += (stopSignal != 0) ? 1 : -1;
+		job->stopSignal = stopSignal;
+		job->sequence = ++jobs->sequence;
+		if (stopSignal == 0)
 		{
-			expandedString[i] = (int)*ptrCur;
-			i++;
-			ptrCur++;
+			return 0;
 		}
+		job->foreground = false;
+		printJob(jobs, slot, currentJob(jobs));
+		return 1;
 	}
 
-	free(inputString);
-	return expandedString;
-}
+	removeProcess(jobs, position);
 
+	if (processId == job->pid)
+	{
+		job->lastStatus = processStatus;
+	}
+	if (job->timed)
+	{
+		addUsage(&job->usage, usage);
+	}
+	if (--job->liveProcs > 0)
+	{
+		return 0;
+	}
 
-/**************************************************
-Function: getInput
+	long long startedAt = (long long)job->started.tv_sec * 1000000000LL + job->started.tv_nsec;
+	recordMetric(&metrics.jobLifetime, metricClock() - startedAt);
+	countMetric(&metrics.jobsFinished);
 
-Function displays command prompt and collects user
-input. Returns pointer to character array allocated dynamically
-in function. User input string is returned with the variable $$
-expanded within the return string. Memory for string allocated
-dynamically within function, so must be freed later.
+	// a job in its own cgroup may have been killed by one of its limits
+	const char* limitHit = NULL;
+	if (job->cgroupFd != -1)
+	{
+		limitHit = cgroupLimitHit(job->cgroupFd);
+		removeJobCgroup(job->cgroupFd, job->cgroupId);
+		job->cgroupFd = -1;
+	}
 
-***************************************************/
+	// print messages about process status (fg reports its own job)
+	if (job->foreground)
+	{
+		lastLimitHit = limitHit;
+		lastTimedOut = job->timedOut;
+	}
+	else if (job->timed)
+	{
+		char usageString[USAGE_STRING_LENGTH];
+		formatUsage(usageString, &job->started, &job->usage);
+		statusBackground(&job->lastStatus, &job->pid, job->timedOut, limitHit, usageString);
+	}
+	else
+	{
+		statusBackground(&job->lastStatus, &job->pid, job->timedOut, limitHit, NULL);
+	}
 
-char* getInput() {
+	if (job->stopSignal != 0)
+	{
+		jobs->stoppedCount--;
+		job->stopSignal = 0;
+	}
+	free(job->commandText);
+	job->commandText = NULL;
+	struct finishedJob* finished = &jobs->finished[jobs->finishedCount++ % FINISHED_JOBS];
+	finished->pid = job->pid;
+	finished->status = job->lastStatus;
+
+	// return the slot to the free list
+	job->pid = 0;
+	job->nextFree = jobs->freeHead;
+	jobs->freeHead = slot;
+	jobs->jobCount--;
+
+	// with no jobs left, job IDs start again from 1
+	if (jobs->jobCount == 0 && jobs->freeHead != 0)
+	{
+		for (int i = 0; i < jobs->jobCapacity; i++)
+		{
+			jobs->jobs[i].nextFree = (i + 1 < jobs->jobCapacity) ? i + 1 : -1;
+		}
+		jobs->freeHead = 0;
+	}
 
-	//Show the command prompt, which is ":"
-	
-	printf(": ");
-	fflush(stdout);
+	return 1;
+}
 
-	//shell supports command lines with max length of 2048 chars
-	char* inputString = calloc(MAX_ARG_LENGTH + 1, sizeof(char));
-	fgets(inputString, MAX_ARG_LENGTH, stdin);
+/**************************************************
+Function: initJobTable
 
-	inputString = expandInput(inputString);
+Function takes a pointer to a job table and sets it up
+empty, with room for 16 jobs before either array grows.
+***************************************************/
 
-	return inputString;
-}
+void initJobTable(struct jobTable* jobs)
+{
+	jobs->jobCapacity = 16;
+	jobs->jobs = calloc(jobs->jobCapacity, sizeof(struct jobEntry));
+	jobs->jobCount = 0;
+	jobs->stoppedCount = 0;
+	jobs->sequence = 0;
+	jobs->finishedCount = 0;
+
+	// every slot starts on the free list, lowest ID first
+	for (int i = 0; i < jobs->jobCapacity; i++)
+	{
+		jobs->jobs[i].nextFree = (i + 1 < jobs->jobCapacity) ? i + 1 : -1;
+	}
+	jobs->freeHead = 0;
 
+	jobs->indexCapacity = 64;
+	jobs->index = calloc(jobs->indexCapacity, sizeof(struct pidSlot));
+	jobs->indexCount = 0;
+}
 
 /**************************************************
-Function: printCommandStruct
+Function: hashPid
 
-Function takes a pointer to commandStruct and prints out its
-members. Used in development.
+Function takes a pid and the (power of two) capacity of
+the pid index and returns the home position of the pid.
+Fibonacci hashing spreads the sequential pids the kernel
+hands out across the whole table.
+***************************************************/
+
+static inline int hashPid(pid_t processId, int capacity)
+{
+	return (int)(((unsigned int)processId * 2654435769u) & (unsigned int)(capacity - 1));
+}
 
+/**************************************************
+Function: addJob
+
+Function takes a pointer to the job table and the pid that
+will be reported for a new job, takes a slot off the free
+list (doubling the slot array if there is none) and returns
+it. The job's ID is the slot + 1. Processes are attached to
+the job with addJobProcess. Its start time is recorded for
+the job lifetime metric; a timed job also has its resource
+usage collected as it is reaped.
 ***************************************************/
 
-void printCommandStruct(commandStruct* currentCmdStruct)
+int addJob(struct jobTable* jobs, pid_t reportPid, bool timed)
 {
-	int i = 0;
-	if (currentCmdStruct != NULL)
+	if (jobs->freeHead == -1)
 	{
-		if (currentCmdStruct->command != NULL)
-		{
-			printf("Command is: %s \n", currentCmdStruct->command);
-			fflush(stdout);
-		}
-		if (currentCmdStruct->arguments[i] != NULL)
-		{
-			for (i = 0; i < MAX_ARGS + 1; i++) {
-				if (currentCmdStruct->arguments[i] != NULL)
-				{
-					printf("Argument %d is: %s \n", i, currentCmdStruct->arguments[i]);
-					fflush(stdout);
-				}
-				else
-				{
-					break;
-				}
-			}
-		}
+		int oldCapacity = jobs->jobCapacity;
 
-		if (currentCmdStruct->inputRedir != NULL)
-		{
-			printf("Redirect input to: %s\n", currentCmdStruct->inputRedir);
-			fflush(stdout);
-		}
-		else
+		jobs->jobCapacity *= 2;
+		jobs->jobs = realloc(jobs->jobs, jobs->jobCapacity * sizeof(struct jobEntry));
+		memset(&jobs->jobs[oldCapacity], 0, oldCapacity * sizeof(struct jobEntry));
+		for (int i = oldCapacity; i < jobs->jobCapacity; i++)
 		{
-			printf("Redirect input to: Nothing entered\n");
-			fflush(stdout);
+			jobs->jobs[i].nextFree = (i + 1 < jobs->jobCapacity) ? i + 1 : -1;
 		}
+		jobs->freeHead = oldCapacity;
+	}
 
-		if (currentCmdStruct->outputRedir != NULL)
-		{
-			printf("Redirect output to: %s\n", currentCmdStruct->outputRedir);
-			fflush(stdout);
-		}
-		else
-		{
-			printf("Redirect output to: Nothing entered\n");
-			fflush(stdout);
-		}
-		printf("Background mode is: %s\n", currentCmdStruct->bkgrdInd ? "true" : "false");
-		fflush(stdout);
+	int slot = jobs->freeHead;
+	struct jobEntry* job = &jobs->jobs[slot];
+
+	jobs->freeHead = job->nextFree;
+	job->pid = reportPid;
+	job->liveProcs = 0;
+	job->lastStatus = 0;
+	job->nextFree = -1;
+	job->timed = timed;
+	job->cgroupFd = -1;
+	job->pgid = -1;
+	job->stopSignal = 0;
+	job->sequence = ++jobs->sequence;
+	job->commandText = NULL;
+	job->foreground = false;
+	job->hasModes = false;
+	job->deadline = 0;
+	job->timedOut = false;
+	clock_gettime(CLOCK_MONOTONIC, &job->started);
+	if (timed)
+	{
+		memset(&job->usage, 0, sizeof(job->usage));
 	}
+	jobs->jobCount++;
+	countMetric(&metrics.jobsStarted);
 
+	return slot;
 }
 
-
 /**************************************************
-Function: processInput
-
-Function takes pointer to an input string and processes
-it, returning a pointer to a commandStruct whose elements 
-are allocated dynamically on the heap. The commandStruct 
-that is returned has 5 members representing all 5 categories 
-of command line input.
+Function: insertIndex
 
+Function places an entry in the pid index without checking
+the load factor. Used by addJobProcess and when the index
+is rebuilt at a bigger size.
 ***************************************************/
 
-commandStruct* processInput(char* inputString) {
-	
-	//allocate dynamic memory
-	commandStruct* currentCommand = malloc(sizeof(commandStruct));
-	currentCommand->bkgrdInd = false;
-
-	//use strtok_r to separate the input -- first token is command part
-	char* tkPtr;
-	char* tk = strtok_r(inputString, " \n", &tkPtr);
+static void insertIndex(struct pidSlot* index, int capacity, struct pidSlot entry)
+{
+	int position = hashPid(entry.pid, capacity);
 
-	// if token is empty (there was no input)
-	if (tk == NULL)
+	while (index[position].pid != 0)
 	{
-		return NULL;
+		position = (position + 1) & (capacity - 1);
 	}
-	//populate the new structure -- each element created dynamically
-	// command string
-	currentCommand->command = calloc(strlen(tk) + 1, sizeof(char));
-	strcpy(currentCommand->command, tk);
-	
-	// first element of argument array is same as command
-	currentCommand->arguments[0] = calloc(strlen(currentCommand->command) + 1, sizeof(char));
-	strcpy(currentCommand->arguments[0], currentCommand->command);
+	index[position] = entry;
+}
 
-	//get all arguments from raw input into the arguments array
-	int index = 1;   //arguments start at the second element of array
-	tk = strtok_r(NULL, " \n", &tkPtr);
+/**************************************************
+Function: addJobProcess
 
-	// Loops through input and sends space-delimited tokens to arguments
-	// array. Stops when it encounters any of the special characters ( <, >, & )
-	while(tk != NULL && (strcmp(tk, IN) != 0) 
-		&& (strcmp(tk, OUT) != 0)
-		&& (strcmp(tk, BKGRD) != 0))
-	{
-		currentCommand->arguments[index] = calloc(strlen(tk) + 1, sizeof(char));
-		strcpy(currentCommand->arguments[index], tk);
-		tk = strtok_r(NULL, " \n", &tkPtr);
-		index++;
-	}
+Function takes a pointer to the job table, a job slot from
+addJob and a process started for that job. Adds the process
+to the pid index (growing it when it would be more than half
+full) and registers a pidfd for it with the event loop.
+***************************************************/
 
-	// Final element after arguments entered in array should be NULL pointer
-	currentCommand->arguments[index] = calloc(1, sizeof(char));
-	currentCommand->arguments[index] = NULL;
+void addJobProcess(struct jobTable* jobs, int slot, pid_t processId)
+{
+	struct pidSlot entry;
 
-	// Allocate and assign input and output redirection members
-	// if they are present in the input
-	do {
-		if (tk != NULL && (strcmp(tk, IN) == 0))
-		{
-			//printf("Current token is: %s\n", token); //for testing
-			//fflush(stdout);
+	if ((jobs->indexCount + 1) * 2 > jobs->indexCapacity)
+	{
+		struct pidSlot* oldIndex = jobs->index;
+		int oldCapacity = jobs->indexCapacity;
 
-			// "<" token present, so save next token as input source
-			tk = strtok_r(NULL, " \n", &tkPtr);
-			if (tk != NULL) {
-				currentCommand->inputRedir = calloc(strlen(tk) + 1, sizeof(char));
-				strcpy(currentCommand->inputRedir, tk);
-			}
-			else { 
-				printf("Syntax error after \"<\" \n");
-				break; // in case next token is empty
-			} 
-		}
-		// ">" token present, so save next token as output target
-		else if (tk != NULL && (strcmp(tk, OUT) == 0))
+		jobs->indexCapacity *= 2;
+		jobs->index = calloc(jobs->indexCapacity, sizeof(struct pidSlot));
+		for (int i = 0; i < oldCapacity; i++)
 		{
-			tk = strtok_r(NULL, " \n", &tkPtr);
-			if (tk != NULL) {
-				currentCommand->outputRedir = calloc(strlen(tk) + 1, sizeof(char));
-				strcpy(currentCommand->outputRedir, tk);
+			if (oldIndex[i].pid != 0)
+			{
+				insertIndex(jobs->index, jobs->indexCapacity, oldIndex[i]);
 			}
-			else { 
-				printf("Syntax error after \">\"\n");
-				fflush(stdout);
-				break; // in case next token is empty
-			} 
-		}
-		// & token present, so this command should run in background mode
-		else if (tk != NULL && (strcmp(tk, BKGRD) == 0))
-		{
-			currentCommand->bkgrdInd = true;
 		}
+		free(oldIndex);
+	}
 
-		tk = strtok_r(NULL, " \n", &tkPtr);
-
-	} while (tk != NULL);
+	entry.pid = processId;
+	entry.slot = slot;
+	entry.pidfd = watchBackground(processId);
+	insertIndex(jobs->index, jobs->indexCapacity, entry);
 
-	return currentCommand;
+	jobs->indexCount++;
+	jobs->jobs[slot].liveProcs++;
 }
 
-
 /**************************************************
-Function: freeCommandStruct
+Function: findProcess
+
+Function takes a pointer to the job table and a pid and
+returns the position of the pid in the index, or -1 if it
+is not a background process.
+***************************************************/
+
+int findProcess(struct jobTable* jobs, pid_t processId)
+{
+	int position = hashPid(processId, jobs->indexCapacity);
+
+	while (jobs->index[position].pid != 0)
+	{
+		if (jobs->index[position].pid == processId)
+		{
+			return position;
+		}
+		position = (position + 1) & (jobs->indexCapacity - 1);
+	}
+	return -1;
+}
 
-Function takes a pointer to a commandStruct and frees the dynamically
-allocated memory for the structure.
+/**************************************************
+Function: removeProcess
 
+Function takes a pointer to the job table and a position
+returned by findProcess. Closes the process's pidfd (which
+also drops it from the epoll set) and removes it from the
+index. Later entries of the probe run are shifted back into
+the hole, so no tombstones build up and lookups stay short.
 ***************************************************/
 
-void freeCommandStruct(commandStruct * currentCmdStruct)
+void removeProcess(struct jobTable* jobs, int position)
 {
-	if (currentCmdStruct != NULL)
+	int mask = jobs->indexCapacity - 1;
+	int hole = position;
+	int next = (position + 1) & mask;
+
+	if (jobs->index[position].pidfd != -1)
 	{
-		currentCmdStruct->outputRedir = (void*)0;
-		free(currentCmdStruct->command);
+		close(jobs->index[position].pidfd);
 	}
 
-	for (int i = 0; i < MAX_ARGS + 1; i++)
+	while (jobs->index[next].pid != 0)
 	{
-		if (currentCmdStruct->arguments[i] != NULL)
-		{
-			currentCmdStruct->outputRedir = (void*)0;
-			free(currentCmdStruct->arguments[i]);
-		}
+		int home = hashPid(jobs->index[next].pid, jobs->indexCapacity);
 
-		else
+		// move the entry back if its home is not in (hole, next]
+		if (((next - home) & mask) >= ((next - hole) & mask))
 		{
-			//free the final allocated pointer to NULL
-			//free(currentCmdStruct->arguments[i]);
-			break;
+			jobs->index[hole] = jobs->index[next];
+			hole = next;
 		}
+		next = (next + 1) & mask;
 	}
 
-	if (currentCmdStruct->inputRedir != NULL)
+	jobs->index[hole].pid = 0;
+	jobs->indexCount--;
+}
+
+/**************************************************
+Function: setupJobControl
+
+Function turns job control on when the shell is interactive
+on a terminal. A shell started in the background waits until
+it is brought to the foreground; then it leads a process
+group of its own, takes the terminal for it and keeps the
+terminal's modes to put back after each job. SIGTTIN and
+SIGTTOU are ignored so the shell can hand the terminal back
+and forth; the spawn paths give children the defaults.
+***************************************************/
+
+void setupJobControl(void)
+{
+	struct sigaction ignore_action = { {0} };
+	pid_t owner;
+
+	if (!interactiveMode || !isatty(terminalFd))
 	{
-		currentCmdStruct->inputRedir = (void*)0; //seemed to clear up a segfault in freeing mem
-		free(currentCmdStruct->inputRedir);
+		return;
 	}
 
-	if (currentCmdStruct->outputRedir != NULL)
+	while ((owner = tcgetpgrp(terminalFd)) != -1 && owner != getpgrp())
 	{
-		currentCmdStruct->outputRedir = (void*)0;
-		free(currentCmdStruct->outputRedir);
+		kill(-getpgrp(), SIGTTIN);
+	}
+	if (owner == -1)
+	{
+		return;
 	}
-	free(currentCmdStruct);
-}
 
+	ignore_action.sa_handler = SIG_IGN;
+	sigaction(SIGTTIN, &ignore_action, NULL);
+	sigaction(SIGTTOU, &ignore_action, NULL);
+
+	// a session leader already leads its group
+	setpgid(0, 0);
+	shellGroup = getpgrp();
+	tcsetpgrp(terminalFd, shellGroup);
+	tcgetattr(terminalFd, &shellModes);
+	jobControl = true;
+}
 
 /**************************************************
-Function: exitProcess
-
-Function takes a pointer to an inputString and a commandStruct 
-and frees the dynamically allocated memory for the structure.
+Function: returnTerminal
 
+Function takes the job that had the terminal, or NULL if it
+has ended, and gives the terminal back to the shell with the
+shell's modes. A job that was only stopped keeps the modes
+it left, for fg to put back. Does nothing without job
+control.
 ***************************************************/
-void exitProcess(char* inputString, commandStruct* currentCmdStruct)
+
+void returnTerminal(struct jobEntry* job)
 {
-	free(inputString); 
-	freeCommandStruct(currentCmdStruct);
+	if (!jobControl)
+	{
+		return;
+	}
+	if (job != NULL)
+	{
+		job->hasModes = (tcgetattr(terminalFd, &job->terminalModes) == 0);
+	}
+	tcsetpgrp(terminalFd, shellGroup);
+	tcsetattr(terminalFd, TCSADRAIN, &shellModes);
 }
 
 /**************************************************
-Function: cdProcess
-
-Function takes string with path to desired directory and
-changes the current working directory of the process.
+Function: describeCommand
 
-References:
-Code adapted from examples at:
-https://iq.opengenus.org/chdir-fchdir-getcwd-in-c/
-and
-Module 4: Exploration on Environment
-https://canvas.oregonstate.edu/courses/1830250/pages/
-exploration-environment?module_item_id=21468875
+Function takes a populated command struct and returns its
+pipeline as a malloc'd string, the words of each stage
+separated by spaces and the stages by " | ", for jobs.
 ***************************************************/
 
-void cdProcess(char* pathString)
+char* describeCommand(commandStruct* currentCmdStruct)
 {
-	char* newDir;
-	char cwd[256];
+	size_t length = 1;
 
-	if (pathString == NULL) 
+	for (commandStruct* stage = currentCmdStruct; stage != NULL; stage = stage->nextStage)
 	{
-		newDir = getenv("HOME");
+		for (int i = 0; i < stage->argCount; i++)
+		{
+			length += strlen(stage->arguments[i]) + 1;
+		}
+		length += 2;
 	}
-	else
+
+	char* text = malloc(length);
+	char* next = text;
+	for (commandStruct* stage = currentCmdStruct; stage != NULL; stage = stage->nextStage)
 	{
-		newDir = pathString;
+		if (stage != currentCmdStruct)
+		{
+			memcpy(next, "| ", 2);
+			next += 2;
+		}
+		for (int i = 0; i < stage->argCount; i++)
+		{
+			size_t argLength = strlen(stage->arguments[i]);
+			memcpy(next, stage->arguments[i], argLength);
+			next += argLength;
+			*next++ = ' ';
+		}
 	}
-	
-	if (chdir(newDir) != 0)
+	// drop the last space
+	if (next > text)
 	{
-		perror("chdir() error()");
-		fflush(stdout);
+		next--;
 	}
-	else 
+	*next = '\0';
+	return text;
+}
+
+/**************************************************
+Function: trackJob
+
+Function takes the job table, the command a job runs, the
+pid to report it under, its processes (-1 entries are
+skipped) and the fan-out processes of its output, adds a
+job for them and returns its slot.
+***************************************************/
+
+int trackJob(struct jobTable* jobs, commandStruct* currentCmdStruct, pid_t reportPid,
+	pid_t* processIds, int processCount, pid_t* pumpPids, int pumpCount)
+{
+	int slot = addJob(jobs, reportPid, currentCmdStruct->timed);
+
+	for (int i = 0; i < processCount; i++)
 	{
-		if (getcwd(cwd, sizeof(cwd)) == NULL)
+		if (processIds[i] != -1)
 		{
-			perror("getcwd() error");
-			fflush(stdout);
+			addJobProcess(jobs, slot, processIds[i]);
 		}
-		else
+	}
+	for (int pump = 0; pump < pumpCount; pump++)
+	{
+		if (pumpPids[pump] != -1)
 		{
-			//printf("Current directory is: %s \n", cwd); //for testing
-			//fflush(stdout);
+			addJobProcess(jobs, slot, pumpPids[pump]);
 		}
 	}
+	jobs->jobs[slot].commandText = describeCommand(currentCmdStruct);
+	return slot;
 }
 
-
 /**************************************************
-Function: statusProcess
-
-Function takes int pointer to status code and last
-Foreground process ID. Prints out exit code or
-exit signal of last process
+Function: currentJob
 
-References:
-Code directly based on examples from
-Course Module 4: Monitoring Child Processes
-https://canvas.oregonstate.edu/courses/1830250/pages/
-exploration-process-api-monitoring-child-processes?module_item_id=21468873
+Function takes the job table and returns the slot of the
+current job, the one fg and bg act on by default: the job
+stopped last if any is stopped, else the job started (or
+continued) last. Returns -1 if there are no jobs.
 ***************************************************/
-void statusProcess(int* lastStatus, int* lastForegroundPid)
+
+int currentJob(struct jobTable* jobs)
 {
-	//printf("Status process function input:  %d\n", *lastStatus); //for testing
-	//fflush(stdout);
+	int current = -1;
 
-	if (WIFEXITED(*lastStatus)) {
-		//for testing
-		//printf("process (%d) exit value %d\n", *lastForegroundPid, WEXITSTATUS(*lastStatus));
-		printf("exit value %d\n", WEXITSTATUS(*lastStatus));
-		fflush(stdout);
-	}
-	else {
-		//for testing
-		//printf("process (%d) terminated by signal %d\n", *lastForegroundPid, WTERMSIG(*lastStatus));
-		printf("terminated by signal %d\n", WTERMSIG(*lastStatus));
-		fflush(stdout);
+	for (int slot = 0; slot < jobs->jobCapacity && jobs->jobCount > 0; slot++)
+	{
+		struct jobEntry* job = &jobs->jobs[slot];
+		if (job->pid == 0)
+		{
+			continue;
+		}
+
+		if (current == -1)
+		{
+			current = slot;
+			continue;
+		}
+		bool stopped = (job->stopSignal != 0);
+		bool currentStopped = (jobs->jobs[current].stopSignal != 0);
+		if (stopped > currentStopped
+			|| (stopped == currentStopped && job->sequence > jobs->jobs[current].sequence))
+		{
+			current = slot;
+		}
 	}
+	return current;
 }
 
 /**************************************************
-Function: statusBackground
-
-Function takes int pointers representing a status of 
-a child process and a process ID and prints out messages 
-about their resolution to the console. Part of the process of
-monitoring and checking background processes.
+Function: findJob
 
-References:
-Code directly based on examples from
-Course Module 4: Monitoring Child Processes
-https://canvas.oregonstate.edu/courses/1830250/pages/
-exploration-process-api-monitoring-child-processes?module_item_id=21468873
+Function takes the job table and a job as the builtins name
+it: %n for job n, %%, %+ or NULL for the current job, or the
+pid of one of the job's processes. Returns the job's slot,
+or -1 if there is no such job.
 ***************************************************/
 
-void statusBackground(int* childStatus, int* childPid)
+int findJob(struct jobTable* jobs, const char* spec)
 {
-	
-	if (WIFEXITED(*childStatus)) {
-		
-		printf("background pid %d is done: exit value %d\n",*childPid, WEXITSTATUS(*childStatus));
-		fflush(stdout);
+	char* end;
+
+	if (spec == NULL || strcmp(spec, "%") == 0 || strcmp(spec, "%%") == 0 || strcmp(spec, "%+") == 0)
+	{
+		return currentJob(jobs);
 	}
-	else {
-		
-		printf("background pid %d is done: terminated by signal %d\n",*childPid, WTERMSIG(*childStatus));
-		fflush(stdout);
+
+	long number = strtol(spec + (spec[0] == '%'), &end, 10);
+	if (end == spec + (spec[0] == '%') || *end != '\0' || number <= 0)
+	{
+		return -1;
+	}
+
+	if (spec[0] == '%')
+	{
+		if (number > jobs->jobCapacity || jobs->jobs[number - 1].pid == 0)
+		{
+			return -1;
+		}
+		return (int)number - 1;
+	}
+
+	int position = findProcess(jobs, (pid_t)number);
+	if (position != -1)
+	{
+		return jobs->index[position].slot;
+	}
+	// the reported process may be gone while the rest runs on
+	for (int slot = 0; slot < jobs->jobCapacity; slot++)
+	{
+		if (jobs->jobs[slot].pid == (pid_t)number)
+		{
+			return slot;
+		}
 	}
+	return -1;
 }
 
+/**************************************************
+Function: printJob
+
+Function takes the job table, a job's slot and the current
+job's slot and prints the job as jobs lists it:
+[n]+ Running|Stopped pid command, with + marking the
+current job.
+***************************************************/
+
+void printJob(struct jobTable* jobs, int slot, int current)
+{
+	struct jobEntry* job = &jobs->jobs[slot];
+
+	printf("[%d]%c %s %d %s\n", slot + 1, (slot == current) ? '+' : ' ',
+		(job->stopSignal != 0) ? "Stopped" : "Running", job->pid,
+		(job->commandText != NULL) ? job->commandText : "");
+	fflush(stdout);
+}
 
 /**************************************************
-Function: handleSIGSTP
+Function: signalJob
 
- Signal handler function to switch modes for running 
- after receiving SIGTSTP
+Function takes the job table, a job's slot and a signal and
+sends the signal to the job's process group, or to each of
+its processes when it has none of its own. Returns 0, or -1
+with errno set if no process could be signalled.
+***************************************************/
 
-References:
-Course materials: Exploration: Signal handling API:
-https://canvas.oregonstate.edu/courses/1830250/pages/
-exploration-signal-handling-api?module_item_id=21468881
+int signalJob(struct jobTable* jobs, int slot, int signo)
+{
+	struct jobEntry* job = &jobs->jobs[slot];
+	int result = -1;
 
-Signals, Benjamin Brewster, YouTube: https://www.youtube.com/watch?v=VwS3dx3uyiQ
+	if (job->pgid > 0)
+	{
+		return kill(-job->pgid, signo);
+	}
+	errno = ESRCH;
+	for (int i = 0; i < jobs->indexCapacity; i++)
+	{
+		if (jobs->index[i].pid != 0 && jobs->index[i].slot == slot && kill(jobs->index[i].pid, signo) == 0)
+		{
+			result = 0;
+		}
+	}
+	return result;
+}
+
+/**************************************************
+Function: reapNext
+
+Function takes the job table and sleeps until any child
+changes state (ends, stops or is continued), then hands it
+to reapBackground. This is what the waiting builtins block
+in, so a wait costs nothing until something happens: poll
+on the SIGCHLD signalfd and the job timer, whose deadlines
+are enforced meanwhile (checkJobTimeouts). Returns false if
+there is no child to wait for.
 ***************************************************/
 
+bool reapNext(struct jobTable* jobs)
+{
+	struct pollfd watched[2] = { { childSignalFd, POLLIN, 0 }, { jobTimerFd, POLLIN, 0 } };
+	struct signalfd_siginfo childInfo;
+	int processStatus;
+	pid_t processId;
+	struct rusage usage;
 
-void handleSIGTSTP(int signo) 
+	while (true)
+	{
+		// drained before the wait4, so the poll wakes for new changes only
+		while (childSignalFd != -1 && read(childSignalFd, &childInfo, sizeof(childInfo)) > 0)
+		{
+		}
+		// (without the signalfd there is nothing to poll: block in wait4)
+		processId = wait4(-1, &processStatus, WUNTRACED | WCONTINUED | ((childSignalFd != -1) ? WNOHANG : 0), &usage);
+		if (processId > 0)
+		{
+			reapBackground(jobs, processId, processStatus, &usage);
+			return true;
+		}
+		if (processId == -1 && errno != EINTR)
+		{
+			return false;
+		}
+
+		watched[1].fd = jobTimerFd;
+		if (poll(watched, 2, -1) > 0 && (watched[1].revents & POLLIN))
+		{
+			checkJobTimeouts(jobs);
+		}
+	}
+}
+
+/**************************************************
+Function: parseDuration
+
+Function takes a duration as timeout takes it, a number of
+seconds that may have a fraction, optionally followed by s,
+m, h or d as for coreutils timeout, and stores it in
+milliseconds in *durationMs. Returns false for anything
+else, or for more than a compiled script can hold (about
+49 days).
+***************************************************/
+
+bool parseDuration(const char* text, long long* durationMs)
 {
-	char messageA[51] = "\nEntering foreground-only mode (& is now ignored)\n";
-	char messageB[31] = "\nExiting foreground-only mode\n";
-	
-	if (foregroundOnlyMode == false)
+	char* end;
+	double value = strtod(text, &end);
+	double scale = 1000;
+
+	if (end == text || (*end != '\0' && end[1] != '\0'))
 	{
-		//switch to forcing processes to foreground only mode (custom mode)
-		foregroundOnlyMode = true;
-		write(STDOUT_FILENO, messageA, strlen(messageA));
-		fflush(stdout);
+		return false;
 	}
-	else
+	switch (*end)
 	{
-		//switch to allowing processes to run in background (normal mode)
-		foregroundOnlyMode = false;
-		write(STDOUT_FILENO, messageB, strlen(messageB));
-		fflush(stdout);
+	case '\0': case 's': break;
+	case 'm': scale = 60 * 1000; break;
+	case 'h': scale = 60 * 60 * 1000; break;
+	case 'd': scale = 24 * 60 * 60 * 1000; break;
+	default: return false;
+	}
+
+	value *= scale;
+	if (!(value >= 0 && value <= UINT32_MAX))
+	{
+		return false;
+	}
+	// anything above 0 is at least a millisecond
+	*durationMs = (long long)value;
+	if (value > 0 && *durationMs == 0)
+	{
+		*durationMs = 1;
 	}
+	return true;
 }
 
 /**************************************************
-Function: executeAsChild
+Function: startTimer
 
-Function takes parameters relevant to execution of a 
-child process and exectutes the given command as a child 
-process, instead of as a built in command. Updates
-status code for the executed child process.
+Function takes a timerfd and a number of milliseconds and
+arms the timer to fire once, that long from now.
+***************************************************/
 
-Parameters are:
-1) pointer to populated command struct
-2) int pointer representing status of a child process
-3) int pointer representing last foreground process ID
-4) pointer to head of linked list for tracking pids
-5) sigaction struc that is loaded with handler function for
-SIGTSTP
+void startTimer(int timerFd, long long afterMs)
+{
+	struct itimerspec when = { { 0, 0 }, { afterMs / 1000, (afterMs % 1000) * 1000000 } };
 
-References:
-Based directly on models in Course Module 4 on Process API and
-Module 5 Signal Handling API:
-https://canvas.oregonstate.edu/courses/1830250/pages/
-exploration-process-api-executing-a-new-program?module_item_id=21468874
+	timerfd_settime(timerFd, 0, &when, NULL);
+}
 
-https://canvas.oregonstate.edu/courses/1830250/pages/
-exploration-signal-handling-api?module_item_id=21468881
-***************************************************/
+/**************************************************
+Function: scheduleTimeout
 
-void executeAsChild(commandStruct* currentCmdStruct, int* statusCode, int* lastForegroundPid, struct pidListHead* listHead, struct sigaction SIGTSTP_action)
+Function takes the job table, a job's slot and the time
+(metricClock) it must end by, and sets the job's deadline.
+The shared job timer is created and registered with the
+event loop the first time, and is brought forward if this
+deadline is earlier than the one it is set for.
+***************************************************/
 
+void scheduleTimeout(struct jobTable* jobs, int slot, long long deadline)
 {
-	int childStatus;
-	int sourceFd;
-	int targetFd;
-	int resultFd;
-	
-	// if Foreground Only Mode is on, child processes cannot run in background
-	if (foregroundOnlyMode)
+	jobs->jobs[slot].deadline = deadline;
+
+	if (jobTimerFd == -1)
 	{
-		currentCmdStruct->bkgrdInd = false;
+		jobTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (jobTimerFd == -1)
+		{
+			perror("timerfd_create()");
+			fflush(stdout);
+			return;
+		}
+		if (eventPollFd != -1)
+		{
+			struct epoll_event event = { 0 };
+			event.events = EPOLLIN;
+			event.data.fd = jobTimerFd;
+			epoll_ctl(eventPollFd, EPOLL_CTL_ADD, jobTimerFd, &event);
+		}
 	}
 
-	// generate new process
-	pid_t spawnPid = fork();
+	if (jobTimerDeadline == 0 || deadline < jobTimerDeadline)
+	{
+		struct itimerspec when = { { 0, 0 }, { deadline / 1000000000LL, deadline % 1000000000LL } };
+		timerfd_settime(jobTimerFd, TFD_TIMER_ABSTIME, &when, NULL);
+		jobTimerDeadline = deadline;
+	}
+}
 
-	switch (spawnPid) {
-	case -1:
-		perror("fork()\n");
-		fflush(stdout);
-		exit(1);
-		break;
+/**************************************************
+Function: checkJobTimeouts
+
+Function takes the job table and acts on the background jobs
+whose deadline has passed, when the shared job timer fires:
+a job that has run out of time is sent SIGTERM (and SIGCONT
+if it is stopped, so it can act on it) and given the grace
+period; one still there after that is sent SIGKILL. The
+timer is then set for the next deadline, or disarmed. The
+table is only scanned when the timer fires.
+***************************************************/
 
-	case 0:
-		// In the child process
-		
-		//signal handler defined for child process forcing
-		// it to ignore Ctrl-Z/SIGTSTP spec
-		SIGTSTP_action.sa_handler = SIG_IGN;
-		sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+void checkJobTimeouts(struct jobTable* jobs)
+{
+	uint64_t expirations;
+	long long now = metricClock();
+	long long next = 0;
 
-		if (foregroundOnlyMode)
+	if (jobTimerFd == -1 || read(jobTimerFd, &expirations, sizeof(expirations)) <= 0)
+	{
+		return;
+	}
+
+	for (int slot = 0; slot < jobs->jobCapacity && jobs->jobCount > 0; slot++)
+	{
+		struct jobEntry* job = &jobs->jobs[slot];
+		if (job->pid == 0 || job->deadline == 0)
 		{
-			currentCmdStruct->bkgrdInd = false;
+			continue;
 		}
 
-		//set so that processes set to run in foreground should have the
-		// default behavior (SIG_DFL)
-		if (!currentCmdStruct->bkgrdInd)
+		if (job->deadline <= now && job->timedOut)
 		{
-			struct sigaction default_action = { { 0 } };
-			default_action.sa_handler = SIG_DFL;
-			sigaction(SIGINT, &default_action, NULL);
+			signalJob(jobs, slot, SIGKILL);
+			job->deadline = 0;
+			continue;
 		}
-
-		//BRANCH: there is input redirect source OR command will run in background
-		if (currentCmdStruct->inputRedir != NULL || currentCmdStruct->bkgrdInd)
+		if (job->deadline <= now)
 		{
-			
-			if (currentCmdStruct->inputRedir != NULL)
-			{
-				// open for READ from
-				sourceFd = open(currentCmdStruct->inputRedir, O_RDONLY);
-			} 
-			else
-				//open stream will just redirect from nowhere
-				//but stay in background
+			signalJob(jobs, slot, SIGTERM);
+			if (job->stopSignal != 0)
 			{
-				sourceFd = open("/dev/null", O_RDONLY);
-			}
-		
-			if (sourceFd == -1) {
-				printf("cannot open %s for input \n", currentCmdStruct->inputRedir);
-				fflush(stdout);
-				exit(1);
-			}
-			//redirects stdin (0) from source file descriptor, which is the source file
-			resultFd = dup2(sourceFd, 0);
-
-			if (resultFd == -1) {
-				perror("READ error. New file descriptor could not be allocated\n");
-				fflush(stdout);
-				exit(1);
+				signalJob(jobs, slot, SIGCONT);
 			}
+			job->timedOut = true;
+			job->deadline = now + timeoutGraceMs * 1000000LL;
 		}
-		//BRANCH: there is output redirect target OR command will run in background
-		if (currentCmdStruct->outputRedir != NULL || currentCmdStruct->bkgrdInd)
+		if (next == 0 || job->deadline < next)
 		{
-			if (currentCmdStruct->outputRedir != NULL)
-			{
-				targetFd = open(currentCmdStruct->outputRedir, O_WRONLY | O_CREAT | O_TRUNC, 0760);
-			}
+			next = job->deadline;
+		}
+	}
 
-			else
-				//open stream will just redirect to nowhere
-				//but stay in background - no messages on terminal
-			{
-				targetFd = open("/dev/null", O_WRONLY | O_CREAT | O_TRUNC, 0760);
-			}
-			
-			if (targetFd == -1) {
-				printf("cannot open %s for output \n", currentCmdStruct->outputRedir);
-				//perror("WRITE error. File could not be opened for output\n");
-				fflush(stdout);
-				exit(1);
-			}
+	struct itimerspec when = { { 0, 0 }, { next / 1000000000LL, next % 1000000000LL } };
+	timerfd_settime(jobTimerFd, TFD_TIMER_ABSTIME, &when, NULL);
+	jobTimerDeadline = next;
+}
 
-			//redirects stdout (1) to fileDescriptor, which is the target file
-			resultFd = dup2(targetFd, 1);
+/**************************************************
+Function: waitTimeout
+
+Function waits for one process of a foreground command that
+has a timeout, or while a background job has one, in place
+of a blocking wait4 (WUNTRACED). It sleeps in poll on the
+process's pidfd, the SIGCHLD signalfd (a stop does not make
+a pidfd readable), timerFd, the command's own timer (-1 for
+none), and the background jobs' timer, which is handed to
+checkJobTimeouts. When timerFd fires the command is sent
+SIGTERM, through its process group or, without one, to each
+of the processes given, and SIGKILL when it fires again
+after the grace period; *signalsSent counts the two.
+Returns as wait4 does.
+***************************************************/
 
-			if (resultFd == -1) {
-				perror("WRITE error. New file descriptor could not be allocated\n");
-				fflush(stdout);
-				exit(1);
-			}
+pid_t waitTimeout(pid_t processId, int* status, struct rusage* usage, int timerFd,
+	int* signalsSent, pid_t group, pid_t* processIds, int processCount, struct jobTable* jobs)
+{
+	int pidfd = (int)syscall(SYS_pidfd_open, processId, 0);
+	struct pollfd watched[4] = { { pidfd, POLLIN, 0 }, { childSignalFd, POLLIN, 0 }, { timerFd, POLLIN, 0 },
+		{ jobTimerFd, POLLIN, 0 } };
+	struct signalfd_siginfo childInfo;
+	uint64_t expirations;
+	pid_t result;
+
+	while ((result = wait4(processId, status, WNOHANG | WUNTRACED, usage)) == 0)
+	{
+		if (poll(watched, 4, -1) == -1)
+		{
+			continue;
 		}
-		
-		// Replace the current program
-		execvp(currentCmdStruct->command, currentCmdStruct->arguments);
-		// exec only returns if there is an error
-		perror(currentCmdStruct->command);
-		fflush(stdout);
-		exit(2);
-		
-
-	default:
-		// The parent process
-
-		//CASE: Child runs in foreground
-		if (currentCmdStruct->bkgrdInd == false)
+		// the SIGCHLDs are only a wake-up here (processCheck reaps)
+		while (childSignalFd != -1 && read(childSignalFd, &childInfo, sizeof(childInfo)) > 0)
 		{
-			//Parent waits while child finishes
-			spawnPid = waitpid(spawnPid, &childStatus, 0);
-			//printf("Child process running in foreground \n");    //for testing
-			//fflush(stdout);
-			
-			//statusCode only updates if the child runs as foreground process
-			//updates the external variable -- this supports the status function
-			*statusCode = childStatus;
-
-			//updates the last foreground process, which here is the child
-			*lastForegroundPid = spawnPid;
+		}
+		if (watched[3].revents & POLLIN)
+		{
+			checkJobTimeouts(jobs);
+		}
+		if (!(watched[2].revents & POLLIN) || read(timerFd, &expirations, sizeof(expirations)) <= 0)
+		{
+			continue;
+		}
 
-			// notifies early termination of foreground child process
-			if (childStatus == 2)
-			{
-				printf("terminated by signal %d\n", childStatus);
-				fflush(stdout);
-			}
-			else
-			{
-				//printf("PARENT(%d): child(%d) terminated, status code: %d\n", getpid(), spawnPid, childStatus);  //for testing
-				//fflush(stdout);
-			}
+		int signo = (*signalsSent == 0) ? SIGTERM : SIGKILL;
+		if (group > 0)
+		{
+			kill(-group, signo);
 		}
-		//CASE: Child runs in background
-		else
+		for (int i = 0; group <= 0 && i < processCount; i++)
 		{
-			printf("background pid is %d \n", spawnPid);
-			fflush(stdout);
-			
-			//updates last foreground process, which here is the parent
-			*lastForegroundPid = getpid();
-
-			//insert the PID of the child into first spot in the pid list 
-			// that tracks currently running background child processes (order doesn't matter)
-			struct pidNode* currNode = malloc(sizeof(struct pidNode));
-			currNode->process = malloc(sizeof(pid_t));
-			*currNode->process = spawnPid;
-			currNode->next = (void*)0;
-			//struct pidNode* tempNode = (void*)0;
-			
-			if (listHead->next == (void*)0)
-			{
-				listHead->next = currNode;
-				currNode->next = (void*)0;
-			}
-			else
+			if (processIds[i] != -1)
 			{
-				currNode->next = listHead->next;
-				listHead->next = currNode;
+				kill(processIds[i], signo);
 			}
-			
-
 		}
-		//usleep(75000); //waits until the child prints it's message that it's in background
-		
-		//returns control to the parent while child runs in background
-		spawnPid = waitpid(spawnPid, &childStatus, WNOHANG);
+		if (*signalsSent == 0)
+		{
+			startTimer(timerFd, timeoutGraceMs);
+		}
+		(*signalsSent)++;
+	}
 
-		//statusProcess(statusCode); //for testing
+	if (pidfd != -1)
+	{
+		close(pidfd);
 	}
+	return result;
 }
 
+/**************************************************
+Function: setupEventLoop
+
+Function sets up the epoll instance the shell sleeps on
+between commands. SIGCHLD is blocked and read through a
+signalfd instead, so a background exit wakes the shell
+while it is waiting at the prompt. The command input is
+registered too when it can be polled (ttys, pipes,
+sockets); a regular file is mapped by openInput instead.
+
+Children must not inherit the blocked SIGCHLD, so the mask
+from before this call is kept in childSignalMask for the
+spawn paths.
+***************************************************/
+
+void setupEventLoop(void)
+{
+	sigset_t blockSignals;
+	struct epoll_event event = { 0 };
+
+	sigemptyset(&blockSignals);
+	sigaddset(&blockSignals, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &blockSignals, &childSignalMask);
+
+	eventPollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (eventPollFd == -1)
+	{
+		perror("epoll_create1()");
+		fflush(stdout);
+		return;
+	}
+
+	childSignalFd = signalfd(-1, &blockSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (childSignalFd != -1)
+	{
+		event.events = EPOLLIN;
+		event.data.fd = childSignalFd;
+		epoll_ctl(eventPollFd, EPOLL_CTL_ADD, childSignalFd, &event);
+	}
 
+	if (scriptMap == NULL)
+	{
+		event.events = EPOLLIN;
+		event.data.fd = inputFd;
+		inputPollable = (epoll_ctl(eventPollFd, EPOLL_CTL_ADD, inputFd, &event) == 0);
+	}
+}
 
+/**************************************************
+Function: watchBackground
 
+Function takes the pid of a new background process and
+registers a pidfd for it with the event loop, so its exit
+is seen even if the SIGCHLD for it was merged with another
+one. Returns the pidfd, or -1 on kernels without
+pidfd_open, which rely on the signalfd alone.
+***************************************************/
+
+int watchBackground(pid_t processId)
+{
+	struct epoll_event event = { 0 };
+	int pidfd;
+
+	if (eventPollFd == -1)
+	{
+		return -1;
+	}
+
+	pidfd = (int)syscall(SYS_pidfd_open, processId, 0);
+	if (pidfd == -1)
+	{
+		return -1;
+	}
+	fcntl(pidfd, F_SETFD, FD_CLOEXEC);
+
+	event.events = EPOLLIN;
+	event.data.fd = pidfd;
+	epoll_ctl(eventPollFd, EPOLL_CTL_ADD, pidfd, &event);
+	return pidfd;
+}
+
+/**************************************************
+Function: openInput
+
+Function takes the path of a script, or NULL to read
+commands from stdin, and sets up the command input. A
+script, or a stdin that is not a terminal, switches the
+shell to script mode. Input that is a regular file is
+mapped private and writable, so lines can be terminated in
+place; anything else is read in INPUT_CHUNK_SIZE chunks.
+Command lines may be up to ARG_MAX bytes (argMax), the most
+exec could pass on anyway.
+***************************************************/
+
+void openInput(char* scriptPath)
+{
+	struct stat inputStat;
+
+	argMax = sysconf(_SC_ARG_MAX);
+	if (argMax <= 0)
+	{
+		argMax = _POSIX_ARG_MAX;
+	}
+	inputCapacity = INPUT_CHUNK_SIZE;
+	inputBuffer = malloc(inputCapacity + 1);
+
+	if (scriptPath != NULL)
+	{
+		inputFd = open(scriptPath, O_RDONLY | O_CLOEXEC);
+		if (inputFd == -1)
+		{
+			perror(scriptPath);
+			exit(127);
+		}
+		interactiveMode = false;
+	}
+	else
+	{
+		interactiveMode = isatty(STDIN_FILENO);
+	}
+
+	if (fstat(inputFd, &inputStat) == 0 && S_ISREG(inputStat.st_mode) && inputStat.st_size > 0)
+	{
+		scriptMap = mmap(NULL, inputStat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, inputFd, 0);
+		if (scriptMap == MAP_FAILED)
+		{
+			scriptMap = NULL;
+			return;
+		}
+		madvise(scriptMap, inputStat.st_size, MADV_SEQUENTIAL);
+		scriptSize = inputStat.st_size;
+	}
+}
+
+/**************************************************
+Function: nextMappedLine
+
+Function returns the next line of a mapped script,
+terminated in place where its newline was, or NULL at the
+end of the script. A last line with no newline has no byte
+to spare after it, so it alone is copied into the line
+arena. Lines longer than argMax are reported and skipped.
+***************************************************/
+
+static char* nextMappedLine(void)
+{
+	while (scriptPos < scriptSize)
+	{
+		char* line = &scriptMap[scriptPos];
+		size_t available = scriptSize - scriptPos;
+		char* lineEnd = memchr(line, '\n', available);
+		size_t lineLength = (lineEnd != NULL) ? (size_t)(lineEnd - line) : available;
+
+		scriptPos += (lineEnd != NULL) ? lineLength + 1 : lineLength;
+		if (lineLength > (size_t)argMax)
+		{
+			printf("line longer than %ld bytes ignored\n", argMax);
+			fflush(stdout);
+			linesIgnored++;
+			continue;
+		}
+
+		if (lineEnd != NULL)
+		{
+			*lineEnd = '\0';
+			return line;
+		}
+
+		char* copy = arenaAlloc(&lineArena, lineLength + 1);
+		memcpy(copy, line, lineLength);
+		copy[lineLength] = '\0';
+		return copy;
+	}
+	return NULL;
+}
+
+/**************************************************
+Function: readInputLine
+
+Function takes the background job table and returns the
+next line of input, NUL-terminated in place of its newline.
+The line stays valid until the next call. While no full
+line is available the shell sleeps in epoll_wait;
+background processes that finish in the meantime are
+reaped and reported right away and the prompt is shown
+again; the periodic metrics dump is done there too, and
+the zygote pool is refilled before the shell goes to sleep.
+The input buffer grows for long lines; a line longer than
+argMax is reported and skipped rather than cut up.
+
+Returns the line, or NULL at end of input.
+***************************************************/
+
+char* readInputLine(struct jobTable* jobs)
+{
+	struct epoll_event events[MAX_EVENTS];
+	int eventCount;
+	int i;
+	bool refilled = false;
+
+	if (scriptMap != NULL)
+	{
+		return nextMappedLine();
+	}
+
+	while (true)
+	{
+		// hand out a full line if one is already buffered (the
+		// part of a long line searched before is not searched again)
+		char* line = &inputBuffer[inputStart];
+		int available = inputEnd - inputStart;
+		char* lineEnd = memchr(line + inputScanned, '\n', available - inputScanned);
+		int lineLength = (lineEnd != NULL) ? (int)(lineEnd - line) : available;
+
+		inputScanned = (lineEnd != NULL) ? 0 : available;
+		if (inputSkipping || lineLength > argMax)
+		{
+			// over argMax: drop the line, up to its newline
+			if (!inputSkipping)
+			{
+				printf("line longer than %ld bytes ignored\n", argMax);
+				fflush(stdout);
+			}
+			inputStart += (lineEnd != NULL) ? lineLength + 1 : lineLength;
+			inputScanned = 0;
+			inputSkipping = (lineEnd == NULL);
+			if (!inputSkipping)
+			{
+				continue;
+			}
+		}
+		else if (lineEnd != NULL || (inputEOF && available > 0))
+		{
+			// inputBuffer has a spare byte past the end for the last line
+			line[lineLength] = '\0';
+			inputStart += (lineEnd != NULL) ? lineLength + 1 : lineLength;
+			inputScanned = 0;
+			return line;
+		}
+		if (inputEOF)
+		{
+			return NULL;
+		}
+
+		// wait for input, reporting background exits as they happen
+		if (inputPollable)
+		{
+			// idle until the next command: top up the helper pool
+			if (zygoteMode && !refilled)
+			{
+				refillZygotes();
+				refilled = true;
+			}
+
+			eventCount = epoll_wait(eventPollFd, events, MAX_EVENTS, -1);
+			if (eventCount == -1)
+			{
+				// SIGTSTP handler ran: show the prompt again
+				if (errno == EINTR && interactiveMode)
+				{
+					printf(": ");
+					fflush(stdout);
+				}
+				continue;
+			}
+
+			bool inputReady = false;
+			bool childExited = false;
+			for (i = 0; i < eventCount; i++)
+			{
+				if (events[i].data.fd == inputFd)
+				{
+					inputReady = true;
+				}
+				else if (events[i].data.fd == metricsTimerFd)
+				{
+					checkMetricsTimer(jobs);
+				}
+				else if (events[i].data.fd == jobTimerFd)
+				{
+					checkJobTimeouts(jobs);
+				}
+				else
+				{
+					childExited = true;
+				}
+			}
+			if (childExited && processCheck(jobs) > 0 && interactiveMode)
+			{
+				printf(": ");
+				fflush(stdout);
+			}
+			if (!inputReady)
+			{
+				continue;
+			}
+		}
+
+		// make room at the end of the buffer for the next read
+		if (inputStart > 0)
+		{
+			memmove(inputBuffer, &inputBuffer[inputStart], inputEnd - inputStart);
+			inputEnd -= inputStart;
+			inputStart = 0;
+		}
+		if (inputEnd == inputCapacity)
+		{
+			// a line as long as the buffer: make it twice as big
+			inputCapacity *= 2;
+			inputBuffer = realloc(inputBuffer, inputCapacity + 1);
+		}
+		else if (inputCapacity > INPUT_CHUNK_SIZE && inputEnd < INPUT_CHUNK_SIZE / 2)
+		{
+			// the long line is gone: give the memory back
+			inputCapacity = INPUT_CHUNK_SIZE;
+			inputBuffer = realloc(inputBuffer, inputCapacity + 1);
+		}
+
+		ssize_t bytesRead = read(inputFd, &inputBuffer[inputEnd], inputCapacity - inputEnd);
+		if (bytesRead > 0)
+		{
+			inputEnd += (int)bytesRead;
+		}
+		else if (bytesRead == 0 || errno != EINTR)
+		{
+			inputEOF = true;
+		}
+		else if (interactiveMode)
+		{
+			printf(": ");
+			fflush(stdout);
+		}
+	}
+}
+
+/**************************************************
+Function: arenaAlloc
+
+Function takes a pointer to an arena and a size and returns
+memory for that many bytes, aligned for any type. The memory
+is not cleared (see arenaCalloc).
+Memory comes from the current block; when it is full the
+next block is reused or a new one is added (an oversized
+request gets a block of its own).
+***************************************************/
+
+void* arenaAlloc(struct lineArena* arena, size_t size)
+{
+	struct arenaBlock* block = arena->current;
+	void* memory;
+
+	size = (size + 15) & ~(size_t)15;
+
+	// move on to a block with enough room
+	while (block == NULL || block->used + size > block->size)
+	{
+		if (block != NULL && block->next != NULL)
+		{
+			block = block->next;
+			block->used = 0;
+			continue;
+		}
+
+		size_t blockSize = (size > ARENA_BLOCK_SIZE) ? size : ARENA_BLOCK_SIZE;
+		struct arenaBlock* newBlock = malloc(sizeof(struct arenaBlock) + blockSize);
+		if (newBlock == NULL)
+		{
+			perror("malloc()");
+			exit(1);
+		}
+		newBlock->next = NULL;
+		newBlock->size = blockSize;
+		newBlock->used = 0;
+
+		if (block == NULL)
+		{
+			arena->first = newBlock;
+		}
+		else
+		{
+			block->next = newBlock;
+		}
+		block = newBlock;
+	}
+	arena->current = block;
+
+	memory = &block->data[block->used];
+	block->used += size;
+	return memory;
+}
+
+/**************************************************
+Function: arenaCalloc
+
+Function takes a pointer to an arena and a size and returns
+zeroed memory for that many bytes from arenaAlloc.
+***************************************************/
+
+void* arenaCalloc(struct lineArena* arena, size_t size)
+{
+	return memset(arenaAlloc(arena, size), 0, size);
+}
+
+/**************************************************
+Function: arenaStrdup
+
+Function takes a pointer to an arena and a string and
+returns a copy of the string allocated in the arena.
+***************************************************/
+
+char* arenaStrdup(struct lineArena* arena, const char* source)
+{
+	size_t length = strlen(source);
+	char* copy = arenaAlloc(arena, length + 1);
+
+	memcpy(copy, source, length + 1);
+	return copy;
+}
+
+/**************************************************
+Function: arenaReset
+
+Function takes a pointer to an arena and releases every
+allocation in it at once. The first block is kept for the
+next command line; blocks added for unusually large lines
+are returned to the heap so they do not pin memory.
+***************************************************/
+
+void arenaReset(struct lineArena* arena)
+{
+	struct arenaBlock* block;
+
+	if (arena->first == NULL)
+	{
+		return;
+	}
+
+	block = arena->first->next;
+	while (block != NULL)
+	{
+		struct arenaBlock* nextBlock = block->next;
+		free(block);
+		block = nextBlock;
+	}
+
+	arena->first->next = NULL;
+	arena->first->used = 0;
+	arena->current = arena->first;
+}
+
+/**************************************************
+Function: arenaSave
+
+Function takes a pointer to an arena and returns a mark of
+how far it is used, for arenaRewind.
+***************************************************/
+
+struct arenaMark arenaSave(struct lineArena* arena)
+{
+	struct arenaMark mark = { arena->current, 0 };
+
+	if (mark.block != NULL)
+	{
+		mark.used = mark.block->used;
+	}
+	return mark;
+}
+
+/**************************************************
+Function: arenaRewind
+
+Function takes a pointer to an arena and a mark from
+arenaSave and releases everything allocated since then, so
+each iteration of a loop reuses the same memory. Blocks
+added since stay on the list for arenaAlloc to reuse.
+***************************************************/
+
+void arenaRewind(struct lineArena* arena, struct arenaMark mark)
+{
+	if (mark.block == NULL)
+	{
+		mark.block = arena->first;
+	}
+	if (mark.block != NULL)
+	{
+		mark.block->used = mark.used;
+		arena->current = mark.block;
+	}
+}
+
+/**************************************************
+Function: initVariables
+
+Function formats the shell's process ID once, for every
+later expansion of the variable '$$', and builds the
+variable table: $$, $? (0) and $! (empty until a job is
+started in the background), then every NAME=value of the
+environment, pointed to where it is.
+***************************************************/
+
+void initVariables(void)
+{
+	shellPidLength = snprintf(shellPidString, sizeof(shellPidString), "%ld", (long)getpid());
+
+	setVariable("$", 1, shellPidString, shellPidLength);
+	setVariable("?", 1, variables.statusValue, strlen(variables.statusValue));
+	setVariable("!", 1, variables.backgroundValue, 0);
+	for (char** entry = environ; *entry != NULL; entry++)
+	{
+		char* equals = strchr(*entry, '=');
+		if (equals != NULL && equals != *entry)
+		{
+			setVariable(*entry, equals - *entry, equals + 1, strlen(equals + 1));
+		}
+	}
+}
+
+/**************************************************
+Function: hashVariable
+
+Function takes a name that need not be NUL-terminated and
+its length and returns its FNV-1a hash, as hashName does.
+***************************************************/
+
+static unsigned int hashVariable(const char* name, size_t nameLength)
+{
+	unsigned int hash = 2166136261u;
+
+	for (size_t i = 0; i < nameLength; i++)
+	{
+		hash = (hash ^ (unsigned char)name[i]) * 16777619u;
+	}
+	return hash;
+}
+
+/**************************************************
+Function: findVariable
+
+Function takes a name and its length and returns its entry
+in the variable table, or NULL if it is not set.
+***************************************************/
+
+struct shellVariable* findVariable(const char* name, size_t nameLength)
+{
+	if (variables.capacity == 0)
+	{
+		return NULL;
+	}
+
+	int mask = variables.capacity - 1;
+	for (int slot = hashVariable(name, nameLength) & mask; variables.slots[slot].name != NULL;
+		slot = (slot + 1) & mask)
+	{
+		struct shellVariable* variable = &variables.slots[slot];
+		if (variable->nameLength == nameLength && memcmp(variable->name, name, nameLength) == 0)
+		{
+			return variable;
+		}
+	}
+	return NULL;
+}
+
+/**************************************************
+Function: setVariable
+
+Function takes a name and a value, each with its length,
+and sets the variable in the table, adding it if it is new.
+Neither is copied: both must outlive the table entry. The
+table doubles once it is three quarters full.
+***************************************************/
+
+void setVariable(const char* name, size_t nameLength, const char* value, size_t valueLength)
+{
+	struct shellVariable* variable = findVariable(name, nameLength);
+
+	if (variable == NULL)
+	{
+		if ((variables.count + 1) * 4 > variables.capacity * 3)
+		{
+			struct shellVariable* oldSlots = variables.slots;
+			int oldCapacity = variables.capacity;
+
+			variables.capacity = (oldCapacity == 0) ? 64 : oldCapacity * 2;
+			variables.slots = calloc(variables.capacity, sizeof(struct shellVariable));
+			variables.count = 0;
+			for (int i = 0; i < oldCapacity; i++)
+			{
+				if (oldSlots[i].name != NULL)
+				{
+					setVariable(oldSlots[i].name, oldSlots[i].nameLength, oldSlots[i].value, oldSlots[i].valueLength);
+				}
+			}
+			free(oldSlots);
+		}
+
+		int mask = variables.capacity - 1;
+		int slot = hashVariable(name, nameLength) & mask;
+		while (variables.slots[slot].name != NULL)
+		{
+			slot = (slot + 1) & mask;
+		}
+		variable = &variables.slots[slot];
+		variable->name = name;
+		variable->nameLength = nameLength;
+		variables.count++;
+	}
+
+	variable->value = value;
+	variable->valueLength = valueLength;
+	if (valueLength > variables.longestValue)
+	{
+		variables.longestValue = valueLength;
+	}
+}
+
+/**************************************************
+Function: updateStatusVariable
+
+Function takes the status of the last foreground command
+and, if it changed since $? was last set, formats its exit
+status (see lastExitStatus) for $?.
+***************************************************/
+
+void updateStatusVariable(int status)
+{
+	if (status != variables.status)
+	{
+		variables.status = status;
+		setVariable("?", 1, variables.statusValue, snprintf(variables.statusValue,
+			sizeof(variables.statusValue), "%d", lastExitStatus(&status)));
+	}
+}
+
+/**************************************************
+Function: setBackgroundVariable
+
+Function takes the process ID a background job was reported
+under and sets $! to it.
+***************************************************/
+
+void setBackgroundVariable(pid_t processId)
+{
+	setVariable("!", 1, variables.backgroundValue, snprintf(variables.backgroundValue,
+		sizeof(variables.backgroundValue), "%ld", (long)processId));
+}
+
+/**************************************************
+Function: findClosingParen
+
+Function takes a pointer to a '(' and returns a pointer to
+the ')' that closes it, counting the parentheses nested in
+between, or NULL if the string ends first.
+***************************************************/
+
+char* findClosingParen(char* open)
+{
+	int depth = 0;
+
+	for (char* next = open; *next != '\0'; next++)
+	{
+		if (*next == '(')
+		{
+			depth++;
+		}
+		else if (*next == ')' && --depth == 0)
+		{
+			return next;
+		}
+	}
+	return NULL;
+}
+
+/**************************************************
+Function: lexInput
+
+Function takes an input line and an array with room for
+tokenCapacity(line) tokens, and in a single scan splits
+the line into space-delimited tokens, substitutes the
+process ID for the expansion variable '$$' and classifies
+the operators < > >> & | and ;. Returns the number of tokens.
+
+Tokens are not copied: the delimiter after each token is
+overwritten with '\0' and the token points into the line.
+Only a token that contains '$$' is written out, into one
+expansion buffer allocated from the line arena the first
+time it is needed and sized for the worst case, so a line
+costs at most one allocation. An operator must stand alone
+to count as one, except <<< and <<, which may have their
+word attached, and ";", which also ends the word before it
+(its token is made on the next pass, as the ';' itself is
+overwritten). "$$" never expands to an operator; while a
+script is compiled (lateBindPid) it is left in the word for
+bindVariables, as the pid differs from run to run. A "$("
+takes everything up to its matching ')' into the word,
+spaces and ';' included, unexpanded: the command inside is
+lexed again when it runs.
+***************************************************/
+
+int lexInput(char* inputString, struct lexToken* tokens)
+{
+	char* ptrCur = inputString;
+	char* expandedString = NULL;
+	char* outPtr = NULL;
+	int tokenCount = 0;
+	bool semicolon = false;     // the last word ended at a ';'
+	static char semicolonText[] = ";";
+
+	while (true)
+	{
+		// skip the delimiters before the next token
+		while (*ptrCur == ' ' || *ptrCur == '\n')
+		{
+			ptrCur++;
+		}
+		if (semicolon || *ptrCur == ';')
+		{
+			tokens[tokenCount].type = TOKEN_SEMI;
+			tokens[tokenCount].substitution = false;
+			tokens[tokenCount++].text = semicolonText;
+			ptrCur += !semicolon;
+			semicolon = false;
+			continue;
+		}
+		if (*ptrCur == '\0')
+		{
+			break;
+		}
+
+		char* tokenStart = ptrCur;
+		char* tokenOut = NULL;   // set once the token needs expanding
+		bool substitution = false;
+
+		while (*ptrCur != '\0' && *ptrCur != ' ' && *ptrCur != '\n' && *ptrCur != ';')
+		{
+			if (ptrCur[0] == '$' && ptrCur[1] == '$' && lateBindPid)
+			{
+				// kept for bindVariables, so "$$(" is no substitution
+				if (tokenOut != NULL)
+				{
+					*outPtr++ = '$';
+					*outPtr++ = '$';
+				}
+				ptrCur += 2;
+			}
+			else if (ptrCur[0] == '$' && ptrCur[1] == '$')
+			{
+				if (tokenOut == NULL)
+				{
+					// worst case: every remaining pair of characters is $$
+					if (expandedString == NULL)
+					{
+						size_t remaining = strlen(ptrCur);
+						size_t bufferSize = (ptrCur - inputString) + remaining
+							+ (remaining / 2) * shellPidLength + 1;
+						expandedString = arenaAlloc(&lineArena, bufferSize);
+						outPtr = expandedString;
+					}
+					tokenOut = outPtr;
+					memcpy(outPtr, tokenStart, ptrCur - tokenStart);
+					outPtr += ptrCur - tokenStart;
+				}
+				memcpy(outPtr, shellPidString, shellPidLength);
+				outPtr += shellPidLength;
+				ptrCur += 2;
+			}
+			else if (ptrCur[0] == '$' && ptrCur[1] == '(')
+			{
+				char* close = findClosingParen(ptrCur + 1);
+				char* after = (close != NULL) ? close + 1 : ptrCur + strlen(ptrCur);
+				if (tokenOut != NULL)
+				{
+					memcpy(outPtr, ptrCur, after - ptrCur);
+					outPtr += after - ptrCur;
+				}
+				ptrCur = after;
+				substitution = true;
+			}
+			else
+			{
+				if (tokenOut != NULL)
+				{
+					*outPtr++ = *ptrCur;
+				}
+				ptrCur++;
+			}
+		}
+
+		struct lexToken* token = &tokens[tokenCount++];
+		token->type = TOKEN_WORD;
+		token->substitution = substitution;
+
+		if (tokenStart[0] == '<' && tokenStart[1] == '<')
+		{
+			// here-string or here-document, word attached or not
+			if (tokenOut != NULL)
+			{
+				*outPtr++ = '\0';
+				tokenStart = tokenOut;
+			}
+			bool hereString = (tokenStart[2] == '<');
+			token->type = hereString ? TOKEN_HERESTRING : TOKEN_HEREDOC;
+			token->text = tokenStart + (hereString ? 3 : 2);
+		}
+		else if (tokenOut != NULL)
+		{
+			*outPtr++ = '\0';
+			token->text = tokenOut;
+		}
+		else
+		{
+			// single-character operators, and >>
+			if (ptrCur - tokenStart == 1)
+			{
+				switch (*tokenStart)
+				{
+				case '<': token->type = TOKEN_IN; break;
+				case '>': token->type = TOKEN_OUT; break;
+				case '&': token->type = TOKEN_BKGRD; break;
+				case '|': token->type = TOKEN_PIPE; break;
+				}
+			}
+			else if (ptrCur - tokenStart == 2 && tokenStart[0] == '>' && tokenStart[1] == '>')
+			{
+				token->type = TOKEN_APPEND;
+			}
+			token->text = tokenStart;
+		}
+
+		// end the slice in place
+		if (*ptrCur != '\0')
+		{
+			semicolon = (*ptrCur == ';');
+			*ptrCur++ = '\0';
+		}
+	}
+
+	return tokenCount;
+}
+
+/**************************************************
+Function: tokenCapacity
+
+Function takes an input line and returns how many tokens
+lexInput can make of it at most: one per two characters
+(a token and its delimiter), plus one for each ';', which
+is a token of its own without a delimiter.
+***************************************************/
+
+int tokenCapacity(const char* inputString)
+{
+	int capacity = strlen(inputString) / 2 + 1;
+
+	for (const char* next = strchr(inputString, ';'); next != NULL; next = strchr(next + 1, ';'))
+	{
+		capacity++;
+	}
+	return capacity;
+}
+
+
+/**************************************************
+Function: getInput
+
+Function displays command prompt and collects user
+input. Returns pointer to the line, which lives in the input
+buffer (or the line arena) until the next line is read. The
+variable $$ is expanded later, by lexInput.
+
+Takes the head of the background process list so finished
+jobs can be reported while the shell waits for input.
+Returns NULL at end of input.
+
+***************************************************/
+
+char* getInput(struct jobTable* jobs) {
+
+	//Show the command prompt, which is ":" (not in script mode)
+	if (interactiveMode)
+	{
+		printf(": ");
+		fflush(stdout);
+	}
+
+	//command lines may be up to ARG_MAX bytes long
+	return readInputLine(jobs);
+}
+
+
+/**************************************************
+Function: printCommandStruct
+
+Function takes a pointer to commandStruct and prints out its
+members. Used in development.
+
+***************************************************/
+
+void printCommandStruct(commandStruct* currentCmdStruct)
+{
+	int i = 0;
+	if (currentCmdStruct != NULL)
+	{
+		if (currentCmdStruct->command != NULL)
+		{
+			printf("Command is: %s \n", currentCmdStruct->command);
+			fflush(stdout);
+		}
+		if (currentCmdStruct->arguments[i] != NULL)
+		{
+			for (i = 0; i < currentCmdStruct->argCount + 1; i++) {
+				if (currentCmdStruct->arguments[i] != NULL)
+				{
+					printf("Argument %d is: %s \n", i, currentCmdStruct->arguments[i]);
+					fflush(stdout);
+				}
+				else
+				{
+					break;
+				}
+			}
+		}
+
+		if (currentCmdStruct->hereData != NULL)
+		{
+			printf("Input from here-document: %zu bytes\n", currentCmdStruct->hereLength);
+			fflush(stdout);
+		}
+		else if (currentCmdStruct->inputRedir != NULL)
+		{
+			printf("Redirect input to: %s\n", currentCmdStruct->inputRedir);
+			fflush(stdout);
+		}
+		else
+		{
+			printf("Redirect input to: Nothing entered\n");
+			fflush(stdout);
+		}
+
+		if (currentCmdStruct->outputRedir != NULL)
+		{
+			printf("Redirect output to: %s\n", currentCmdStruct->outputRedir);
+			fflush(stdout);
+		}
+		else
+		{
+			printf("Redirect output to: Nothing entered\n");
+			fflush(stdout);
+		}
+		printf("Background mode is: %s\n", currentCmdStruct->bkgrdInd ? "true" : "false");
+		fflush(stdout);
+
+		if (currentCmdStruct->nextStage != NULL)
+		{
+			printf("Pipes into:\n");
+			fflush(stdout);
+			printCommandStruct(currentCmdStruct->nextStage);
+		}
+	}
+
+}
+
+
+/**************************************************
+Function: processInput
+
+Function takes pointer to an input string and processes
+it, returning a pointer to a commandStruct whose elements 
+are allocated in the line arena. The commandStruct 
+that is returned has 5 members representing all 5 categories 
+of command line input.
+
+The line is split and expanded by lexInput; the strings in
+the commandStruct point into the line itself, so nothing is
+copied here. A line is a list of pipelines and loops
+separated by ";" (see parseList), chained through
+nextCommand; a line that starts with # is a comment, and
+NULL is returned for it as for an empty line or a syntax
+error.
+
+"<< WORD" only records the delimiter: the body follows on the
+next input lines and is read by readHereDocuments, so a line
+with a here-document is first copied into the line arena,
+out of the input buffer those reads reuse.
+
+***************************************************/
+
+commandStruct* processInput(char* inputString) {
+
+	bool failed = false;
+	int position = 0;
+
+	if (scriptMap == NULL && strstr(inputString, "<<") != NULL)
+	{
+		inputString = arenaStrdup(&lineArena, inputString);
+	}
+
+	struct lexToken* tokens = arenaAlloc(&lineArena,
+		tokenCapacity(inputString) * sizeof(struct lexToken));
+	int tokenCount = lexInput(inputString, tokens);
+
+	// if there are no tokens (there was no input), or a comment
+	if (tokenCount == 0 || strncmp(tokens[0].text, COMMENT, 1) == 0)
+	{
+		return NULL;
+	}
+
+	commandStruct* commandList = parseList(tokens, &position, tokenCount, false, &failed);
+	markVariables(commandList);
+	return commandList;
+}
+
+/**************************************************
+Function: parseList
+
+Function takes the tokens of a line, the position to start
+at and the token count, and parses a list of commands: each
+a pipeline, which ends at ";" or after "&", or a loop. They
+are chained through nextCommand. Inside a loop (nested) the
+list ends at a "do" or "done" in command position, which is
+left for parseLoop; at the top of a line those words are a
+syntax error. *position is left after the list.
+
+Sets *failed and returns NULL on a syntax error.
+***************************************************/
+
+static commandStruct* parseList(struct lexToken* tokens, int* position, int tokenCount, bool nested, bool* failed)
+{
+	commandStruct* firstCommand = NULL;
+	commandStruct* lastCommand = NULL;
+	int i = *position;
+
+	while (i < tokenCount && !*failed)
+	{
+		struct lexToken* tk = &tokens[i];
+		commandStruct* command;
+
+		// an empty command between two ";" is skipped
+		if (tk->type == TOKEN_SEMI)
+		{
+			i++;
+			continue;
+		}
+
+		if (tk->type == TOKEN_WORD && (strcmp(tk->text, "do") == 0 || strcmp(tk->text, "done") == 0))
+		{
+			if (!nested)
+			{
+				printf("Syntax error near \"%s\"\n", tk->text);
+				fflush(stdout);
+				*failed = true;
+			}
+			break;
+		}
+
+		if (tk->type == TOKEN_WORD && (strcmp(tk->text, "for") == 0 || strcmp(tk->text, "while") == 0))
+		{
+			command = parseLoop(tokens, &i, tokenCount, failed);
+		}
+		else
+		{
+			int end = i;
+			while (end < tokenCount && tokens[end].type != TOKEN_SEMI)
+			{
+				if (tokens[end++].type == TOKEN_BKGRD)
+				{
+					break;
+				}
+			}
+			command = parsePipeline(tokens, i, end);
+			*failed = (command == NULL);
+			i = end;
+		}
+
+		if (command != NULL)
+		{
+			if (firstCommand == NULL)
+			{
+				firstCommand = command;
+			}
+			else
+			{
+				lastCommand->nextCommand = command;
+			}
+			lastCommand = command;
+		}
+	}
+
+	*position = i;
+	return *failed ? NULL : firstCommand;
+}
+
+/**************************************************
+Function: validName
+
+Function takes a word and returns true if it can name a
+variable: a letter or underscore, then letters, digits and
+underscores.
+***************************************************/
+
+static bool validName(const char* name)
+{
+	if (!isalpha((unsigned char)name[0]) && name[0] != '_')
+	{
+		return false;
+	}
+	for (name++; *name != '\0'; name++)
+	{
+		if (!isalnum((unsigned char)*name) && *name != '_')
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**************************************************
+Function: markVariables
+
+Function takes a list (a line, or a loop body or condition)
+and flags every pipeline stage with a string that may refer
+to a variable ($name, ${name}, $? ...), or with a
+here-document whose body will be expanded, so that only
+those stages are copied and substituted each time they run.
+***************************************************/
+
+static void markVariables(commandStruct* commandList)
+{
+	for (commandStruct* command = commandList; command != NULL; command = command->nextCommand)
+	{
+		for (commandStruct* stage = command; stage != NULL && stage->loop == NULL; stage = stage->nextStage)
+		{
+			bool found = (stage->hereDelimiter != NULL && stage->hereExpand)
+				|| (stage->hereData != NULL && strchr(stage->hereData, '$') != NULL)
+				|| (stage->inputRedir != NULL && strchr(stage->inputRedir, '$') != NULL)
+				|| (stage->outputRedir != NULL && strchr(stage->outputRedir, '$') != NULL);
+
+			for (int i = 0; i < stage->argCount && !found; i++)
+			{
+				found = (strchr(stage->arguments[i], '$') != NULL);
+			}
+			for (int i = 0; i < stage->outputCount && !found; i++)
+			{
+				found = (strchr(stage->outputTargets[i].path, '$') != NULL);
+			}
+			stage->hasVariables = found;
+		}
+	}
+}
+
+/**************************************************
+Function: parseLoop
+
+Function takes the tokens of a line with *position at a
+"for" or "while" and parses the whole loop,
+
+for NAME in word ... ; do list ; done
+while list ; do list ; done
+
+into a commandStruct (command is the keyword) with a
+loopStruct holding the variable and words or the condition,
+and the body. The lists are parsed once, here; running the
+loop only binds the variable into them. *position is left
+after "done", which must end a command.
+
+Sets *failed and returns NULL on a syntax error.
+***************************************************/
+
+static commandStruct* parseLoop(struct lexToken* tokens, int* position, int tokenCount, bool* failed)
+{
+	int i = *position;
+	const char* expected = NULL;
+	commandStruct* command = arenaCalloc(&lineArena, sizeof(commandStruct));
+	struct loopStruct* loop = arenaCalloc(&lineArena, sizeof(struct loopStruct));
+
+	command->command = tokens[i].text;
+	command->arguments = arenaAlloc(&lineArena, 2 * sizeof(char*));
+	command->arguments[0] = command->command;
+	command->arguments[1] = NULL;
+	command->argCount = 1;
+	command->loop = loop;
+	loop->isWhile = (strcmp(tokens[i++].text, "while") == 0);
+
+	if (loop->isWhile)
+	{
+		loop->condition = parseList(tokens, &i, tokenCount, true, failed);
+		if (loop->condition == NULL)
+		{
+			expected = "a condition";
+		}
+	}
+	else if (i + 1 >= tokenCount || tokens[i].type != TOKEN_WORD || !validName(tokens[i].text)
+		|| strcmp(tokens[i + 1].text, "in") != 0)
+	{
+		expected = "NAME in";
+	}
+	else
+	{
+		// the words up to the ";" are taken in turn
+		loop->variable = tokens[i].text;
+		i += 2;
+		while (i + loop->wordCount < tokenCount && tokens[i + loop->wordCount].type == TOKEN_WORD)
+		{
+			loop->wordCount++;
+		}
+		loop->words = arenaAlloc(&lineArena, (loop->wordCount + 1) * sizeof(char*));
+		for (int w = 0; w < loop->wordCount; w++)
+		{
+			loop->hasSubstitutions |= tokens[i].substitution;
+			loop->words[w] = tokens[i++].text;
+		}
+		if (i < tokenCount && tokens[i].type == TOKEN_SEMI)
+		{
+			i++;
+		}
+		else
+		{
+			expected = "\";\"";
+		}
+	}
+
+	if (expected == NULL && !*failed)
+	{
+		if (i < tokenCount && strcmp(tokens[i].text, "do") == 0)
+		{
+			i++;
+			loop->body = parseList(tokens, &i, tokenCount, true, failed);
+			if (loop->body == NULL)
+			{
+				expected = "a command after do";
+			}
+			else if (i < tokenCount && strcmp(tokens[i].text, "done") == 0)
+			{
+				i++;
+				if (i < tokenCount && tokens[i].type != TOKEN_SEMI)
+				{
+					expected = "\";\" after done";
+				}
+			}
+			else
+			{
+				expected = "done";
+			}
+		}
+		else
+		{
+			expected = "do";
+		}
+	}
+
+	if (*failed)
+	{
+		return NULL;
+	}
+	if (expected != NULL)
+	{
+		printf("Syntax error in %s loop: expected %s\n", command->command, expected);
+		fflush(stdout);
+		*failed = true;
+		return NULL;
+	}
+
+	markVariables(loop->condition);
+	markVariables(loop->body);
+	*position = i;
+	return command;
+}
+
+/**************************************************
+Function: parsePipeline
+
+Function takes the tokens of a line and the range
+[start, end) of one pipeline and builds its commandStruct
+chain. Each stage's argv is counted before it is allocated,
+so it has no fixed limit and no spare slots.
+
+A "|" token ends the current stage of a pipeline and starts
+the next one. Stages are chained through nextStage; the
+background flag applies to the whole pipeline and is set
+on every stage. A leading "time" word is dropped and sets
+the timed flag of the first stage instead (as does
+always-on timing). Likewise a leading "limit" with
+key=value settings becomes the first stage's policy, and a
+leading "timeout DURATION" its timeoutMs.
+
+"<<< word" gives the stage word plus a newline as its input;
+"<< WORD" records the here-document delimiter. Every ">" and
+">>" target is kept (see startFanOut).
+
+Returns NULL on a syntax error.
+***************************************************/
+
+static commandStruct* parsePipeline(struct lexToken* tokens, int start, int end)
+{
+	commandStruct* firstStage = NULL;
+	commandStruct* lastStage = NULL;
+	commandStruct* currentCommand = NULL;
+	bool argsDone = false;
+	bool background = false;
+	bool timed = false;
+	struct cgroupPolicy* policy = NULL;
+	long long timeoutMs = 0;
+	int index = 0;
+	int i;
+
+	for (i = start; i < end; i++)
+	{
+		struct lexToken* tk = &tokens[i];
+
+		// "time cmd ..." times the rest of the line
+		if (firstStage == NULL && !timed && strcmp(tk->text, "time") == 0
+			&& i + 1 < end && strcmp(tokens[i + 1].text, "-a") != 0)
+		{
+			timed = true;
+			continue;
+		}
+
+		// "limit key=value ... cmd" runs cmd in a cgroup of its own
+		if (firstStage == NULL && policy == NULL && strcmp(tk->text, "limit") == 0)
+		{
+			int settingsEnd = i + 1;
+			while (settingsEnd < end && strchr(tokens[settingsEnd].text, '=') != NULL)
+			{
+				settingsEnd++;
+			}
+			if (settingsEnd > i + 1 && settingsEnd < end)
+			{
+				policy = arenaCalloc(&lineArena, sizeof(struct cgroupPolicy));
+				for (i++; i < settingsEnd; i++)
+				{
+					if (!parseLimit(tokens[i].text, policy))
+					{
+						return NULL;
+					}
+				}
+				i--;
+				continue;
+			}
+		}
+
+		// "timeout DURATION cmd ..." limits how long cmd may run
+		if (firstStage == NULL && timeoutMs == 0 && strcmp(tk->text, "timeout") == 0
+			&& i + 2 < end && parseDuration(tokens[i + 1].text, &timeoutMs))
+		{
+			i++;
+			continue;
+		}
+
+		// start of a stage: first token is the command
+		if (currentCommand == NULL)
+		{
+			currentCommand = arenaCalloc(&lineArena, sizeof(commandStruct));
+			if (firstStage == NULL)
+			{
+				firstStage = currentCommand;
+			}
+			else
+			{
+				// link onto the end of the pipeline
+				lastStage->nextStage = currentCommand;
+			}
+			lastStage = currentCommand;
+
+			// argv takes the words up to the first operator, so it
+			// can be allocated at its exact size
+			int wordCount = 1;
+			while (i + wordCount < end && tokens[i + wordCount].type == TOKEN_WORD)
+			{
+				wordCount++;
+			}
+			currentCommand->arguments = arenaAlloc(&lineArena, (wordCount + 1) * sizeof(char*));
+			currentCommand->arguments[wordCount] = NULL;
+			currentCommand->argCount = wordCount;
+
+			// and so can the stage's output targets
+			int outputCount = 0;
+			for (int t = i + wordCount; t < end && tokens[t].type != TOKEN_PIPE; t++)
+			{
+				outputCount += (tokens[t].type == TOKEN_OUT || tokens[t].type == TOKEN_APPEND);
+			}
+			if (outputCount > 0)
+			{
+				currentCommand->outputTargets = arenaAlloc(&lineArena, outputCount * sizeof(struct outputTarget));
+			}
+
+			// command string; first element of argument array is same as command
+			currentCommand->command = tk->text;
+			currentCommand->arguments[0] = tk->text;
+			index = 1;   //arguments start at the second element of array
+			argsDone = false;
+			continue;
+		}
+
+		switch (tk->type)
+		{
+		// "|" token present, so the next token starts a new stage
+		case TOKEN_PIPE:
+			if (i + 1 == end)
+			{
+				printf("Syntax error after \"|\"\n");
+				fflush(stdout);
+				return NULL;
+			}
+			currentCommand = NULL;
+			break;
+
+		// "<" token present, so save next token as input source
+		case TOKEN_IN:
+			argsDone = true;
+			if (i + 1 == end)
+			{
+				printf("Syntax error after \"<\" \n");
+				fflush(stdout);
+				break;
+			}
+			currentCommand->inputRedir = tokens[++i].text;
+			break;
+
+		// "<<<" token present: the word after it is the input
+		case TOKEN_HERESTRING:
+		case TOKEN_HEREDOC:
+			argsDone = true;
+			char* hereWord = tk->text;
+			if (hereWord[0] == '\0')
+			{
+				if (i + 1 == end)
+				{
+					printf("Syntax error after \"%s\" \n", (tk->type == TOKEN_HEREDOC) ? "<<" : "<<<");
+					fflush(stdout);
+					return NULL;
+				}
+				hereWord = tokens[++i].text;
+			}
+			if (tk->type == TOKEN_HERESTRING)
+			{
+				size_t wordLength = strlen(hereWord);
+				currentCommand->hereData = arenaAlloc(&lineArena, wordLength + 2);
+				memcpy(currentCommand->hereData, hereWord, wordLength);
+				currentCommand->hereData[wordLength] = '\n';
+				currentCommand->hereData[wordLength + 1] = '\0';
+				currentCommand->hereLength = wordLength + 1;
+				currentCommand->hereDelimiter = NULL;
+				currentCommand->hereExpand = true;
+				break;
+			}
+
+			// "<<" token present: the body follows the line
+			size_t delimiterLength = strlen(hereWord);
+			currentCommand->hereExpand = true;
+			if (delimiterLength >= 2 && (hereWord[0] == '\'' || hereWord[0] == '"')
+				&& hereWord[delimiterLength - 1] == hereWord[0])
+			{
+				// quoted delimiter: the body is taken literally
+				hereWord[delimiterLength - 1] = '\0';
+				hereWord++;
+				currentCommand->hereExpand = false;
+			}
+			currentCommand->hereDelimiter = hereWord;
+			break;
+
+		// ">" or ">>" token present, so add next token as an output target
+		case TOKEN_OUT:
+		case TOKEN_APPEND:
+			argsDone = true;
+			if (i + 1 == end)
+			{
+				printf("Syntax error after \"%s\"\n", tk->text);
+				fflush(stdout);
+				break;
+			}
+			struct outputTarget* target = &currentCommand->outputTargets[currentCommand->outputCount++];
+			target->path = tokens[++i].text;
+			target->append = (tk->type == TOKEN_APPEND);
+			currentCommand->outputRedir = currentCommand->outputTargets[0].path;
+			break;
+
+		// & token present, so this command should run in background mode
+		case TOKEN_BKGRD:
+			argsDone = true;
+			background = true;
+			break;
+
+		// Sends words to arguments array until any of the
+		// special characters ( <, >, & ) is seen in this stage
+		case TOKEN_WORD:
+			if (!argsDone)
+			{
+				currentCommand->arguments[index++] = tk->text;
+			}
+			break;
+
+		// ";" never falls inside a pipeline (see parseList)
+		case TOKEN_SEMI:
+			break;
+		}
+	}
+
+	if (firstStage == NULL)
+	{
+		printf("Syntax error near \"%s\"\n", tokens[start].text);
+		fflush(stdout);
+		return NULL;
+	}
+
+	// background mode applies to every stage of the pipeline
+	for (currentCommand = firstStage; currentCommand != NULL; currentCommand = currentCommand->nextStage)
+	{
+		currentCommand->bkgrdInd = background;
+	}
+	firstStage->timed = timed || alwaysTime;
+	firstStage->policy = policy;
+	firstStage->timeoutMs = timeoutMs;
+
+	// a $(...) runs each time the pipeline does
+	for (i = start; i < end; i++)
+	{
+		firstStage->hasSubstitutions |= tokens[i].substitution;
+	}
+
+	return firstStage;
+}
+
+
+/**************************************************
+Function: readHereDocuments
+
+Function takes the list processInput made and, for every
+stage with a pending here-document (loops included, in the
+order they appear on the line), reads the body from the
+following input lines up to the delimiter line (showing a
+"> " prompt in interactive mode). The body is kept as it
+was typed: unless the delimiter was quoted, its variables
+($$ included) are expanded when the command runs, by
+bindVariables. The body is collected in a growing buffer
+and moved into the line arena when complete.
+End of input also ends the body, with a warning.
+
+Returns false, after reading all bodies, if a line with a
+here-document should not run (input ended inside the body).
+***************************************************/
+
+bool readHereDocuments(commandStruct* commandLine, struct jobTable* jobs)
+{
+	bool complete = true;
+
+	for (commandStruct* command = commandLine; command != NULL; command = command->nextCommand)
+	{
+		if (command->loop != NULL)
+		{
+			complete = readHereDocuments(command->loop->condition, jobs) && complete;
+			complete = readHereDocuments(command->loop->body, jobs) && complete;
+			continue;
+		}
+
+		for (commandStruct* stage = command; stage != NULL; stage = stage->nextStage)
+		{
+			if (stage->hereDelimiter == NULL)
+			{
+				continue;
+			}
+
+			char* body = NULL;
+			size_t length = 0;
+			size_t capacity = 0;
+			char* line;
+
+			while (true)
+			{
+				if (interactiveMode)
+				{
+					printf("> ");
+					fflush(stdout);
+				}
+				line = readInputLine(jobs);
+				if (line == NULL || strcmp(line, stage->hereDelimiter) == 0)
+				{
+					break;
+				}
+
+				size_t lineLength = strlen(line);
+				size_t needed = length + lineLength + 1;
+				if (needed > capacity)
+				{
+					capacity = (needed > 2 * capacity) ? needed : 2 * capacity;
+					body = realloc(body, capacity);
+				}
+				memcpy(&body[length], line, lineLength);
+				length += lineLength;
+				body[length++] = '\n';
+			}
+
+			if (line == NULL)
+			{
+				printf("here-document ended by end of input (wanted \"%s\")\n", stage->hereDelimiter);
+				fflush(stdout);
+				complete = false;
+			}
+
+			stage->hereData = arenaAlloc(&lineArena, length + 1);
+			if (length > 0)
+			{
+				memcpy(stage->hereData, body, length);
+			}
+			stage->hereData[length] = '\0';
+			stage->hereLength = length;
+			stage->hereDelimiter = NULL;
+			free(body);
+		}
+	}
+
+	return complete;
+}
+
+
+/**************************************************
+Function: appendCompiled
+
+Function takes a section of a compiled script being built,
+data and its size, and appends the data (zeroes if data is
+NULL), doubling the section as needed. Returns the byte
+offset the data starts at within the section.
+***************************************************/
+
+static uint32_t appendCompiled(struct compileBuffer* buffer, const void* data, size_t size)
+{
+	size_t offset = buffer->length;
+
+	if (buffer->length + size > buffer->capacity)
+	{
+		buffer->capacity = (buffer->capacity == 0) ? 4096 : buffer->capacity * 2;
+		while (buffer->length + size > buffer->capacity)
+		{
+			buffer->capacity *= 2;
+		}
+		buffer->data = realloc(buffer->data, buffer->capacity);
+	}
+	if (data != NULL)
+	{
+		memcpy(buffer->data + offset, data, size);
+	}
+	else
+	{
+		memset(buffer->data + offset, 0, size);
+	}
+	buffer->length += size;
+	return offset;
+}
+
+/**************************************************
+Function: compileString
+
+Function takes the sections being built and a string of
+the given length, or NULL, and returns its offset in the
+string pool, adding it unless the same string is already
+there (the same command names, paths and words recur all
+through a script). Returns COMPILED_NONE for NULL.
+***************************************************/
+
+static uint32_t compileString(struct compileSections* out, const char* text, size_t length)
+{
+	if (text == NULL)
+	{
+		return COMPILED_NONE;
+	}
+
+	if ((out->stringCount + 1) * 2 > out->stringCapacity)
+	{
+		uint32_t* oldStrings = out->strings;
+		size_t oldCapacity = out->stringCapacity;
+
+		out->stringCapacity = (oldCapacity == 0) ? 1024 : oldCapacity * 2;
+		out->strings = calloc(out->stringCapacity, sizeof(uint32_t));
+		for (size_t i = 0; i < oldCapacity; i++)
+		{
+			if (oldStrings[i] != 0)
+			{
+				const char* pooled = out->pool.data + oldStrings[i] - 1;
+				size_t slot = hashVariable(pooled, strlen(pooled)) & (out->stringCapacity - 1);
+				while (out->strings[slot] != 0)
+				{
+					slot = (slot + 1) & (out->stringCapacity - 1);
+				}
+				out->strings[slot] = oldStrings[i];
+			}
+		}
+		free(oldStrings);
+	}
+
+	size_t slot = hashVariable(text, length) & (out->stringCapacity - 1);
+	while (out->strings[slot] != 0)
+	{
+		const char* pooled = out->pool.data + out->strings[slot] - 1;
+		if (memcmp(pooled, text, length) == 0 && pooled[length] == '\0')
+		{
+			return out->strings[slot] - 1;
+		}
+		slot = (slot + 1) & (out->stringCapacity - 1);
+	}
+
+	uint32_t offset = appendCompiled(&out->pool, text, length);
+	appendCompiled(&out->pool, "", 1);
+	out->strings[slot] = offset + 1;
+	out->stringCount++;
+	return offset;
+}
+
+/**************************************************
+Function: compileCommand
+
+Function takes the sections being built and a list made by
+processInput (after readHereDocuments), and adds a record
+for every command of it: its stages, the commands after it
+and any loop, with their lists. A record's slot is taken
+before the records it refers to are added, so they follow
+it. Returns the first command's index + 1, or 0 for NULL.
+***************************************************/
+
+static uint32_t compileCommand(struct compileSections* out, commandStruct* command)
+{
+	if (command == NULL)
+	{
+		return 0;
+	}
+
+	struct compiledCommand record = { 0 };
+	uint32_t index = appendCompiled(&out->commands, NULL, sizeof(record)) / sizeof(record);
+
+	record.argCount = command->argCount;
+	record.arguments = out->args.length / sizeof(uint32_t);
+	appendCompiled(&out->args, NULL, command->argCount * sizeof(uint32_t));
+	for (int i = 0; i < command->argCount; i++)
+	{
+		uint32_t offset = compileString(out, command->arguments[i], strlen(command->arguments[i]));
+		memcpy(out->args.data + (record.arguments + i) * sizeof(uint32_t), &offset, sizeof(offset));
+	}
+
+	record.inputRedir = compileString(out, command->inputRedir,
+		(command->inputRedir != NULL) ? strlen(command->inputRedir) : 0);
+	record.targets = out->targets.length / sizeof(struct compiledTarget);
+	record.targetCount = command->outputCount;
+	for (int i = 0; i < command->outputCount; i++)
+	{
+		struct compiledTarget target = {
+			compileString(out, command->outputTargets[i].path, strlen(command->outputTargets[i].path)),
+			command->outputTargets[i].append };
+		appendCompiled(&out->targets, &target, sizeof(target));
+	}
+	record.hereData = compileString(out, command->hereData, command->hereLength);
+	record.hereLength = command->hereLength;
+	if (command->policy != NULL)
+	{
+		record.policy = appendCompiled(&out->policies, command->policy, sizeof(struct cgroupPolicy))
+			/ sizeof(struct cgroupPolicy) + 1;
+	}
+
+	record.flags = (command->bkgrdInd ? COMPILED_BACKGROUND : 0)
+		| (command->timed ? COMPILED_TIMED : 0)
+		| (command->hereExpand ? COMPILED_HERE_EXPAND : 0)
+		| (command->hasVariables ? COMPILED_VARIABLES : 0)
+		| (command->hasSubstitutions ? COMPILED_SUBSTITUTIONS : 0);
+	record.timeoutMs = (uint32_t)command->timeoutMs;
+
+	if (command->loop != NULL)
+	{
+		struct loopStruct* loop = command->loop;
+		struct compiledLoop compiled = { 0 };
+		uint32_t loopIndex = appendCompiled(&out->loops, NULL, sizeof(compiled)) / sizeof(compiled);
+
+		compiled.variable = compileString(out, loop->variable, (loop->variable != NULL) ? strlen(loop->variable) : 0);
+		compiled.words = out->args.length / sizeof(uint32_t);
+		compiled.wordCount = loop->wordCount;
+		for (int w = 0; w < loop->wordCount; w++)
+		{
+			uint32_t offset = compileString(out, loop->words[w], strlen(loop->words[w]));
+			appendCompiled(&out->args, &offset, sizeof(offset));
+		}
+		compiled.flags = (loop->isWhile ? COMPILED_WHILE : 0)
+			| (loop->hasSubstitutions ? COMPILED_SUBSTITUTIONS : 0);
+		compiled.condition = compileCommand(out, loop->condition);
+		compiled.body = compileCommand(out, loop->body);
+		memcpy(out->loops.data + loopIndex * sizeof(compiled), &compiled, sizeof(compiled));
+		record.loop = loopIndex + 1;
+	}
+
+	record.nextStage = compileCommand(out, command->nextStage);
+	record.nextCommand = compileCommand(out, command->nextCommand);
+	memcpy(out->commands.data + index * sizeof(record), &record, sizeof(record));
+	return index + 1;
+}
+
+/**************************************************
+Function: hashScript
+
+Function takes the script's bytes and their count and
+returns their 64-bit FNV-1a hash, the key a compiled script
+is checked against.
+***************************************************/
+
+static uint64_t hashScript(const char* data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ULL;
+
+	for (size_t i = 0; i < size; i++)
+	{
+		hash = (hash ^ (unsigned char)data[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+/**************************************************
+Function: compileScript
+
+Function takes the sections to build and the background
+job table and compiles the mapped script: every line is
+parsed as it would be when run, here-document bodies are
+read with it, and the list is added with compileCommand.
+The lines are read from a private mapping of their own, so
+the script's mapping is untouched for running it the usual
+way if compiling fails. Nothing that depends on the run is
+fixed here: $$ is left for bindVariables (lateBindPid) and
+always-on timing is applied when a line is loaded. Parse
+errors are not shown now; the line is kept as text and
+parsed again, showing them, when its turn comes.
+
+Returns false if the script cannot be compiled: a line was
+over argMax, or input ended inside a here-document.
+***************************************************/
+
+static bool compileScript(struct compileSections* out, struct jobTable* jobs)
+{
+	char* savedMap = scriptMap;
+	size_t savedPos = scriptPos;
+	int savedIgnored = linesIgnored;
+	bool savedTime = alwaysTime;
+	bool compiled = true;
+	char* line;
+
+	scriptMap = mmap(NULL, scriptSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, inputFd, 0);
+	if (scriptMap == MAP_FAILED)
+	{
+		scriptMap = savedMap;
+		return false;
+	}
+	scriptPos = 0;
+
+	// parse errors are shown when the line runs, not now
+	fflush(stdout);
+	int savedOut = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+	int nullFd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+	if (nullFd != -1)
+	{
+		dup2(nullFd, STDOUT_FILENO);
+		close(nullFd);
+	}
+	lateBindPid = true;
+	alwaysTime = false;
+
+	while (compiled && (line = nextMappedLine()) != NULL)
+	{
+		struct compiledLine entry = { 0, COMPILED_NONE };
+		char* rawText = arenaStrdup(&lineArena, line);
+		char* first = rawText + strspn(rawText, " ");
+
+		commandStruct* commandLine = processInput(line);
+		if (commandLine != NULL)
+		{
+			compiled = readHereDocuments(commandLine, jobs);
+			entry.command = compileCommand(out, commandLine);
+		}
+		else if (*first != '\0' && strncmp(first, COMMENT, 1) != 0)
+		{
+			entry.rawText = compileString(out, rawText, strlen(rawText));
+		}
+		if (entry.command != 0 || entry.rawText != COMPILED_NONE)
+		{
+			appendCompiled(&out->lines, &entry, sizeof(entry));
+		}
+		freeCommandLine();
+	}
+	compiled = compiled && linesIgnored == savedIgnored;
+
+	lateBindPid = false;
+	alwaysTime = savedTime;
+	linesIgnored = savedIgnored;
+	fflush(stdout);
+	dup2(savedOut, STDOUT_FILENO);
+	close(savedOut);
+	munmap(scriptMap, scriptSize);
+	scriptMap = savedMap;
+	scriptPos = savedPos;
+	return compiled;
+}
+
+/**************************************************
+Function: writeCompiledImage
+
+Function takes the built sections and the script's hash
+and lays them out as one image behind a compiledHeader,
+each section aligned to 8 bytes. Returns the malloc'd image
+and sets *imageSize, or returns NULL if it would not fit
+the 32-bit offsets.
+***************************************************/
+
+static char* writeCompiledImage(struct compileSections* out, uint64_t scriptHash, size_t* imageSize)
+{
+	struct compileBuffer* sections[] = { &out->lines, &out->commands, &out->loops,
+		&out->args, &out->targets, &out->policies, &out->pool };
+	uint32_t offsets[7];
+	size_t size = sizeof(struct compiledHeader);
+
+	for (int i = 0; i < 7; i++)
+	{
+		size = (size + 7) & ~(size_t)7;
+		offsets[i] = size;
+		size += sections[i]->length;
+	}
+	if (size > UINT32_MAX)
+	{
+		return NULL;
+	}
+
+	char* image = calloc(1, size);
+	struct compiledHeader* header = (struct compiledHeader*)image;
+	memcpy(header->magic, COMPILED_MAGIC, sizeof(header->magic));
+	header->scriptHash = scriptHash;
+	header->scriptSize = scriptSize;
+	header->imageSize = size;
+	header->lineCount = out->lines.length / sizeof(struct compiledLine);
+	header->lineOffset = offsets[0];
+	header->commandOffset = offsets[1];
+	header->loopOffset = offsets[2];
+	header->argOffset = offsets[3];
+	header->targetOffset = offsets[4];
+	header->policyOffset = offsets[5];
+	header->poolOffset = offsets[6];
+	for (int i = 0; i < 7; i++)
+	{
+		if (sections[i]->length > 0)
+		{
+			memcpy(image + offsets[i], sections[i]->data, sections[i]->length);
+		}
+	}
+
+	*imageSize = size;
+	return image;
+}
+
+/**************************************************
+Function: compiledReference, checkCompiledImage
+
+checkCompiledImage takes a cached compiled script and its
+size and returns whether every reference in it stays inside
+it: the sections lie in order within the image, each index
+and run is inside its table, each pool offset inside the
+pool (which ends in a NUL, so every string is terminated),
+and commands only refer to commands after them, as
+compileCommand lays them out, so loading one cannot loop.
+compiledReference checks one command index + 1 made by the
+command at index owner. A cache that fails is compiled
+again.
+***************************************************/
+
+static bool compiledReference(uint32_t reference, uint32_t owner, uint32_t commandCount)
+{
+	return reference == 0 || (reference > owner + 1 && reference <= commandCount);
+}
+
+static bool checkCompiledImage(char* image, size_t size)
+{
+	struct compiledHeader* header = (struct compiledHeader*)image;
+	uint32_t bounds[] = { header->lineOffset, header->commandOffset, header->loopOffset, header->argOffset,
+		header->targetOffset, header->policyOffset, header->poolOffset, (uint32_t)size };
+
+	if (bounds[0] < sizeof(struct compiledHeader))
+	{
+		return false;
+	}
+	for (int i = 0; i < 7; i++)
+	{
+		if (bounds[i] > bounds[i + 1] || bounds[i] % 8 != 0)
+		{
+			return false;
+		}
+	}
+
+	uint32_t commandCount = (header->loopOffset - header->commandOffset) / sizeof(struct compiledCommand);
+	uint32_t loopCount = (header->argOffset - header->loopOffset) / sizeof(struct compiledLoop);
+	uint32_t argCount = (header->targetOffset - header->argOffset) / sizeof(uint32_t);
+	uint32_t targetCount = (header->policyOffset - header->targetOffset) / sizeof(struct compiledTarget);
+	uint32_t policyCount = (header->poolOffset - header->policyOffset) / sizeof(struct cgroupPolicy);
+	uint32_t poolSize = size - header->poolOffset;
+	struct compiledLine* lines = (struct compiledLine*)(image + header->lineOffset);
+	struct compiledCommand* commands = (struct compiledCommand*)(image + header->commandOffset);
+	struct compiledLoop* loops = (struct compiledLoop*)(image + header->loopOffset);
+	uint32_t* argTable = (uint32_t*)(image + header->argOffset);
+	struct compiledTarget* targets = (struct compiledTarget*)(image + header->targetOffset);
+
+	if (header->lineCount > (header->commandOffset - header->lineOffset) / sizeof(struct compiledLine)
+		|| (poolSize > 0 && image[size - 1] != '\0'))
+	{
+		return false;
+	}
+	for (uint32_t i = 0; i < header->lineCount; i++)
+	{
+		if ((lines[i].command == 0 && lines[i].rawText >= poolSize) || lines[i].command > commandCount)
+		{
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < argCount; i++)
+	{
+		if (argTable[i] >= poolSize)
+		{
+			return false;
+		}
+	}
+	for (uint32_t i = 0; i < targetCount; i++)
+	{
+		if (targets[i].path >= poolSize)
+		{
+			return false;
+		}
+	}
+
+	for (uint32_t i = 0; i < commandCount; i++)
+	{
+		struct compiledCommand* record = &commands[i];
+		if ((uint64_t)record->arguments + record->argCount > argCount
+			|| (record->argCount == 0 && record->loop == 0)
+			|| (record->inputRedir != COMPILED_NONE && record->inputRedir >= poolSize)
+			|| (uint64_t)record->targets + record->targetCount > targetCount
+			|| (record->hereData != COMPILED_NONE && (uint64_t)record->hereData + record->hereLength >= poolSize)
+			|| record->policy > policyCount || record->loop > loopCount
+			|| !compiledReference(record->nextStage, i, commandCount)
+			|| !compiledReference(record->nextCommand, i, commandCount))
+		{
+			return false;
+		}
+		if (record->loop != 0)
+		{
+			struct compiledLoop* loop = &loops[record->loop - 1];
+			if ((loop->variable != COMPILED_NONE && loop->variable >= poolSize)
+				|| (uint64_t)loop->words + loop->wordCount > argCount
+				|| !compiledReference(loop->condition, i, commandCount)
+				|| !compiledReference(loop->body, i, commandCount))
+			{
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+/**************************************************
+Function: openCompiledScript
+
+Function takes the path of the script being run (already
+mapped by openInput) and the background job table, and
+sets up compiledImage so the script runs without parsing.
+The compiled script is cached next to the script, as
+path.smc, keyed by a hash of the script's contents: a cache
+file whose hash, size and format match, and that passes
+checkCompiledImage, is mapped and used as it is. Otherwise the script is compiled, the image
+written to the cache (through a temporary file renamed into
+place, and only if the directory is writable) and run from
+memory. SMALLSH_SCRIPT_CACHE=0 turns this off, and a script
+that does not compile runs line by line as before.
+***************************************************/
+
+void openCompiledScript(const char* path, struct jobTable* jobs)
+{
+	char* cacheSetting = getenv("SMALLSH_SCRIPT_CACHE");
+	struct compileSections sections = { { 0 } };
+	char cachePath[PATH_MAX];
+	struct stat cacheStat;
+
+	if (scriptMap == NULL || (cacheSetting != NULL && strcmp(cacheSetting, "0") == 0)
+		|| snprintf(cachePath, sizeof(cachePath), "%s.smc", path) >= (int)sizeof(cachePath))
+	{
+		return;
+	}
+	uint64_t scriptHash = hashScript(scriptMap, scriptSize);
+
+	int cacheFd = open(cachePath, O_RDONLY | O_CLOEXEC);
+	if (cacheFd != -1)
+	{
+		if (fstat(cacheFd, &cacheStat) == 0 && (size_t)cacheStat.st_size >= sizeof(struct compiledHeader))
+		{
+			char* image = mmap(NULL, cacheStat.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, cacheFd, 0);
+			struct compiledHeader* header = (struct compiledHeader*)image;
+			if (image != MAP_FAILED && memcmp(header->magic, COMPILED_MAGIC, sizeof(header->magic)) == 0
+				&& header->scriptHash == scriptHash && header->scriptSize == scriptSize
+				&& header->imageSize == (uint64_t)cacheStat.st_size
+				&& checkCompiledImage(image, cacheStat.st_size))
+			{
+				compiledImage = image;
+				compiledSize = cacheStat.st_size;
+				compiledMapped = true;
+			}
+			else if (image != MAP_FAILED)
+			{
+				munmap(image, cacheStat.st_size);
+			}
+		}
+		close(cacheFd);
+		if (compiledImage != NULL)
+		{
+			return;
+		}
+	}
+
+	if (compileScript(&sections, jobs))
+	{
+		compiledImage = writeCompiledImage(&sections, scriptHash, &compiledSize);
+	}
+	struct compileBuffer* buffers[] = { &sections.lines, &sections.commands, &sections.loops,
+		&sections.args, &sections.targets, &sections.policies, &sections.pool };
+	for (int i = 0; i < 7; i++)
+	{
+		free(buffers[i]->data);
+	}
+	free(sections.strings);
+	if (compiledImage == NULL)
+	{
+		return;
+	}
+
+	char tempPath[PATH_MAX + 8];
+	snprintf(tempPath, sizeof(tempPath), "%s.XXXXXX", cachePath);
+	int tempFd = mkostemp(tempPath, O_CLOEXEC);
+	if (tempFd != -1)
+	{
+		bool written = (write(tempFd, compiledImage, compiledSize) == (ssize_t)compiledSize);
+		close(tempFd);
+		if (!written || rename(tempPath, cachePath) == -1)
+		{
+			unlink(tempPath);
+		}
+	}
+}
+
+/**************************************************
+Function: loadCompiledCommand
+
+Function takes a command index + 1 in the compiled script
+and whether it starts a pipeline, and builds the list from
+there as processInput would have: commandStructs in the
+line arena whose strings point into the image's pool, so
+nothing is copied or parsed. Always-on timing applies to
+the first stage of a pipeline, as in parsePipeline.
+Returns NULL for 0, or for an index past the command table
+(a cached image was checked by checkCompiledImage).
+***************************************************/
+
+static commandStruct* loadCompiledCommand(uint32_t reference, bool firstStage)
+{
+	struct compiledHeader* header = (struct compiledHeader*)compiledImage;
+
+	if (reference == 0 || reference > (header->loopOffset - header->commandOffset) / sizeof(struct compiledCommand))
+	{
+		return NULL;
+	}
+
+	struct compiledCommand* record = (struct compiledCommand*)(compiledImage + header->commandOffset) + reference - 1;
+	uint32_t* argTable = (uint32_t*)(compiledImage + header->argOffset);
+	char* pool = compiledImage + header->poolOffset;
+	commandStruct* command = arenaCalloc(&lineArena, sizeof(commandStruct));
+
+	command->argCount = record->argCount;
+	command->arguments = arenaAlloc(&lineArena, (record->argCount + 1) * sizeof(char*));
+	for (uint32_t i = 0; i < record->argCount; i++)
+	{
+		command->arguments[i] = pool + argTable[record->arguments + i];
+	}
+	command->arguments[record->argCount] = NULL;
+	command->command = command->arguments[0];
+
+	command->inputRedir = (record->inputRedir != COMPILED_NONE) ? pool + record->inputRedir : NULL;
+	command->outputCount = record->targetCount;
+	if (record->targetCount > 0)
+	{
+		struct compiledTarget* targets = (struct compiledTarget*)(compiledImage + header->targetOffset) + record->targets;
+		command->outputTargets = arenaAlloc(&lineArena, record->targetCount * sizeof(struct outputTarget));
+		for (uint32_t i = 0; i < record->targetCount; i++)
+		{
+			command->outputTargets[i].path = pool + targets[i].path;
+			command->outputTargets[i].append = targets[i].append;
+		}
+		command->outputRedir = command->outputTargets[0].path;
+	}
+	if (record->hereData != COMPILED_NONE)
+	{
+		command->hereData = pool + record->hereData;
+		command->hereLength = record->hereLength;
+	}
+	if (record->policy != 0)
+	{
+		command->policy = (struct cgroupPolicy*)(compiledImage + header->policyOffset) + record->policy - 1;
+	}
+
+	command->bkgrdInd = (record->flags & COMPILED_BACKGROUND) != 0;
+	command->timed = (record->flags & COMPILED_TIMED) != 0 || (firstStage && alwaysTime && record->loop == 0);
+	command->hereExpand = (record->flags & COMPILED_HERE_EXPAND) != 0;
+	command->hasVariables = (record->flags & COMPILED_VARIABLES) != 0;
+	command->hasSubstitutions = (record->flags & COMPILED_SUBSTITUTIONS) != 0;
+	command->timeoutMs = record->timeoutMs;
+
+	if (record->loop != 0)
+	{
+		struct compiledLoop* compiled = (struct compiledLoop*)(compiledImage + header->loopOffset) + record->loop - 1;
+		struct loopStruct* loop = arenaCalloc(&lineArena, sizeof(struct loopStruct));
+
+		loop->isWhile = (compiled->flags & COMPILED_WHILE) != 0;
+		loop->hasSubstitutions = (compiled->flags & COMPILED_SUBSTITUTIONS) != 0;
+		loop->variable = (compiled->variable != COMPILED_NONE) ? pool + compiled->variable : NULL;
+		loop->wordCount = compiled->wordCount;
+		loop->words = arenaAlloc(&lineArena, (compiled->wordCount + 1) * sizeof(char*));
+		for (uint32_t w = 0; w < compiled->wordCount; w++)
+		{
+			loop->words[w] = pool + argTable[compiled->words + w];
+		}
+		loop->condition = loadCompiledCommand(compiled->condition, true);
+		loop->body = loadCompiledCommand(compiled->body, true);
+		command->loop = loop;
+	}
+
+	command->nextStage = loadCompiledCommand(record->nextStage, false);
+	command->nextCommand = loadCompiledCommand(record->nextCommand, true);
+	return command;
+}
+
+/**************************************************
+Function: nextCompiledLine
+
+Function sets *commandLine to the list of the compiled
+script's next line, ready to run: loaded from the image, or
+for a line that did not compile, parsed from its text now
+(showing its syntax error, and giving NULL). Returns false
+at the end of the script.
+***************************************************/
+
+bool nextCompiledLine(commandStruct** commandLine)
+{
+	struct compiledHeader* header = (struct compiledHeader*)compiledImage;
+
+	if (compiledNext >= header->lineCount)
+	{
+		return false;
+	}
+
+	struct compiledLine* line = (struct compiledLine*)(compiledImage + header->lineOffset) + compiledNext++;
+	if (line->command != 0)
+	{
+		*commandLine = loadCompiledCommand(line->command, true);
+	}
+	else
+	{
+		*commandLine = processInput(arenaStrdup(&lineArena, compiledImage + header->poolOffset + line->rawText));
+	}
+	return true;
+}
+
+/**************************************************
+Function: closeCompiledScript
+
+Function releases the compiled script's image, mapped or
+built in memory.
+***************************************************/
+
+void closeCompiledScript(void)
+{
+	if (compiledImage != NULL && compiledMapped)
+	{
+		munmap(compiledImage, compiledSize);
+	}
+	else
+	{
+		free(compiledImage);
+	}
+	compiledImage = NULL;
+}
+
+/**************************************************
+Function: freeCommandLine
+
+Function frees the memory for the command line that was
+just executed: the expanded input string and every
+commandStruct of its pipeline live in the line arena, so
+this is a single arenaReset.
+
+***************************************************/
+
+void freeCommandLine(void)
+{
+	arenaReset(&lineArena);
+}
+
+
+/**************************************************
+Function: exitProcess
+
+Function frees the dynamically allocated memory for the
+command line before the shell exits.
+
+***************************************************/
+void exitProcess(void)
+{
+	freeCommandLine();
+}
+
+/**************************************************
+Function: cdProcess
+
+Function takes string with path to desired directory and
+changes the current working directory of the process.
+
+References:
+Code adapted from examples at:
+https://iq.opengenus.org/chdir-fchdir-getcwd-in-c/
+and
+Module 4: Exploration on Environment
+https://canvas.oregonstate.edu/courses/1830250/pages/
+exploration-environment?module_item_id=21468875
+***************************************************/
+
+void cdProcess(char* pathString)
+{
+	char* newDir;
+	char cwd[256];
+
+	if (pathString == NULL) 
+	{
+		newDir = getenv("HOME");
+	}
+	else
+	{
+		newDir = pathString;
+	}
+	
+	if (chdir(newDir) != 0)
+	{
+		perror("chdir() error()");
+		fflush(stdout);
+	}
+	else 
+	{
+		if (getcwd(cwd, sizeof(cwd)) == NULL)
+		{
+			perror("getcwd() error");
+			fflush(stdout);
+		}
+		else
+		{
+			//printf("Current directory is: %s \n", cwd); //for testing
+			//fflush(stdout);
+		}
+	}
+}
+
+
+/**************************************************
+Function: statusProcess
+
+Function takes int pointer to status code and last
+Foreground process ID. Prints out exit code or
+exit signal of last process, after "timed out, " if its
+timeout ended it
+
+References:
+Code directly based on examples from
+Course Module 4: Monitoring Child Processes
+https://canvas.oregonstate.edu/courses/1830250/pages/
+exploration-process-api-monitoring-child-processes?module_item_id=21468873
+***************************************************/
+void statusProcess(int* lastStatus, int* lastForegroundPid)
+{
+	//printf("Status process function input:  %d\n", *lastStatus); //for testing
+	//fflush(stdout);
+
+	// its timeout (see waitTimeout) may have ended it
+	if (lastTimedOut)
+	{
+		printf("timed out, ");
+	}
+
+	if (WIFEXITED(*lastStatus)) {
+		//for testing
+		//printf("process (%d) exit value %d\n", *lastForegroundPid, WEXITSTATUS(*lastStatus));
+		printf("exit value %d\n", WEXITSTATUS(*lastStatus));
+		fflush(stdout);
+	}
+	else {
+		//for testing
+		//printf("process (%d) terminated by signal %d\n", *lastForegroundPid, WTERMSIG(*lastStatus));
+		printf("terminated by signal %d", WTERMSIG(*lastStatus));
+		// a cgroup limit (see executeAsChild) may have done it
+		if (lastLimitHit != NULL)
+		{
+			printf(" (%s)", lastLimitHit);
+		}
+		printf("\n");
+		fflush(stdout);
+	}
+}
+
+/**************************************************
+Function: lastExitStatus
+
+Function takes int pointer to the status code of the last
+foreground process and converts it to an exit status for
+the shell itself, the way other shells do: the exit value,
+or 128 + the number of the signal that terminated it.
+***************************************************/
+int lastExitStatus(int* lastStatus)
+{
+	if (WIFEXITED(*lastStatus))
+	{
+		return WEXITSTATUS(*lastStatus);
+	}
+	return 128 + WTERMSIG(*lastStatus);
+}
+
+/**************************************************
+Function: statusBackground
+
+Function takes int pointers representing a status of 
+a child process and a process ID and prints out messages 
+about their resolution to the console. Part of the process of
+monitoring and checking background processes. A job that
+ran out of time (timedOut) is reported as timed out before
+how it ended. limitHit, if
+not NULL, names the cgroup limit that killed the job, and
+usageString, if not NULL, is the job's resource usage from
+formatUsage; each is added in parentheses.
+
+References:
+Code directly based on examples from
+Course Module 4: Monitoring Child Processes
+https://canvas.oregonstate.edu/courses/1830250/pages/
+exploration-process-api-monitoring-child-processes?module_item_id=21468873
+***************************************************/
+
+void statusBackground(int* childStatus, int* childPid, bool timedOut, const char* limitHit, char* usageString)
+{
+	
+	printf("background pid %d is done: ", *childPid);
+	if (timedOut)
+	{
+		printf("timed out, ");
+	}
+
+	if (WIFEXITED(*childStatus)) {
+		
+		printf("exit value %d", WEXITSTATUS(*childStatus));
+	}
+	else {
+		
+		printf("terminated by signal %d", WTERMSIG(*childStatus));
+	}
+
+	if (limitHit != NULL)
+	{
+		printf(" (%s)", limitHit);
+	}
+	if (usageString != NULL)
+	{
+		printf(" (%s)", usageString);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+/**************************************************
+Function: addUsage
+
+Function takes a running total and the rusage of one more
+reaped process of the same command, and adds the second to
+the first: CPU times and fault counts are summed, max RSS
+is the largest of any one process.
+***************************************************/
+
+void addUsage(struct rusage* total, struct rusage* usage)
+{
+	timeradd(&total->ru_utime, &usage->ru_utime, &total->ru_utime);
+	timeradd(&total->ru_stime, &usage->ru_stime, &total->ru_stime);
+	if (usage->ru_maxrss > total->ru_maxrss)
+	{
+		total->ru_maxrss = usage->ru_maxrss;
+	}
+	total->ru_majflt += usage->ru_majflt;
+	total->ru_minflt += usage->ru_minflt;
+}
+
+/**************************************************
+Function: formatUsage
+
+Function takes a buffer of USAGE_STRING_LENGTH bytes, the
+time a command was started and its (summed) rusage, and
+writes a one-line resource report: wall time, user and
+system CPU time, max RSS and major/minor page faults.
+***************************************************/
+
+void formatUsage(char* usageString, struct timespec* started, struct rusage* usage)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double wallTime = (now.tv_sec - started->tv_sec) + (now.tv_nsec - started->tv_nsec) / 1e9;
+
+	snprintf(usageString, USAGE_STRING_LENGTH,
+		"real %.3fs user %.3fs sys %.3fs maxrss %ldKB majflt %ld minflt %ld",
+		wallTime,
+		usage->ru_utime.tv_sec + usage->ru_utime.tv_usec / 1e6,
+		usage->ru_stime.tv_sec + usage->ru_stime.tv_usec / 1e6,
+		usage->ru_maxrss, usage->ru_majflt, usage->ru_minflt);
+}
+
+/**************************************************
+Function: timeProcess
+
+Built-in command time, when it is given no command to time
+(time cmd ... is handled by processInput as a prefix).
+"time -a on" and "time -a off" turn always-on timing, which
+reports every command as if it had the prefix, on and off;
+plain "time" shows whether it is on.
+***************************************************/
+
+void timeProcess(char** arguments)
+{
+	if (arguments[1] != NULL && strcmp(arguments[1], "-a") == 0 && arguments[2] != NULL)
+	{
+		alwaysTime = (strcmp(arguments[2], "on") == 0);
+	}
+	printf("always-on timing is %s\n", alwaysTime ? "on" : "off");
+	fflush(stdout);
+}
+
+/**************************************************
+Function: timeoutProcess
+
+Built-in command timeout, when it is not a prefix (timeout
+DURATION cmd ... is handled by processInput). "timeout -a
+DURATION" sets the default timeout of every command and
+"timeout -a off" clears it; "timeout -k DURATION" sets how
+long a command has after SIGTERM before it gets SIGKILL.
+Plain "timeout" shows both.
+
+Returns 0, 1 after a usage message for a bad -a, or
+BUILTIN_FALLBACK for any other form (timeout -s KILL 1 cmd,
+timeout -k 1 5 cmd, ...), which the timeout program runs.
+***************************************************/
+
+int timeoutProcess(char** arguments)
+{
+	long long ms;
+	if (arguments[1] == NULL)
+	{
+		if (defaultTimeoutMs > 0)
+		{
+			printf("default timeout is %gs", defaultTimeoutMs / 1e3);
+		}
+		else
+		{
+			printf("default timeout is off");
+		}
+		printf(", grace period %gs\n", timeoutGraceMs / 1e3);
+	}
+	else if (strcmp(arguments[1], "-a") == 0)
+	{
+		if (arguments[2] != NULL && arguments[3] == NULL && strcmp(arguments[2], "off") == 0)
+		{
+			defaultTimeoutMs = 0;
+		}
+		else if (arguments[2] != NULL && arguments[3] == NULL && parseDuration(arguments[2], &ms))
+		{
+			defaultTimeoutMs = ms;
+		}
+		else
+		{
+			printf("usage: timeout DURATION command, timeout -a DURATION|off, timeout -k DURATION\n");
+			fflush(stdout);
+			return 1;
+		}
+	}
+	else if (strcmp(arguments[1], "-k") == 0 && arguments[2] != NULL && arguments[3] == NULL
+		&& parseDuration(arguments[2], &ms))
+	{
+		timeoutGraceMs = (ms > 0) ? ms : 1;
+	}
+	else
+	{
+		return BUILTIN_FALLBACK;
+	}
+	fflush(stdout);
+	return 0;
+}
+
+
+/**************************************************
+Function: cdBuiltin, statusBuiltin, timeBuiltin,
+timeoutBuiltin, limitBuiltin, metricsBuiltin, hashBuiltin, parallelBuiltin,
+exitBuiltin
+
+Registry handlers for the shell's own builtins: each passes
+what its ...Process function needs from the command and the
+shell state.
+***************************************************/
+
+static int cdBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	(void)shell;
+	cdProcess(currentCmdStruct->arguments[1]);
+	return 0;
+}
+
+static int statusBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	(void)currentCmdStruct;
+	statusProcess(shell->childStatus, shell->lastForegroundPid);
+	return 0;
+}
+
+static int timeBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	(void)shell;
+	timeProcess(currentCmdStruct->arguments);
+	return 0;
+}
+
+static int timeoutBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	int result = timeoutProcess(currentCmdStruct->arguments);
+	if (result != BUILTIN_FALLBACK)
+	{
+		*shell->childStatus = W_EXITCODE(result, 0);
+	}
+	return result;
+}
+
+static int limitBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	(void)shell;
+	limitProcess(currentCmdStruct->arguments);
+	return 0;
+}
+
+static int metricsBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	(void)currentCmdStruct;
+	metricsProcess(shell->jobs);
+	return 0;
+}
+
+static int hashBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	(void)shell;
+	hashProcess(currentCmdStruct->arguments);
+	return 0;
+}
+
+static int parallelBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	parallelProcess(currentCmdStruct, shell->childStatus, shell->jobs, shell->SIGTSTP_action);
+	return 0;
+}
+
+static int exitBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	(void)currentCmdStruct;
+	exitProcess();
+	shell->exitRequested = true;
+	return 0;
+}
+
+/**************************************************
+Function: jobsBuiltin, fgBuiltin, bgBuiltin, waitBuiltin
+
+Job control builtins. Each takes a job as findJob reads it
+(%n, %%, or a pid), the current job when none is given.
+
+jobs lists every job, after reporting those that have
+ended. fg continues a job with the terminal handed to its
+process group and waits for it like a foreground command:
+its status becomes the shell's, and if it is stopped again
+it goes back to the job table. bg continues a stopped job
+in the background.
+
+wait blocks in wait4 (reapNext), so it costs nothing while
+the jobs run: with no arguments until every running job has
+ended, with -n until the next one does, and otherwise until
+each job named has ended or stopped. Its status is that of
+the last job waited for, 127 if there was none; a job that
+was reaped before it was waited for is found by its pid in
+the finished ring.
+***************************************************/
+
+static int jobsBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	struct jobTable* jobs = shell->jobs;
+	(void)currentCmdStruct;
+
+	processCheck(jobs);
+	int current = currentJob(jobs);
+	for (int slot = 0; slot < jobs->jobCapacity && jobs->jobCount > 0; slot++)
+	{
+		if (jobs->jobs[slot].pid != 0)
+		{
+			printJob(jobs, slot, current);
+		}
+	}
+	return 0;
+}
+
+static int fgBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	struct jobTable* jobs = shell->jobs;
+	char* spec = currentCmdStruct->arguments[1];
+	int slot = findJob(jobs, spec);
+
+	if (slot == -1)
+	{
+		if (spec == NULL)
+		{
+			printf("fg: no current job\n");
+		}
+		else
+		{
+			printf("fg: %s: no such job\n", spec);
+		}
+		fflush(stdout);
+		*shell->childStatus = W_EXITCODE(1, 0);
+		return 1;
+	}
+
+	struct jobEntry* job = &jobs->jobs[slot];
+	pid_t jobPid = job->pid;
+
+	printf("%s\n", job->commandText);
+	fflush(stdout);
+	if (jobControl && job->pgid > 0)
+	{
+		if (job->hasModes)
+		{
+			tcsetattr(terminalFd, TCSADRAIN, &job->terminalModes);
+		}
+		tcsetpgrp(terminalFd, job->pgid);
+	}
+	if (job->stopSignal != 0)
+	{
+		jobs->stoppedCount--;
+		job->stopSignal = 0;
+	}
+	job->foreground = true;
+	job->sequence = ++jobs->sequence;
+	signalJob(jobs, slot, SIGCONT);
+
+	lastLimitHit = NULL;
+	lastTimedOut = false;
+	while (job->pid == jobPid && job->stopSignal == 0 && reapNext(jobs))
+	{
+	}
+
+	if (job->pid == jobPid)
+	{
+		// stopped again: back to the job table
+		returnTerminal(job);
+		job->foreground = false;
+		*shell->childStatus = W_EXITCODE(128 + job->stopSignal, 0);
+	}
+	else
+	{
+		returnTerminal(NULL);
+		*shell->childStatus = job->lastStatus;
+		if (lastTimedOut)
+		{
+			printf("timed out\n");
+			fflush(stdout);
+		}
+		if (lastLimitHit != NULL)
+		{
+			printf("killed by %s limit\n", lastLimitHit);
+			fflush(stdout);
+		}
+	}
+	*shell->lastForegroundPid = jobPid;
+	return 0;
+}
+
+static int bgBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	struct jobTable* jobs = shell->jobs;
+	char* spec = currentCmdStruct->arguments[1];
+	int slot = findJob(jobs, spec);
+
+	if (slot == -1)
+	{
+		if (spec == NULL)
+		{
+			printf("bg: no current job\n");
+		}
+		else
+		{
+			printf("bg: %s: no such job\n", spec);
+		}
+		fflush(stdout);
+		*shell->childStatus = W_EXITCODE(1, 0);
+		return 1;
+	}
+
+	struct jobEntry* job = &jobs->jobs[slot];
+	if (job->stopSignal != 0)
+	{
+		jobs->stoppedCount--;
+		job->stopSignal = 0;
+		job->sequence = ++jobs->sequence;
+		signalJob(jobs, slot, SIGCONT);
+	}
+	printJob(jobs, slot, currentJob(jobs));
+	*shell->childStatus = W_EXITCODE(0, 0);
+	return 0;
+}
+
+static int waitBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	struct jobTable* jobs = shell->jobs;
+	char** arguments = currentCmdStruct->arguments;
+	int status = W_EXITCODE(0, 0);
+
+	if (arguments[1] == NULL)
+	{
+		while (jobs->jobCount > jobs->stoppedCount && reapNext(jobs))
+		{
+		}
+	}
+	else if (strcmp(arguments[1], "-n") == 0)
+	{
+		unsigned int finishedBefore = jobs->finishedCount;
+		while (jobs->finishedCount == finishedBefore && jobs->jobCount > jobs->stoppedCount && reapNext(jobs))
+		{
+		}
+		status = (jobs->finishedCount != finishedBefore)
+			? jobs->finished[(jobs->finishedCount - 1) % FINISHED_JOBS].status
+			: W_EXITCODE(127, 0);
+	}
+	else
+	{
+		for (int i = 1; arguments[i] != NULL; i++)
+		{
+			int slot = findJob(jobs, arguments[i]);
+			if (slot == -1)
+			{
+				// ended already: look for its status
+				pid_t processId = (pid_t)atoi(arguments[i]);
+				unsigned int oldest = (jobs->finishedCount > FINISHED_JOBS) ? jobs->finishedCount - FINISHED_JOBS : 0;
+				unsigned int entry = jobs->finishedCount;
+				while (entry > oldest && jobs->finished[(entry - 1) % FINISHED_JOBS].pid != processId)
+				{
+					entry--;
+				}
+				if (processId > 0 && entry > oldest)
+				{
+					status = jobs->finished[(entry - 1) % FINISHED_JOBS].status;
+					continue;
+				}
+				printf("wait: %s: no such job\n", arguments[i]);
+				fflush(stdout);
+				status = W_EXITCODE(127, 0);
+				continue;
+			}
+
+			struct jobEntry* job = &jobs->jobs[slot];
+			pid_t jobPid = job->pid;
+			while (job->pid == jobPid && job->stopSignal == 0 && reapNext(jobs))
+			{
+			}
+			status = (job->pid == jobPid) ? W_EXITCODE(128 + job->stopSignal, 0) : job->lastStatus;
+		}
+	}
+
+	*shell->childStatus = status;
+	return 0;
+}
+
+/**************************************************
+Function: parseSignal
+
+Function takes a signal as kill takes it, a number or a
+name with or without the SIG prefix (TERM, SIGTERM), and
+returns its number, or -1 if it is not a signal.
+***************************************************/
+
+static int parseSignal(const char* name)
+{
+	char* end;
+	long number = strtol(name, &end, 10);
+
+	if (end != name && *end == '\0')
+	{
+		return (number >= 0 && number < NSIG) ? (int)number : -1;
+	}
+	if (strncmp(name, "SIG", 3) == 0)
+	{
+		name += 3;
+	}
+	for (int signo = 1; signo < NSIG; signo++)
+	{
+		const char* abbrev = sigabbrev_np(signo);
+		if (abbrev != NULL && strcmp(abbrev, name) == 0)
+		{
+			return signo;
+		}
+	}
+	return -1;
+}
+
+/**************************************************
+Function: killBuiltin
+
+Builtin kill, so jobs can be named: kill [-SIG | -s SIG]
+%n|pid ... sends the signal (SIGTERM by default) to the
+process group of each job and to each pid. A stopped job is
+continued too, so it can act on the signal. Anything else
+(kill -l, no target) runs the kill program.
+***************************************************/
+
+static int killBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	struct jobTable* jobs = shell->jobs;
+	char** arguments = currentCmdStruct->arguments;
+	int signo = SIGTERM;
+	int first = 1;
+	int status = 0;
+
+	if (arguments[1] != NULL && arguments[1][0] == '-')
+	{
+		bool named = (strcmp(arguments[1], "-s") == 0);
+		signo = parseSignal(named ? (arguments[2] != NULL ? arguments[2] : "") : arguments[1] + 1);
+		first = named ? 3 : 2;
+	}
+	if (signo == -1 || arguments[first] == NULL)
+	{
+		return BUILTIN_FALLBACK;
+	}
+
+	for (int i = first; arguments[i] != NULL; i++)
+	{
+		char* end;
+
+		if (arguments[i][0] == '%')
+		{
+			int slot = findJob(jobs, arguments[i]);
+			if (slot == -1)
+			{
+				printf("kill: %s: no such job\n", arguments[i]);
+				fflush(stdout);
+				status = 1;
+			}
+			else if (signalJob(jobs, slot, signo) == -1)
+			{
+				perror("kill");
+				fflush(stdout);
+				status = 1;
+			}
+			else if (jobs->jobs[slot].stopSignal != 0 && signo != SIGCONT && signo != SIGKILL && signo != 0)
+			{
+				signalJob(jobs, slot, SIGCONT);
+			}
+			continue;
+		}
+
+		long processId = strtol(arguments[i], &end, 10);
+		if (end == arguments[i] || *end != '\0')
+		{
+			printf("kill: %s: arguments must be process or job IDs\n", arguments[i]);
+			fflush(stdout);
+			status = 1;
+		}
+		else if (kill((pid_t)processId, signo) == -1)
+		{
+			perror("kill");
+			fflush(stdout);
+			status = 1;
+		}
+	}
+	return status;
+}
+
+/**************************************************
+Function: writeEscape
+
+Function takes a pointer to a backslash in an echo -e or
+printf string, writes the character the escape stands for
+to out and returns a pointer to the last character of the
+escape. Octal escapes are \0NNN for echo (octalZero) and
+\NNN for printf. \c sets *stop: no more output at all.
+***************************************************/
+
+static const char* writeEscape(const char* escape, FILE* out, bool octalZero, bool* stop)
+{
+	const char* next = escape + 1;
+	int value = 0;
+	int digits = 0;
+
+	switch (*next)
+	{
+	case 'a': putc('\a', out); return next;
+	case 'b': putc('\b', out); return next;
+	case 'e': putc('\033', out); return next;
+	case 'f': putc('\f', out); return next;
+	case 'n': putc('\n', out); return next;
+	case 'r': putc('\r', out); return next;
+	case 't': putc('\t', out); return next;
+	case 'v': putc('\v', out); return next;
+	case '\\': putc('\\', out); return next;
+	case 'c': *stop = true; return next;
+	case 'x':
+		while (digits < 2 && isxdigit((unsigned char)next[1]))
+		{
+			next++;
+			value = value * 16 + (isdigit((unsigned char)*next) ? *next - '0' : (tolower((unsigned char)*next) - 'a' + 10));
+			digits++;
+		}
+		if (digits == 0)
+		{
+			putc('\\', out);
+			putc('x', out);
+			return next;
+		}
+		putc(value, out);
+		return next;
+	case '\0':
+		putc('\\', out);
+		return escape;
+	default:
+		break;
+	}
+
+	if (*next >= '0' && *next <= '7')
+	{
+		// echo: \0 then up to 3 digits; printf: up to 3 digits
+		if (octalZero && *next == '0')
+		{
+			next++;
+		}
+		else if (octalZero)
+		{
+			putc('\\', out);
+			putc(*next, out);
+			return next;
+		}
+		next--;
+		while (digits < 3 && next[1] >= '0' && next[1] <= '7')
+		{
+			next++;
+			value = value * 8 + (*next - '0');
+			digits++;
+		}
+		putc(value & 0xff, out);
+		return (digits == 0) ? escape + 1 : next;
+	}
+
+	// not an escape: both characters are printed
+	putc('\\', out);
+	putc(*next, out);
+	return next;
+}
+
+/**************************************************
+Function: echoBuiltin
+
+Builtin echo, like the coreutils one: -n leaves off the
+newline, -e interprets backslash escapes, -E (the default)
+does not. Options may be combined (-ne).
+***************************************************/
+
+static int echoBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	char** arguments = currentCmdStruct->arguments;
+	bool newline = true;
+	bool escapes = false;
+	bool stop = false;
+	int i = 1;
+	(void)shell;
+
+	for (; arguments[i] != NULL && arguments[i][0] == '-' && arguments[i][1] != '\0'
+		&& strspn(arguments[i] + 1, "neE") == strlen(arguments[i] + 1); i++)
+	{
+		for (char* option = arguments[i] + 1; *option != '\0'; option++)
+		{
+			if (*option == 'n')
+			{
+				newline = false;
+			}
+			else
+			{
+				escapes = (*option == 'e');
+			}
+		}
+	}
+
+	for (int first = i; arguments[i] != NULL && !stop; i++)
+	{
+		if (i > first)
+		{
+			putchar(' ');
+		}
+		if (!escapes)
+		{
+			fputs(arguments[i], stdout);
+			continue;
+		}
+		for (const char* next = arguments[i]; *next != '\0' && !stop; next++)
+		{
+			if (*next == '\\')
+			{
+				next = writeEscape(next, stdout, true, &stop);
+			}
+			else
+			{
+				putchar(*next);
+			}
+		}
+	}
+
+	if (newline && !stop)
+	{
+		putchar('\n');
+	}
+	return 0;
+}
+
+/**************************************************
+Function: trueBuiltin, falseBuiltin
+
+Builtin true and false.
+***************************************************/
+
+static int trueBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	(void)currentCmdStruct;
+	(void)shell;
+	return 0;
+}
+
+static int falseBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	(void)currentCmdStruct;
+	(void)shell;
+	return 1;
+}
+
+/**************************************************
+Function: testInteger
+
+Function takes an operand of a test integer comparison and
+stores its value. Returns false, after saying so, if it is
+not an integer.
+***************************************************/
+
+static bool testInteger(const char* operand, long long* value)
+{
+	char* end;
+
+	errno = 0;
+	*value = strtoll(operand, &end, 10);
+	while (isspace((unsigned char)*end))
+	{
+		end++;
+	}
+	if (end == operand || *end != '\0' || errno != 0)
+	{
+		fprintf(stderr, "test: %s: integer expression expected\n", operand);
+		return false;
+	}
+	return true;
+}
+
+/**************************************************
+Function: testUnary
+
+Function takes a test unary operator and its operand and
+returns 0 (true) or 1 (false), or 2 if the operator is
+not one.
+***************************************************/
+
+static int testUnary(const char* op, const char* operand)
+{
+	struct stat fileStat;
+
+	if (op[0] != '-' || op[1] == '\0' || op[2] != '\0')
+	{
+		return 2;
+	}
+
+	switch (op[1])
+	{
+	case 'z': return operand[0] == '\0' ? 0 : 1;
+	case 'n': return operand[0] != '\0' ? 0 : 1;
+	case 'r': return access(operand, R_OK) == 0 ? 0 : 1;
+	case 'w': return access(operand, W_OK) == 0 ? 0 : 1;
+	case 'x': return access(operand, X_OK) == 0 ? 0 : 1;
+	case 't': return isatty(atoi(operand)) ? 0 : 1;
+	case 'h':
+	case 'L': return (lstat(operand, &fileStat) == 0 && S_ISLNK(fileStat.st_mode)) ? 0 : 1;
+	case 'e': case 'f': case 'd': case 'b': case 'c': case 'p':
+	case 'S': case 's': case 'g': case 'u': case 'k':
+		break;
+	default:
+		return 2;
+	}
+
+	if (stat(operand, &fileStat) == -1)
+	{
+		return 1;
+	}
+	switch (op[1])
+	{
+	case 'f': return S_ISREG(fileStat.st_mode) ? 0 : 1;
+	case 'd': return S_ISDIR(fileStat.st_mode) ? 0 : 1;
+	case 'b': return S_ISBLK(fileStat.st_mode) ? 0 : 1;
+	case 'c': return S_ISCHR(fileStat.st_mode) ? 0 : 1;
+	case 'p': return S_ISFIFO(fileStat.st_mode) ? 0 : 1;
+	case 'S': return S_ISSOCK(fileStat.st_mode) ? 0 : 1;
+	case 's': return fileStat.st_size > 0 ? 0 : 1;
+	case 'g': return (fileStat.st_mode & S_ISGID) ? 0 : 1;
+	case 'u': return (fileStat.st_mode & S_ISUID) ? 0 : 1;
+	case 'k': return (fileStat.st_mode & S_ISVTX) ? 0 : 1;
+	default: return 0;
+	}
+}
+
+/**************************************************
+Function: testBinary
+
+Function takes the operands and operator of a test binary
+expression and returns 0 (true) or 1 (false), 2 on an
+error, or 3 if the operator is not one.
+***************************************************/
+
+static int testBinary(const char* left, const char* op, const char* right)
+{
+	long long leftValue;
+	long long rightValue;
+	struct stat leftStat;
+	struct stat rightStat;
+
+	if (strcmp(op, "=") == 0 || strcmp(op, "==") == 0)
+	{
+		return strcmp(left, right) == 0 ? 0 : 1;
+	}
+	if (strcmp(op, "!=") == 0)
+	{
+		return strcmp(left, right) != 0 ? 0 : 1;
+	}
+	if (strcmp(op, "<") == 0 || strcmp(op, ">") == 0)
+	{
+		int order = strcoll(left, right);
+		return ((op[0] == '<') ? order < 0 : order > 0) ? 0 : 1;
+	}
+	if (strcmp(op, "-a") == 0)
+	{
+		return (left[0] != '\0' && right[0] != '\0') ? 0 : 1;
+	}
+	if (strcmp(op, "-o") == 0)
+	{
+		return (left[0] != '\0' || right[0] != '\0') ? 0 : 1;
+	}
+	if (strcmp(op, "-nt") == 0 || strcmp(op, "-ot") == 0 || strcmp(op, "-ef") == 0)
+	{
+		bool leftExists = (stat(left, &leftStat) == 0);
+		bool rightExists = (stat(right, &rightStat) == 0);
+		if (op[1] == 'e')
+		{
+			return (leftExists && rightExists && leftStat.st_dev == rightStat.st_dev
+				&& leftStat.st_ino == rightStat.st_ino) ? 0 : 1;
+		}
+		if (!leftExists || !rightExists)
+		{
+			// a missing file is older than any that exists
+			return ((op[1] == 'n') ? leftExists : rightExists) ? 0 : 1;
+		}
+		long long leftTime = leftStat.st_mtim.tv_sec * 1000000000LL + leftStat.st_mtim.tv_nsec;
+		long long rightTime = rightStat.st_mtim.tv_sec * 1000000000LL + rightStat.st_mtim.tv_nsec;
+		return ((op[1] == 'n') ? leftTime > rightTime : leftTime < rightTime) ? 0 : 1;
+	}
+
+	static const char* integerOps[] = { "-eq", "-ne", "-lt", "-le", "-gt", "-ge" };
+	for (int i = 0; i < 6; i++)
+	{
+		if (strcmp(op, integerOps[i]) != 0)
+		{
+			continue;
+		}
+		if (!testInteger(left, &leftValue) || !testInteger(right, &rightValue))
+		{
+			return 2;
+		}
+		bool result[] = { leftValue == rightValue, leftValue != rightValue, leftValue < rightValue,
+			leftValue <= rightValue, leftValue > rightValue, leftValue >= rightValue };
+		return result[i] ? 0 : 1;
+	}
+	return 3;
+}
+
+/**************************************************
+Function: testExpression
+
+Function evaluates a test expression of up to 4 operands
+by the POSIX rules for that many operands, and returns 0
+(true), 1 (false) or 2 (error). Longer expressions return
+BUILTIN_FALLBACK, so the test program handles them.
+***************************************************/
+
+static int testExpression(char** operands, int count)
+{
+	int result;
+
+	switch (count)
+	{
+	case 0:
+		return 1;
+	case 1:
+		return operands[0][0] != '\0' ? 0 : 1;
+	case 2:
+		if (strcmp(operands[0], "!") == 0)
+		{
+			return operands[1][0] == '\0' ? 0 : 1;
+		}
+		result = testUnary(operands[0], operands[1]);
+		if (result == 2)
+		{
+			fprintf(stderr, "test: %s: unary operator expected\n", operands[0]);
+		}
+		return result;
+	case 3:
+		result = testBinary(operands[0], operands[1], operands[2]);
+		if (result != 3)
+		{
+			return result;
+		}
+		if (strcmp(operands[0], "!") == 0)
+		{
+			result = testExpression(operands + 1, 2);
+			return (result == 2) ? 2 : !result;
+		}
+		if (strcmp(operands[0], "(") == 0 && strcmp(operands[2], ")") == 0)
+		{
+			return testExpression(operands + 1, 1);
+		}
+		fprintf(stderr, "test: %s: binary operator expected\n", operands[1]);
+		return 2;
+	case 4:
+		if (strcmp(operands[0], "!") == 0)
+		{
+			result = testExpression(operands + 1, 3);
+			return (result == 2 || result == BUILTIN_FALLBACK) ? result : !result;
+		}
+		if (strcmp(operands[0], "(") == 0 && strcmp(operands[3], ")") == 0)
+		{
+			return testExpression(operands + 1, 2);
+		}
+		return BUILTIN_FALLBACK;
+	default:
+		return BUILTIN_FALLBACK;
+	}
+}
+
+/**************************************************
+Function: testBuiltin
+
+Builtin test and [. Expressions of up to 4 operands are
+evaluated here (file tests, string and integer comparisons,
+!, -a / -o between two strings, parentheses around one
+expression); anything longer runs the test program.
+***************************************************/
+
+static int testBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	char** arguments = currentCmdStruct->arguments;
+	int count = 0;
+	(void)shell;
+
+	while (arguments[count + 1] != NULL)
+	{
+		count++;
+	}
+
+	if (strcmp(arguments[0], "[") == 0)
+	{
+		if (count == 0 || strcmp(arguments[count], "]") != 0)
+		{
+			fprintf(stderr, "[: missing ']'\n");
+			return 2;
+		}
+		count--;
+	}
+	return testExpression(arguments + 1, count);
+}
+
+/**************************************************
+Function: printfSupported
+
+Function takes a printf format and returns whether every
+conversion in it is one printfBuiltin handles: flags,
+width and precision as digits, and d i u o x X c s b e E f
+F g G or %%, in a spec short enough for PRINTF_SPEC_MAX.
+***************************************************/
+
+static bool printfSupported(const char* format)
+{
+	for (const char* next = format; *next != '\0'; next++)
+	{
+		if (*next == '\\' && next[1] != '\0')
+		{
+			next++;
+			continue;
+		}
+		if (*next != '%')
+		{
+			continue;
+		}
+		const char* spec = next++;
+		next += strspn(next, "-+ #0");
+		next += strspn(next, "0123456789");
+		if (*next == '.')
+		{
+			next++;
+			next += strspn(next, "0123456789");
+		}
+		if (*next == '\0' || strchr("diuoxXcsbeEfFgG%", *next) == NULL)
+		{
+			return false;
+		}
+		// the spec, "ll", the conversion and its NUL
+		if (next - spec + 4 > PRINTF_SPEC_MAX)
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**************************************************
+Function: printfNumber
+
+Function takes a printf argument for a numeric conversion
+and returns its value: a number (decimal, 0x hex or 0
+octal), or the code of the character after a leading quote.
+A bad number is reported and *status set to 1.
+***************************************************/
+
+static long long printfNumber(const char* argument, int* status)
+{
+	char* end;
+
+	if (argument[0] == '\'' || argument[0] == '"')
+	{
+		return (unsigned char)argument[1];
+	}
+	errno = 0;
+	long long value = strtoll(argument, &end, 0);
+	if (end == argument || *end != '\0' || errno != 0)
+	{
+		fprintf(stderr, "printf: %s: invalid number\n", argument);
+		*status = 1;
+	}
+	return value;
+}
+
+/**************************************************
+Function: printfBuiltin
+
+Builtin printf: the format is applied to the arguments,
+and applied again while arguments are left, as POSIX
+printf does; missing arguments count as "" or 0. Formats
+with conversions printfSupported does not know run the
+printf program instead.
+***************************************************/
+
+static int printfBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	char** arguments = currentCmdStruct->arguments;
+	char spec[PRINTF_SPEC_MAX];
+	int argIndex = 2;
+	int status = 0;
+	bool stop = false;
+	(void)shell;
+
+	if (arguments[1] == NULL)
+	{
+		fprintf(stderr, "printf: missing operand\n");
+		return 1;
+	}
+	if (!printfSupported(arguments[1]))
+	{
+		return BUILTIN_FALLBACK;
+	}
+
+	do
+	{
+		int firstArg = argIndex;
+		for (const char* next = arguments[1]; *next != '\0' && !stop; next++)
+		{
+			if (*next == '\\')
+			{
+				next = writeEscape(next, stdout, false, &stop);
+				continue;
+			}
+			if (*next != '%')
+			{
+				putchar(*next);
+				continue;
+			}
+			if (next[1] == '%')
+			{
+				putchar('%');
+				next++;
+				continue;
+			}
+
+			// copy the conversion spec, leaving room for "ll"
+			size_t specLength = 1 + strspn(next + 1, "-+ #0.0123456789");
+			memcpy(spec, next, specLength);
+			next += specLength;
+			char conversion = *next;
+			char* argument = (arguments[argIndex] != NULL) ? arguments[argIndex++] : NULL;
+
+			switch (conversion)
+			{
+			case 'd':
+			case 'i':
+				strcpy(&spec[specLength], "lld");
+				printf(spec, argument ? printfNumber(argument, &status) : 0LL);
+				break;
+			case 'u':
+			case 'o':
+			case 'x':
+			case 'X':
+				spec[specLength] = 'l';
+				spec[specLength + 1] = 'l';
+				spec[specLength + 2] = conversion;
+				spec[specLength + 3] = '\0';
+				printf(spec, argument ? (unsigned long long)printfNumber(argument, &status) : 0ULL);
+				break;
+			case 'e':
+			case 'E':
+			case 'f':
+			case 'F':
+			case 'g':
+			case 'G':
+				spec[specLength] = conversion;
+				spec[specLength + 1] = '\0';
+				printf(spec, argument ? strtod(argument, NULL) : 0.0);
+				break;
+			case 'c':
+				strcpy(&spec[specLength], "c");
+				if (argument != NULL && argument[0] != '\0')
+				{
+					printf(spec, argument[0]);
+				}
+				break;
+			case 's':
+				strcpy(&spec[specLength], "s");
+				printf(spec, argument ? argument : "");
+				break;
+			case 'b':
+				for (const char* text = argument ? argument : ""; *text != '\0' && !stop; text++)
+				{
+					if (*text == '\\')
+					{
+						text = writeEscape(text, stdout, true, &stop);
+					}
+					else
+					{
+						putchar(*text);
+					}
+				}
+				break;
+			}
+		}
+		// the format used no arguments: do not loop on it
+		if (argIndex == firstArg)
+		{
+			break;
+		}
+	} while (arguments[argIndex] != NULL && !stop);
+
+	return status;
+}
+
+/**************************************************
+Function: copyFile
+
+Function copies everything from inFd to outFd in the
+kernel where it can: copy_file_range between two regular
+files (which may share extents on filesystems that support
+it), sendfile from a regular file to anything else, and a
+read/write loop otherwise. Returns 0, or -1 with errno set.
+***************************************************/
+
+static int copyFile(int inFd, int outFd)
+{
+	struct stat inStat;
+	struct stat outStat;
+	ssize_t copied;
+
+	if (fstat(inFd, &inStat) == 0 && S_ISREG(inStat.st_mode))
+	{
+		bool regularOut = (fstat(outFd, &outStat) == 0 && S_ISREG(outStat.st_mode));
+		if (regularOut)
+		{
+			while ((copied = copy_file_range(inFd, NULL, outFd, NULL, 1 << 30, 0)) > 0)
+			{
+			}
+			if (copied == 0)
+			{
+				return 0;
+			}
+			if (errno != EXDEV && errno != EINVAL && errno != ENOSYS && errno != EOPNOTSUPP && errno != EBADF)
+			{
+				return -1;
+			}
+		}
+
+		while ((copied = sendfile(outFd, inFd, NULL, 1 << 30)) > 0)
+		{
+		}
+		if (copied == 0)
+		{
+			return 0;
+		}
+		if (errno != EINVAL && errno != ENOSYS)
+		{
+			return -1;
+		}
+	}
+
+	char buffer[INPUT_CHUNK_SIZE];
+	while ((copied = read(inFd, buffer, sizeof(buffer))) != 0)
+	{
+		if (copied == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			return -1;
+		}
+		for (ssize_t written = 0; written < copied; )
+		{
+			ssize_t count = write(outFd, buffer + written, copied - written);
+			if (count == -1 && errno != EINTR)
+			{
+				return -1;
+			}
+			written += (count > 0) ? count : 0;
+		}
+	}
+	return 0;
+}
+
+/**************************************************
+Function: catBuiltin
+
+Builtin cat without options: the files (stdin for none or
+"-") are copied to stdout with copyFile. Options, and a cat
+that would read anything but regular files and here data (a
+terminal, a pipe or a device such as /dev/zero, any of which
+may never end, and the shell could not interrupt it since it
+ignores SIGINT), run the cat program.
+***************************************************/
+
+static int catBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	char** arguments = currentCmdStruct->arguments;
+	struct stat inStat;
+	struct stat outStat;
+	int status = 0;
+	int i;
+	(void)shell;
+
+	bool finiteStdin = currentCmdStruct->hereData != NULL
+		|| (fstat(STDIN_FILENO, &inStat) == 0 && S_ISREG(inStat.st_mode));
+	for (i = 1; arguments[i] != NULL; i++)
+	{
+		if (arguments[i][0] == '-' && arguments[i][1] != '\0')
+		{
+			return BUILTIN_FALLBACK;
+		}
+		// a missing file is reported below; only what exists must be regular
+		bool fromStdin = (strcmp(arguments[i], "-") == 0);
+		if (fromStdin ? !finiteStdin : stat(arguments[i], &inStat) == 0 && !S_ISREG(inStat.st_mode))
+		{
+			return BUILTIN_FALLBACK;
+		}
+	}
+	if (arguments[1] == NULL && !finiteStdin)
+	{
+		return BUILTIN_FALLBACK;
+	}
+
+	bool regularOut = (fstat(STDOUT_FILENO, &outStat) == 0 && S_ISREG(outStat.st_mode));
+	static char* readStdin[] = { "cat", "-", NULL };
+	if (arguments[1] == NULL)
+	{
+		arguments = readStdin;
+	}
+
+	for (i = 1; arguments[i] != NULL; i++)
+	{
+		bool fromStdin = (strcmp(arguments[i], "-") == 0);
+		int inFd = fromStdin ? STDIN_FILENO : open(arguments[i], O_RDONLY | O_CLOEXEC);
+		if (inFd == -1)
+		{
+			fprintf(stderr, "cat: %s: %s\n", arguments[i], strerror(errno));
+			status = 1;
+			continue;
+		}
+
+		if (regularOut && fstat(inFd, &inStat) == 0 && inStat.st_dev == outStat.st_dev
+			&& inStat.st_ino == outStat.st_ino && inStat.st_size > 0)
+		{
+			fprintf(stderr, "cat: %s: input file is output file\n", arguments[i]);
+			status = 1;
+		}
+		else if (copyFile(inFd, STDOUT_FILENO) == -1)
+		{
+			fprintf(stderr, "cat: %s: %s\n", arguments[i], strerror(errno));
+			status = 1;
+		}
+
+		if (!fromStdin)
+		{
+			close(inFd);
+		}
+	}
+	return status;
+}
+
+/**************************************************
+Builtin registry: every command the shell runs itself.
+Shell builtins first, then the utilities that stand in for
+programs (see builtinEntry).
+***************************************************/
+
+static const struct builtinEntry builtinTable[] = {
+	{ "cd", cdBuiltin, false },
+	{ "status", statusBuiltin, false },
+	{ "time", timeBuiltin, false },
+	{ "timeout", timeoutBuiltin, false },
+	{ "limit", limitBuiltin, false },
+	{ "metrics", metricsBuiltin, false },
+	{ "hash", hashBuiltin, false },
+	{ "parallel", parallelBuiltin, false },
+	{ "exit", exitBuiltin, false },
+	{ "jobs", jobsBuiltin, false },
+	{ "fg", fgBuiltin, false },
+	{ "bg", bgBuiltin, false },
+	{ "wait", waitBuiltin, false },
+	{ "echo", echoBuiltin, true },
+	{ "true", trueBuiltin, true },
+	{ "false", falseBuiltin, true },
+	{ "test", testBuiltin, true },
+	{ "[", testBuiltin, true },
+	{ "printf", printfBuiltin, true },
+	{ "cat", catBuiltin, true },
+	{ "kill", killBuiltin, true },
+};
+
+/**************************************************
+Function: findBuiltin
+
+Function takes a command name and returns its entry in
+the builtin registry, or NULL if it is not a builtin.
+***************************************************/
+
+const struct builtinEntry* findBuiltin(const char* commandName)
+{
+	for (size_t i = 0; i < sizeof(builtinTable) / sizeof(builtinTable[0]); i++)
+	{
+		if (builtinTable[i].name[0] == commandName[0] && strcmp(builtinTable[i].name, commandName) == 0)
+		{
+			return &builtinTable[i];
+		}
+	}
+	return NULL;
+}
+
+/**************************************************
+Function: runBuiltin
+
+Function takes a populated command struct and the shell
+state and runs the command if it is a builtin. A utility
+runs here only as a single foreground command without a
+limit or timeout (the prefix or timeout -a): its redirects are opened as for a child, put
+on the shell's stdin/stdout for the call (the originals are
+saved and put back afterwards) and its result becomes the
+status. With the time prefix its usage is the shell's own
+for the call.
+
+Returns true if the command was run, false if it must be
+run as a process.
+***************************************************/
+
+bool runBuiltin(commandStruct* currentCmdStruct, struct shellState* shell)
+{
+	const struct builtinEntry* entry = findBuiltin(currentCmdStruct->command);
+	int inFd;
+	int outFd;
+	int savedIn = -1;
+	int savedOut = -1;
+	struct timespec started;
+	struct rusage before;
+	struct rusage after;
+
+	if (entry == NULL)
+	{
+		return false;
+	}
+	if (!entry->utility)
+	{
+		return entry->handler(currentCmdStruct, shell) != BUILTIN_FALLBACK;
+	}
+
+	if (foregroundOnlyMode)
+	{
+		currentCmdStruct->bkgrdInd = false;
+	}
+	if (currentCmdStruct->nextStage != NULL || currentCmdStruct->bkgrdInd || currentCmdStruct->policy != NULL
+		|| currentCmdStruct->outputCount > 1 || currentCmdStruct->timeoutMs > 0 || defaultTimeoutMs > 0)
+	{
+		return false;
+	}
+
+	if (currentCmdStruct->timed)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &started);
+		getrusage(RUSAGE_SELF, &before);
+	}
+
+	if (openRedirects(currentCmdStruct, true, true, &inFd, &outFd) == -1)
+	{
+		*shell->childStatus = W_EXITCODE(1, 0);
+		return true;
+	}
+	fflush(stdout);
+	if (inFd != -1)
+	{
+		savedIn = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 10);
+		dup2(inFd, STDIN_FILENO);
+		close(inFd);
+	}
+	if (outFd != -1)
+	{
+		savedOut = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+		dup2(outFd, STDOUT_FILENO);
+		close(outFd);
+	}
+
+	int result = entry->handler(currentCmdStruct, shell);
+	fflush(stdout);
+
+	if (savedIn != -1)
+	{
+		dup2(savedIn, STDIN_FILENO);
+		close(savedIn);
+	}
+	if (savedOut != -1)
+	{
+		dup2(savedOut, STDOUT_FILENO);
+		close(savedOut);
+	}
+
+	if (result == BUILTIN_FALLBACK)
+	{
+		return false;
+	}
+	*shell->childStatus = W_EXITCODE(result, 0);
+
+	if (currentCmdStruct->timed)
+	{
+		char usageString[USAGE_STRING_LENGTH];
+		getrusage(RUSAGE_SELF, &after);
+		timersub(&after.ru_utime, &before.ru_utime, &after.ru_utime);
+		timersub(&after.ru_stime, &before.ru_stime, &after.ru_stime);
+		after.ru_majflt -= before.ru_majflt;
+		after.ru_minflt -= before.ru_minflt;
+		formatUsage(usageString, &started, &after);
+		printf("%s\n", usageString);
+		fflush(stdout);
+	}
+	return true;
+}
+
+/**************************************************
+Function: findBinding
+
+Function takes a variable name (not NUL-terminated) and its
+length and returns the innermost running for loop binding
+of that name, or NULL.
+***************************************************/
+
+static struct loopBinding* findBinding(const char* name, size_t nameLength)
+{
+	for (struct loopBinding* binding = loopBindings; binding != NULL; binding = binding->outer)
+	{
+		if (strncmp(binding->name, name, nameLength) == 0 && binding->name[nameLength] == '\0')
+		{
+			return binding;
+		}
+	}
+	return NULL;
+}
+
+/**************************************************
+Function: findSubstitution
+
+Function takes a string and returns its first $(...) as
+the lexer saw it, or NULL: a "$$" pair is skipped whole, so
+"$$(" is no substitution.
+***************************************************/
+
+static char* findSubstitution(char* text)
+{
+	for (char* dollar = strchr(text, '$'); dollar != NULL; dollar = strchr(dollar + 1, '$'))
+	{
+		if (dollar[1] == '(')
+		{
+			return dollar;
+		}
+		if (dollar[1] == '$')
+		{
+			dollar++;
+		}
+	}
+	return NULL;
+}
+
+/**************************************************
+Function: expandText
+
+Function takes a string and, when it holds $(...), the
+substitutions run for it by runSubstitutions and the index
+of its first one, and returns the string with every $name
+and ${name} replaced by the variable's value (a running for
+loop's variable first, then the variable table: $HOME, $?,
+$! ...) and each $(...) by its output, advancing *next past
+them. $?, $! and $$ are the one-character names; a name
+that is not set expands to nothing. Without substitutions a
+$(...) is kept as it is, variables inside it included.
+
+It is one pass over the string as it was written, so
+neither a value nor an output is ever scanned again: a
+variable holding "$(cmd)" does not run cmd. The string
+itself is returned when it has no '$'. Otherwise the result
+goes into a buffer from the line arena, sized up front from
+the number of '$', the longest value and the outputs, so no
+value is measured or copied twice.
+***************************************************/
+
+static char* expandText(char* text, struct substitution* subs, int* subIndex)
+{
+	char* next = (text != NULL) ? strchr(text, '$') : NULL;
+	size_t references = 0;
+	size_t outputLength = 0;
+
+	if (next == NULL)
+	{
+		return text;
+	}
+	for (char* dollar = next; dollar != NULL; dollar = strchr(dollar + 1, '$'))
+	{
+		references++;
+	}
+	if (subs != NULL)
+	{
+		int sub = *subIndex;
+		char* open = findSubstitution(next);
+		char* close;
+		while (open != NULL && (close = findClosingParen(open + 1)) != NULL)
+		{
+			outputLength += subs[sub++].length;
+			open = findSubstitution(close + 1);
+		}
+	}
+
+	size_t prefixLength = next - text;
+	char* result = arenaAlloc(&lineArena, prefixLength + strlen(next) + references * variables.longestValue
+		+ outputLength + 1);
+	char* out = result + prefixLength;
+	memcpy(result, text, prefixLength);
+
+	while (*next != '\0')
+	{
+		char* nameStart = next + 1;
+		size_t nameLength = 0;
+		bool braced = false;
+
+		if (next[0] == '$' && next[1] == '(')
+		{
+			char* close = findClosingParen(next + 1);
+			char* after = (close != NULL) ? close + 1 : next + strlen(next);
+			if (subs != NULL && close != NULL)
+			{
+				struct substitution* sub = &subs[(*subIndex)++];
+				memcpy(out, sub->output, sub->length);
+				out += sub->length;
+			}
+			else
+			{
+				memcpy(out, next, after - next);
+				out += after - next;
+			}
+			next = after;
+			continue;
+		}
+
+		if (*next == '$')
+		{
+			braced = (*nameStart == '{');
+			nameStart += braced;
+			if (*nameStart == '?' || *nameStart == '!' || *nameStart == '$')
+			{
+				nameLength = 1;
+			}
+			else if (isalpha((unsigned char)*nameStart) || *nameStart == '_')
+			{
+				while (isalnum((unsigned char)nameStart[nameLength]) || nameStart[nameLength] == '_')
+				{
+					nameLength++;
+				}
+			}
+			if (braced && nameStart[nameLength] != '}')
+			{
+				nameLength = 0;
+			}
+		}
+
+		if (nameLength > 0)
+		{
+			struct loopBinding* binding = findBinding(nameStart, nameLength);
+			struct shellVariable* variable = (binding == NULL) ? findVariable(nameStart, nameLength) : NULL;
+			if (binding != NULL)
+			{
+				memcpy(out, binding->value, binding->valueLength);
+				out += binding->valueLength;
+			}
+			else if (variable != NULL)
+			{
+				memcpy(out, variable->value, variable->valueLength);
+				out += variable->valueLength;
+			}
+			next = nameStart + nameLength + braced;
+		}
+		else
+		{
+			*out++ = *next++;
+		}
+	}
+
+	*out = '\0';
+	return result;
+}
+
+/**************************************************
+Function: substituteVariables
+
+Function takes a string with no substitutions run for it
+and returns it with its variables expanded (see
+expandText).
+***************************************************/
+
+static char* substituteVariables(char* text)
+{
+	return expandText(text, NULL, NULL);
+}
+
+/**************************************************
+Function: bindVariables
+
+Function takes a pipeline and returns a copy of it with
+variables substituted (see substituteVariables) into the
+stages that refer to one (hasVariables); other stages are
+copied as they are. An argument that expands to nothing is
+dropped, as expandWords does. The copy lives in the line
+arena, in a loop body until the iteration is over.
+
+Returns NULL, so nothing runs, when a stage is left with no
+words at all.
+***************************************************/
+
+static commandStruct* bindVariables(commandStruct* pipeline)
+{
+	commandStruct* firstStage = NULL;
+	commandStruct** link = &firstStage;
+
+	for (commandStruct* stage = pipeline; stage != NULL; stage = stage->nextStage)
+	{
+		commandStruct* bound = arenaAlloc(&lineArena, sizeof(commandStruct));
+		*bound = *stage;
+
+		if (stage->hasVariables)
+		{
+			bound->arguments = arenaAlloc(&lineArena, (stage->argCount + 1) * sizeof(char*));
+			bound->argCount = 0;
+			for (int i = 0; i < stage->argCount; i++)
+			{
+				char* argument = substituteVariables(stage->arguments[i]);
+				if (argument[0] != '\0')
+				{
+					bound->arguments[bound->argCount++] = argument;
+				}
+			}
+			bound->arguments[bound->argCount] = NULL;
+			bound->command = bound->arguments[0];
+			if (bound->argCount == 0)
+			{
+				return NULL;
+			}
+			if (stage->inputRedir != NULL)
+			{
+				bound->inputRedir = substituteVariables(stage->inputRedir);
+			}
+			if (stage->outputCount > 0)
+			{
+				bound->outputTargets = arenaAlloc(&lineArena, stage->outputCount * sizeof(struct outputTarget));
+				for (int i = 0; i < stage->outputCount; i++)
+				{
+					bound->outputTargets[i].path = substituteVariables(stage->outputTargets[i].path);
+					bound->outputTargets[i].append = stage->outputTargets[i].append;
+				}
+				bound->outputRedir = bound->outputTargets[0].path;
+			}
+			if (stage->hereData != NULL && stage->hereExpand)
+			{
+				bound->hereData = substituteVariables(stage->hereData);
+				bound->hereLength = strlen(bound->hereData);
+			}
+		}
+
+		*link = bound;
+		link = &bound->nextStage;
+	}
+	return firstStage;
+}
+
+/**************************************************
+Function: startSubstitution
+
+Function takes a $(...) whose command is set, the ones
+started before it and the shell state, and starts the
+command with its output going to sub->readFd, without
+waiting for it to finish. The cheapest way that leaves the
+shell as it was is taken: a utility builtin runs in the
+shell itself, into a memfd; a single external command is
+spawned like any other, with the pipe as its output; and
+anything else (pipelines, lists, loops, nested $(...), and
+builtins such as cd or exit, which must not change the
+shell) runs in a forked copy of the shell.
+***************************************************/
+
+static void startSubstitution(struct substitution* sub, struct substitution* started, int startedCount,
+	struct shellState* shell)
+{
+	commandStruct* commandList = processInput(sub->command);
+	int pipeFds[2];
+
+	sub->readFd = -1;
+	sub->pid = -1;
+	if (commandList == NULL)
+	{
+		return;
+	}
+
+	bool single = commandList->nextCommand == NULL && commandList->nextStage == NULL
+		&& commandList->loop == NULL && !commandList->hasSubstitutions;
+	if (single && commandList->hasVariables)
+	{
+		// run here, not through runCommandList
+		if ((commandList = bindVariables(commandList)) == NULL)
+		{
+			return;
+		}
+	}
+	const struct builtinEntry* entry = findBuiltin(commandList->command);
+
+	if (single && entry != NULL && entry->utility)
+	{
+		int memFd = memfd_create("smallsh-substitution", MFD_CLOEXEC);
+		if (memFd != -1)
+		{
+			fflush(stdout);
+			int savedOut = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 10);
+			dup2(memFd, STDOUT_FILENO);
+			bool ran = runBuiltin(commandList, shell);
+			fflush(stdout);
+			dup2(savedOut, STDOUT_FILENO);
+			close(savedOut);
+			if (ran)
+			{
+				lseek(memFd, 0, SEEK_SET);
+				sub->readFd = memFd;
+				return;
+			}
+			close(memFd);
+		}
+	}
+
+	if (pipe2(pipeFds, O_CLOEXEC) == -1)
+	{
+		perror("pipe()");
+		fflush(stdout);
+		return;
+	}
+
+	if (single && (entry == NULL || entry->utility) && !commandList->bkgrdInd
+		&& !commandList->timed && commandList->policy == NULL && commandList->outputCount <= 1)
+	{
+		int inFd;
+		int outFd;
+
+		if (openRedirects(commandList, true, true, &inFd, &outFd) == 0)
+		{
+			if (outFd == -1)
+			{
+				outFd = pipeFds[1];
+			}
+			sub->pid = spawnNeedsFork(commandList)
+				? forkCommand(commandList, inFd, outFd, -1, -1, shell->SIGTSTP_action)
+				: spawnCommand(commandList, inFd, outFd, -1);
+			if (sub->pid == -1)
+			{
+				perror(commandList->command);
+				fflush(stdout);
+			}
+			if (inFd != -1)
+			{
+				close(inFd);
+			}
+			if (outFd != pipeFds[1])
+			{
+				close(outFd);
+			}
+		}
+	}
+	else
+	{
+		fflush(stdout);
+		sub->pid = fork();
+		if (sub->pid == 0)
+		{
+			// the copy only keeps its own end of its own pipe; the
+			// helpers' children would not be its children
+			for (int i = 0; i < startedCount; i++)
+			{
+				if (started[i].readFd != -1)
+				{
+					close(started[i].readFd);
+				}
+			}
+			close(pipeFds[0]);
+			dup2(pipeFds[1], STDOUT_FILENO);
+			close(pipeFds[1]);
+			zygoteMode = false;
+			jobControl = false;
+			runCommandList(commandList, shell);
+			fflush(stdout);
+			_exit(lastExitStatus(shell->childStatus));
+		}
+		if (sub->pid == -1)
+		{
+			perror("fork()");
+			fflush(stdout);
+		}
+	}
+
+	close(pipeFds[1]);
+	sub->readFd = pipeFds[0];
+}
+
+/**************************************************
+Function: runSubstitutions
+
+Function takes an array of strings, their count and the
+shell state, finds every $(...) in them (nested ones are
+left to the command they are in), and runs them all at
+once: each is started before any output is read, then
+poll() reads every capture descriptor into its own buffer,
+doubling it as it fills, until all are at their end, and
+the processes are reaped. Trailing newlines are dropped from
+each output. *result is set to a malloc'd array of the
+substitutions in the order they appear, for
+expandText; the caller frees it and their outputs.
+Returns their number, or -1 after reporting a "$(" that is
+never closed.
+***************************************************/
+
+static int runSubstitutions(char** texts, int textCount, struct substitution** result, struct shellState* shell)
+{
+	struct substitution* subs = NULL;
+	int subCount = 0;
+	int subCapacity = 0;
+	int openCount = 0;
+
+	for (int t = 0; t < textCount; t++)
+	{
+		for (char* next = (texts[t] != NULL) ? findSubstitution(texts[t]) : NULL; next != NULL;
+			next = findSubstitution(next))
+		{
+			char* close = findClosingParen(next + 1);
+			if (close == NULL)
+			{
+				printf("Syntax error: $( without a matching )\n");
+				fflush(stdout);
+				free(subs);
+				return -1;
+			}
+			if (subCount == subCapacity)
+			{
+				subCapacity = (subCapacity == 0) ? 4 : subCapacity * 2;
+				subs = realloc(subs, subCapacity * sizeof(struct substitution));
+			}
+			struct substitution* sub = &subs[subCount++];
+			memset(sub, 0, sizeof(struct substitution));
+			sub->command = arenaAlloc(&lineArena, close - next - 1);
+			memcpy(sub->command, next + 2, close - next - 2);
+			sub->command[close - next - 2] = '\0';
+			next = close + 1;
+		}
+	}
+
+	for (int i = 0; i < subCount; i++)
+	{
+		startSubstitution(&subs[i], subs, i, shell);
+		openCount += (subs[i].readFd != -1);
+	}
+
+	struct pollfd* polls = malloc((subCount + 1) * sizeof(struct pollfd));
+	for (int i = 0; i < subCount; i++)
+	{
+		polls[i].fd = subs[i].readFd;
+		polls[i].events = POLLIN;
+	}
+	while (openCount > 0)
+	{
+		if (poll(polls, subCount, -1) == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			perror("poll()");
+			break;
+		}
+		for (int i = 0; i < subCount; i++)
+		{
+			struct substitution* sub = &subs[i];
+			if (polls[i].fd == -1 || polls[i].revents == 0)
+			{
+				continue;
+			}
+			if (sub->capacity - sub->length < INPUT_CHUNK_SIZE / 4)
+			{
+				sub->capacity = (sub->capacity == 0) ? INPUT_CHUNK_SIZE / 4 : sub->capacity * 2;
+				sub->output = realloc(sub->output, sub->capacity);
+			}
+			ssize_t bytesRead = read(sub->readFd, sub->output + sub->length, sub->capacity - sub->length);
+			if (bytesRead > 0)
+			{
+				sub->length += bytesRead;
+			}
+			else if (bytesRead == 0 || errno != EINTR)
+			{
+				close(sub->readFd);
+				sub->readFd = -1;
+				polls[i].fd = -1;
+				openCount--;
+			}
+		}
+	}
+	free(polls);
+
+	for (int i = 0; i < subCount; i++)
+	{
+		int status;
+		if (subs[i].readFd != -1)
+		{
+			close(subs[i].readFd);
+		}
+		while (subs[i].pid > 0 && waitpid(subs[i].pid, &status, 0) == -1 && errno == EINTR);
+		while (subs[i].length > 0 && subs[i].output[subs[i].length - 1] == '\n')
+		{
+			subs[i].length--;
+		}
+	}
+
+	*result = subs;
+	return subCount;
+}
+
+/**************************************************
+Function: splitWords
+
+Function takes a string and splits it into words at spaces,
+tabs and newlines. With words NULL it only counts them;
+otherwise each word is terminated in place and stored in
+words. Returns the number of words.
+***************************************************/
+
+static int splitWords(char* text, char** words)
+{
+	int count = 0;
+	char* next = text;
+
+	while (true)
+	{
+		while (*next == ' ' || *next == '\t' || *next == '\n')
+		{
+			next++;
+		}
+		if (*next == '\0')
+		{
+			return count;
+		}
+		if (words != NULL)
+		{
+			words[count] = next;
+		}
+		count++;
+		while (*next != '\0' && *next != ' ' && *next != '\t' && *next != '\n')
+		{
+			next++;
+		}
+		if (*next == '\0')
+		{
+			return count;
+		}
+		if (words != NULL)
+		{
+			*next = '\0';
+		}
+		next++;
+	}
+}
+
+/**************************************************
+Function: expandWords
+
+Function takes an array of words, a pointer to their count,
+the substitutions run for them and the index of the first
+one, and returns a new NULL-terminated array, in the line
+arena, where every word has its variables expanded and each
+one with a $(...) is split into words after its outputs go
+in (none, one or many), with *wordCount updated. A word that
+expands to nothing is dropped either way. The words are
+counted before the array is made.
+***************************************************/
+
+static char** expandWords(char** words, int* wordCount, struct substitution* subs, int* next)
+{
+	char** joined = arenaAlloc(&lineArena, *wordCount * sizeof(char*));
+	int count = 0;
+
+	for (int w = 0; w < *wordCount; w++)
+	{
+		joined[w] = expandText(words[w], subs, next);
+		if (findSubstitution(words[w]) == NULL)
+		{
+			count += (joined[w][0] != '\0');
+		}
+		else
+		{
+			count += splitWords(joined[w], NULL);
+		}
+	}
+	char** result = arenaAlloc(&lineArena, (count + 1) * sizeof(char*));
+	count = 0;
+	for (int w = 0; w < *wordCount; w++)
+	{
+		if (findSubstitution(words[w]) == NULL)
+		{
+			if (joined[w][0] != '\0')
+			{
+				result[count++] = joined[w];
+			}
+		}
+		else
+		{
+			count += splitWords(joined[w], &result[count]);
+		}
+	}
+	result[count] = NULL;
+	*wordCount = count;
+	return result;
+}
+
+/**************************************************
+Function: freeSubstitutions
+
+Function frees the array runSubstitutions made and the
+output buffers in it.
+***************************************************/
+
+static void freeSubstitutions(struct substitution* subs, int subCount)
+{
+	for (int i = 0; i < subCount; i++)
+	{
+		free(subs[i].output);
+	}
+	free(subs);
+}
+
+/**************************************************
+Function: substituteWords
+
+Function takes the words of a for loop, a pointer to their
+count and the shell state, and returns them with their
+variables expanded and every $(...) replaced by the words
+of its output, updating the count. The substitutions run
+together, as in a pipeline.
+***************************************************/
+
+static char** substituteWords(char** words, int* wordCount, struct shellState* shell)
+{
+	struct substitution* subs;
+	int next = 0;
+
+	int subCount = runSubstitutions(words, *wordCount, &subs, shell);
+	if (subCount == -1)
+	{
+		*wordCount = 0;
+		return words;
+	}
+	char** result = expandWords(words, wordCount, subs, &next);
+	freeSubstitutions(subs, subCount);
+	return result;
+}
+
+/**************************************************
+Function: substituteCommands
+
+Function takes a pipeline whose words hold $(...) and the
+shell state, and returns a copy of it with the output of
+each substitution in its place and its variables expanded,
+in the same pass (see expandText). The substitutions of all
+stages run together (see runSubstitutions). An argument
+with one is split into words, so a stage's argv may grow or
+shrink; redirect targets and here-strings are not split.
+Returns NULL, so nothing runs, when a $( is not closed or a
+stage is left with no words at all.
+***************************************************/
+
+static commandStruct* substituteCommands(commandStruct* pipeline, struct shellState* shell)
+{
+	commandStruct* firstStage = NULL;
+	commandStruct** link = &firstStage;
+	struct substitution* subs;
+	int textCount = 0;
+	int next = 0;
+	bool empty = false;
+
+	// every string of every stage, in the order they are joined below
+	for (commandStruct* stage = pipeline; stage != NULL; stage = stage->nextStage)
+	{
+		textCount += stage->argCount + stage->outputCount + 2;
+	}
+	char** texts = arenaAlloc(&lineArena, textCount * sizeof(char*));
+	textCount = 0;
+	for (commandStruct* stage = pipeline; stage != NULL; stage = stage->nextStage)
+	{
+		for (int i = 0; i < stage->argCount; i++)
+		{
+			texts[textCount++] = stage->arguments[i];
+		}
+		texts[textCount++] = stage->inputRedir;
+		for (int i = 0; i < stage->outputCount; i++)
+		{
+			texts[textCount++] = stage->outputTargets[i].path;
+		}
+		texts[textCount++] = stage->hereExpand ? stage->hereData : NULL;
+	}
+
+	int subCount = runSubstitutions(texts, textCount, &subs, shell);
+	if (subCount == -1)
+	{
+		*shell->childStatus = W_EXITCODE(1, 0);
+		return NULL;
+	}
+
+	for (commandStruct* stage = pipeline; stage != NULL; stage = stage->nextStage)
+	{
+		commandStruct* expanded = arenaAlloc(&lineArena, sizeof(commandStruct));
+
+		*expanded = *stage;
+		expanded->arguments = expandWords(stage->arguments, &expanded->argCount, subs, &next);
+		expanded->command = expanded->arguments[0];
+		empty |= (expanded->argCount == 0);
+
+		expanded->inputRedir = expandText(stage->inputRedir, subs, &next);
+		if (stage->outputCount > 0)
+		{
+			expanded->outputTargets = arenaAlloc(&lineArena, stage->outputCount * sizeof(struct outputTarget));
+			for (int i = 0; i < stage->outputCount; i++)
+			{
+				expanded->outputTargets[i].path = expandText(stage->outputTargets[i].path, subs, &next);
+				expanded->outputTargets[i].append = stage->outputTargets[i].append;
+			}
+			expanded->outputRedir = expanded->outputTargets[0].path;
+		}
+		if (stage->hereExpand && stage->hereData != NULL)
+		{
+			expanded->hereData = expandText(stage->hereData, subs, &next);
+			expanded->hereLength = strlen(expanded->hereData);
+		}
+
+		*link = expanded;
+		link = &expanded->nextStage;
+	}
+
+	freeSubstitutions(subs, subCount);
+	return empty ? NULL : firstStage;
+}
+
+/**************************************************
+Function: endLoop
+
+Function takes runLoop's result, the SIGINT count from when
+the loop started, the SIGINT action it replaced and the
+shell state, and puts the action back. A SIGINT caught in
+the meantime sets the status as if a command had been
+killed by it and stops the line.
+Returns false if the line should stop.
+***************************************************/
+
+static bool endLoop(bool keepGoing, sig_atomic_t interruptsBefore, struct sigaction* saved_action,
+	struct shellState* shell)
+{
+	sigaction(SIGINT, saved_action, NULL);
+	if (interruptCount == interruptsBefore)
+	{
+		return keepGoing;
+	}
+	// an enclosing loop sees the count too, and stops without a second message
+	if (keepGoing || !WIFSIGNALED(*shell->childStatus) || WTERMSIG(*shell->childStatus) != SIGINT)
+	{
+		*shell->childStatus = W_EXITCODE(0, SIGINT);
+		printf("terminated by signal %d\n", SIGINT);
+		fflush(stdout);
+	}
+	return false;
+}
+
+/**************************************************
+Function: runLoop
+
+Function takes a parsed loop and the shell state and runs
+it. A for loop binds its variable to each of its words in
+turn (the words themselves may use variables, and a $(...)
+among them gives the words of its output) and runs the
+body; a while loop runs the body for as long
+as the condition list ends with a zero exit status. The
+line arena is rewound after every iteration, so a loop over
+any number of words runs in the same memory. Returns false
+if the line should stop (see runCommandList).
+
+A loop of builtins never leaves the shell, so SIGINT is
+caught (handleSIGINT) while it runs: a Ctrl-C the shell
+gets ends it as a command killed by SIGINT would.
+***************************************************/
+
+static bool runLoop(struct loopStruct* loop, struct shellState* shell)
+{
+	bool keepGoing = true;
+	struct sigaction interrupt_action = { {0} };
+	struct sigaction saved_action;
+
+	interrupt_action.sa_handler = handleSIGINT;
+	interrupt_action.sa_flags = SA_RESTART;
+	sigaction(SIGINT, &interrupt_action, &saved_action);
+	sig_atomic_t interruptsBefore = interruptCount;
+
+	if (loop->isWhile)
+	{
+		struct arenaMark mark = arenaSave(&lineArena);
+		while (keepGoing && interruptCount == interruptsBefore)
+		{
+			keepGoing = runCommandList(loop->condition, shell);
+			if (!keepGoing || lastExitStatus(shell->childStatus) != 0 || interruptCount != interruptsBefore)
+			{
+				break;
+			}
+			keepGoing = runCommandList(loop->body, shell);
+			arenaRewind(&lineArena, mark);
+		}
+		arenaRewind(&lineArena, mark);
+		return endLoop(keepGoing, interruptsBefore, &saved_action, shell);
+	}
+
+	char** words = loop->words;
+	int wordCount = loop->wordCount;
+	updateStatusVariable(*shell->childStatus);
+	if (loop->hasSubstitutions)
+	{
+		words = substituteWords(words, &wordCount, shell);
+	}
+	else
+	{
+		words = arenaAlloc(&lineArena, (loop->wordCount + 1) * sizeof(char*));
+		wordCount = 0;
+		for (int w = 0; w < loop->wordCount; w++)
+		{
+			words[wordCount] = substituteVariables(loop->words[w]);
+			wordCount += (words[wordCount][0] != '\0');
+		}
+	}
+
+	struct loopBinding binding = { loop->variable, NULL, 0, loopBindings };
+	struct arenaMark mark = arenaSave(&lineArena);
+
+	loopBindings = &binding;
+	for (int w = 0; w < wordCount && keepGoing && interruptCount == interruptsBefore; w++)
+	{
+		binding.value = words[w];
+		binding.valueLength = strlen(words[w]);
+		if (binding.valueLength > variables.longestValue)
+		{
+			variables.longestValue = binding.valueLength;
+		}
+		keepGoing = runCommandList(loop->body, shell);
+		arenaRewind(&lineArena, mark);
+	}
+	loopBindings = binding.outer;
+	return endLoop(keepGoing, interruptsBefore, &saved_action, shell);
+}
+
+/**************************************************
+Function: runCommandList
+
+Function takes a list made by processInput and the shell
+state and runs its commands in order: loops with runLoop,
+builtins with runBuiltin (so a loop of builtins never
+forks) and anything else with executeAsChild. Stages that
+use a variable get its value first, with $? brought up to
+date; then any $(...) is replaced by its command's output.
+Returns false if the rest of the line should not run: exit
+was called, or a foreground command was killed by SIGINT,
+which also ends the loops it ran in.
+***************************************************/
+
+bool runCommandList(commandStruct* commandList, struct shellState* shell)
+{
+	for (commandStruct* command = commandList; command != NULL; command = command->nextCommand)
+	{
+		int statusBefore = *shell->childStatus;
+		int pidBefore = *shell->lastForegroundPid;
+
+		if (command->loop != NULL)
+		{
+			if (!runLoop(command->loop, shell))
+			{
+				return false;
+			}
+			continue;
+		}
+
+		// any stage of the pipeline may be the one with a variable
+		bool hasVariables = false;
+		for (commandStruct* stage = command; stage != NULL && !hasVariables; stage = stage->nextStage)
+		{
+			hasVariables = stage->hasVariables;
+		}
+
+		commandStruct* bound = command;
+		if (hasVariables || command->hasSubstitutions)
+		{
+			updateStatusVariable(*shell->childStatus);
+		}
+		if (command->hasSubstitutions)
+		{
+			// variables go in along with the outputs, never before
+			if ((bound = substituteCommands(command, shell)) == NULL)
+			{
+				continue;
+			}
+		}
+		else if (hasVariables && (bound = bindVariables(command)) == NULL)
+		{
+			continue;
+		}
+		if (!runBuiltin(bound, shell))
+		{
+			executeAsChild(bound, shell->childStatus, shell->lastForegroundPid, shell->jobs, shell->SIGTSTP_action);
+		}
+
+		// a builtin leaves the status alone; a new foreground pid is a command that ran,
+		// even if it ends as the one before it did
+		if (shell->exitRequested
+			|| ((*shell->childStatus != statusBefore || *shell->lastForegroundPid != pidBefore)
+				&& WIFSIGNALED(*shell->childStatus) && WTERMSIG(*shell->childStatus) == SIGINT))
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+/**************************************************
+Function: readParallelArgs
+
+Function takes a file descriptor and reads it to the end,
+splitting it into one argument per non-empty line for the
+parallel built-in. The lines are terminated in place inside
+one growing buffer, returned through *buffer for the caller
+to free along with the returned array. *argCount is set to
+the number of lines.
+***************************************************/
+
+char** readParallelArgs(int sourceFd, char** buffer, int* argCount)
+{
+	size_t capacity = INPUT_CHUNK_SIZE;
+	size_t used = 0;
+	ssize_t bytesRead;
+	int argCapacity = 64;
+	char** args;
+
+	*buffer = malloc(capacity + 1);
+	while ((bytesRead = read(sourceFd, *buffer + used, capacity - used)) != 0)
+	{
+		if (bytesRead == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+		used += bytesRead;
+		if (used == capacity)
+		{
+			capacity *= 2;
+			*buffer = realloc(*buffer, capacity + 1);
+		}
+	}
+	(*buffer)[used] = '\0';
+
+	args = malloc(argCapacity * sizeof(char*));
+	*argCount = 0;
+
+	char* line = *buffer;
+	while (line < *buffer + used)
+	{
+		char* lineEnd = memchr(line, '\n', (*buffer + used) - line);
+		if (lineEnd == NULL)
+		{
+			lineEnd = *buffer + used;
+		}
+		*lineEnd = '\0';
+
+		if (lineEnd > line)
+		{
+			if (*argCount == argCapacity)
+			{
+				argCapacity *= 2;
+				args = realloc(args, argCapacity * sizeof(char*));
+			}
+			args[(*argCount)++] = line;
+		}
+		line = lineEnd + 1;
+	}
+
+	return args;
+}
+
+/**************************************************
+Function: fillParallelJob
+
+Function takes the template arguments of a parallel
+command, one input argument and an empty commandStruct, and
+fills the struct's argument array (with room for
+templateCount + 2 entries) for that job. Every "{}"
+in a template argument is replaced by the input argument;
+if no template argument contains "{}" the input argument is
+appended at the end instead. Substituted strings are built
+in one malloc'd block, returned for the caller to free once
+the job has been started.
+***************************************************/
+
+char* fillParallelJob(char** template, int templateCount, char* inputArg, commandStruct* jobCommand)
+{
+	size_t inputLength = strlen(inputArg);
+	size_t blockSize = 1;
+	bool substituted = false;
+	int i;
+
+	for (i = 0; i < templateCount; i++)
+	{
+		blockSize += strlen(template[i]) + 1;
+		for (char* mark = strstr(template[i], "{}"); mark != NULL; mark = strstr(mark + 2, "{}"))
+		{
+			blockSize += inputLength;
+			substituted = true;
+		}
+	}
+
+	char* block = malloc(blockSize);
+	char* outPtr = block;
+
+	for (i = 0; i < templateCount; i++)
+	{
+		char* mark = strstr(template[i], "{}");
+		if (mark == NULL)
+		{
+			jobCommand->arguments[i] = template[i];
+			continue;
+		}
+
+		jobCommand->arguments[i] = outPtr;
+		char* ptrCur = template[i];
+		for (; mark != NULL; mark = strstr(ptrCur, "{}"))
+		{
+			memcpy(outPtr, ptrCur, mark - ptrCur);
+			outPtr += mark - ptrCur;
+			memcpy(outPtr, inputArg, inputLength);
+			outPtr += inputLength;
+			ptrCur = mark + 2;
+		}
+		strcpy(outPtr, ptrCur);
+		outPtr += strlen(ptrCur) + 1;
+	}
+
+	if (!substituted)
+	{
+		jobCommand->arguments[i++] = inputArg;
+	}
+	jobCommand->arguments[i] = NULL;
+	jobCommand->argCount = i;
+	jobCommand->command = jobCommand->arguments[0];
+
+	return block;
+}
+
+/**************************************************
+Function: statusParallel
+
+Function takes the status and pid of a finished parallel
+job, the argument it ran with and its resource usage string
+(or NULL), and prints its result in the same form
+statusBackground uses.
+***************************************************/
+
+void statusParallel(int* childStatus, int* childPid, char* inputArg, char* usageString)
+{
+	if (WIFEXITED(*childStatus)) {
+		printf("parallel pid %d (%s) is done: exit value %d", *childPid, inputArg, WEXITSTATUS(*childStatus));
+	}
+	else {
+		printf("parallel pid %d (%s) is done: terminated by signal %d", *childPid, inputArg, WTERMSIG(*childStatus));
+	}
+
+	if (usageString != NULL)
+	{
+		printf(" (%s)", usageString);
+	}
+	printf("\n");
+	fflush(stdout);
+}
+
+/**************************************************
+Function: parallelProcess
+
+Built-in command parallel. Syntax is:
+
+parallel [-j N] command [arg ...] [::: input ...] [< file] [> file]
+
+Runs command once per input, keeping exactly N jobs running
+until the inputs run out (N defaults to the number of online
+CPUs). Inputs are the words after ":::", or else the lines of
+the < file, or else the lines of stdin (only when stdin is
+not also where the shell reads its commands). "{}" in the
+command is replaced by the input; without one the input is
+appended. Jobs share the > file if one is given.
+
+The shell blocks in waitpid for the next job to finish.
+Background jobs that finish meanwhile are handed to
+reapBackground and reported as usual. Each job's result is
+printed as it finishes and the status is the number of
+failed jobs (capped at 101), so "status" reports exit
+value 0 only if every job succeeded. parallel always runs
+in the foreground. With the time prefix each job's line
+also shows its resource usage.
+***************************************************/
+
+void parallelProcess(commandStruct* currentCmdStruct, int* statusCode, struct jobTable* jobs, struct sigaction SIGTSTP_action)
+{
+	char** args = currentCmdStruct->arguments;
+	char** inputArgs = NULL;
+	char* inputBlock = NULL;
+	int inputCount = 0;
+	int maxJobs = (int)sysconf(_SC_NPROCESSORS_ONLN);
+	int first = 1;
+	int templateCount = 0;
+	int i;
+
+	// -j N or -jN
+	if (args[first] != NULL && strncmp(args[first], "-j", 2) == 0)
+	{
+		char* countString = (args[first][2] != '\0') ? &args[first][2] : args[++first];
+		if (countString == NULL || atoi(countString) < 1)
+		{
+			printf("parallel: -j needs a job count of at least 1\n");
+			fflush(stdout);
+			*statusCode = W_EXITCODE(1, 0);
+			return;
+		}
+		maxJobs = atoi(countString);
+		first++;
+	}
+	if (maxJobs < 1)
+	{
+		maxJobs = 1;
+	}
+
+	char** template = &args[first];
+	while (template[templateCount] != NULL && strcmp(template[templateCount], ":::") != 0)
+	{
+		templateCount++;
+	}
+	if (templateCount == 0)
+	{
+		printf("usage: parallel [-j N] command [arg ...] [::: input ...]\n");
+		fflush(stdout);
+		*statusCode = W_EXITCODE(1, 0);
+		return;
+	}
+
+	// inputs: words after :::, else lines of the < file or stdin
+	int jobInFd = -1;
+	if (template[templateCount] != NULL)
+	{
+		inputArgs = &template[templateCount + 1];
+		while (inputArgs[inputCount] != NULL)
+		{
+			inputCount++;
+		}
+	}
+	else
+	{
+		int sourceFd = STDIN_FILENO;
+		if (currentCmdStruct->hereData != NULL)
+		{
+			sourceFd = openHereInput(currentCmdStruct->hereData, currentCmdStruct->hereLength);
+			if (sourceFd == -1)
+			{
+				perror("here-document");
+				*statusCode = W_EXITCODE(1, 0);
+				return;
+			}
+		}
+		else if (currentCmdStruct->inputRedir != NULL)
+		{
+			sourceFd = open(currentCmdStruct->inputRedir, O_RDONLY | O_CLOEXEC);
+			if (sourceFd == -1)
+			{
+				printf("cannot open %s for input \n", currentCmdStruct->inputRedir);
+				fflush(stdout);
+				*statusCode = W_EXITCODE(1, 0);
+				return;
+			}
+		}
+		else if (inputFd == STDIN_FILENO && !interactiveMode)
+		{
+			printf("parallel: stdin holds the script; use ::: or < file for inputs\n");
+			fflush(stdout);
+			*statusCode = W_EXITCODE(1, 0);
+			return;
+		}
+
+		inputArgs = readParallelArgs(sourceFd, &inputBlock, &inputCount);
+		if (sourceFd != STDIN_FILENO)
+		{
+			close(sourceFd);
+		}
+
+		// the inputs were the jobs' stdin, so they get none
+		jobInFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	}
+
+	int jobOutFd = -1;
+	pid_t* pumpPids = malloc((currentCmdStruct->outputCount + 1) * sizeof(pid_t));
+	int pumpCount = 0;
+	if (currentCmdStruct->outputCount > 1)
+	{
+		pumpCount = startFanOut(currentCmdStruct, &jobOutFd, pumpPids);
+		if (pumpCount == -1)
+		{
+			pumpCount = 0;
+			*statusCode = W_EXITCODE(1, 0);
+			inputCount = 0;
+		}
+	}
+	else if (currentCmdStruct->outputRedir != NULL)
+	{
+		jobOutFd = openOutputTarget(&currentCmdStruct->outputTargets[0], false);
+		if (jobOutFd == -1)
+		{
+			printf("cannot open %s for output \n", currentCmdStruct->outputRedir);
+			fflush(stdout);
+			*statusCode = W_EXITCODE(1, 0);
+			inputCount = 0;
+		}
+	}
+
+	// one struct reused for every job: posix_spawn and fork are
+	// both done with argv by the time they return
+	commandStruct* jobCommand = arenaCalloc(&lineArena, sizeof(commandStruct));
+	jobCommand->arguments = arenaAlloc(&lineArena, (templateCount + 2) * sizeof(char*));
+	pid_t* runningPids = malloc(maxJobs * sizeof(pid_t));
+	int* runningArgs = malloc(maxJobs * sizeof(int));
+	struct timespec* runningStarts = malloc(maxJobs * sizeof(struct timespec));
+	int running = 0;
+	int nextInput = 0;
+	int failures = 0;
+
+	while (nextInput < inputCount || running > 0)
+	{
+		// top up to maxJobs
+		while (running < maxJobs && nextInput < inputCount)
+		{
+			char* block = fillParallelJob(template, templateCount, inputArgs[nextInput], jobCommand);
+			pid_t spawnPid;
+
+			if (spawnNeedsFork(jobCommand))
+			{
+				spawnPid = forkCommand(jobCommand, jobInFd, jobOutFd, -1, -1, SIGTSTP_action);
+			}
+			else
+			{
+				spawnPid = spawnCommand(jobCommand, jobInFd, jobOutFd, -1);
+			}
+			free(block);
+
+			if (spawnPid == -1)
+			{
+				perror(jobCommand->command);
+				fflush(stdout);
+				failures++;
+			}
+			else
+			{
+				runningPids[running] = spawnPid;
+				runningArgs[running] = nextInput;
+				clock_gettime(CLOCK_MONOTONIC, &runningStarts[running]);
+				running++;
+			}
+			nextInput++;
+		}
+
+		if (running == 0)
+		{
+			continue;
+		}
+
+		// wait for the next job (or background process) to finish
+		int childStatus;
+		struct rusage usage;
+		pid_t donePid = wait4(-1, &childStatus, 0, &usage);
+		if (donePid == -1)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			break;
+		}
+
+		for (i = 0; i < running && runningPids[i] != donePid; i++)
+		{
+		}
+		if (i == running)
+		{
+			reapBackground(jobs, donePid, childStatus, &usage);
+			continue;
+		}
+
+		if (currentCmdStruct->timed)
+		{
+			char usageString[USAGE_STRING_LENGTH];
+			formatUsage(usageString, &runningStarts[i], &usage);
+			statusParallel(&childStatus, &donePid, inputArgs[runningArgs[i]], usageString);
+		}
+		else
+		{
+			statusParallel(&childStatus, &donePid, inputArgs[runningArgs[i]], NULL);
+		}
+		if (!WIFEXITED(childStatus) || WEXITSTATUS(childStatus) != 0)
+		{
+			failures++;
+		}
+
+		// keep the running set packed
+		running--;
+		runningPids[i] = runningPids[running];
+		runningArgs[i] = runningArgs[running];
+		runningStarts[i] = runningStarts[running];
+	}
+
+	if (jobOutFd != -1 || currentCmdStruct->outputRedir == NULL)
+	{
+		*statusCode = W_EXITCODE(failures > 101 ? 101 : failures, 0);
+	}
+
+	free(runningPids);
+	free(runningArgs);
+	free(runningStarts);
+	if (inputBlock != NULL)
+	{
+		free(inputBlock);
+		free(inputArgs);
+	}
+	if (jobInFd != -1)
+	{
+		close(jobInFd);
+	}
+	if (jobOutFd != -1)
+	{
+		close(jobOutFd);
+	}
+
+	// the fan-out processes finish once the jobs' output is written
+	for (i = 0; i < pumpCount; i++)
+	{
+		if (pumpPids[i] != -1)
+		{
+			waitpid(pumpPids[i], NULL, 0);
+		}
+	}
+	free(pumpPids);
+}
+
+/**************************************************
+Function: handleSIGSTP
+
+ Signal handler function to switch modes for running 
+ after receiving SIGTSTP
+
+References:
+Course materials: Exploration: Signal handling API:
+https://canvas.oregonstate.edu/courses/1830250/pages/
+exploration-signal-handling-api?module_item_id=21468881
+
+Signals, Benjamin Brewster, YouTube: https://www.youtube.com/watch?v=VwS3dx3uyiQ
+***************************************************/
+
+
+void handleSIGTSTP(int signo) 
+{
+	char messageA[51] = "\nEntering foreground-only mode (& is now ignored)\n";
+	char messageB[31] = "\nExiting foreground-only mode\n";
+	
+	if (foregroundOnlyMode == false)
+	{
+		//switch to forcing processes to foreground only mode (custom mode)
+		foregroundOnlyMode = true;
+		write(STDOUT_FILENO, messageA, strlen(messageA));
+		fflush(stdout);
+	}
+	else
+	{
+		//switch to allowing processes to run in background (normal mode)
+		foregroundOnlyMode = false;
+		write(STDOUT_FILENO, messageB, strlen(messageB));
+		fflush(stdout);
+	}
+}
+
+/**************************************************
+Function: handleSIGINT
+
+Signal handler installed for SIGINT while a loop runs (the
+shell otherwise ignores it), so a Ctrl-C that reaches the
+shell itself, as when the loop is made of builtins, can end
+the loop: it only counts the signal for runLoop to see.
+***************************************************/
+
+void handleSIGINT(int signo)
+{
+	(void)signo;
+	interruptCount++;
+}
+
+/**************************************************
+Function: openHereInput
+
+Function takes the body of a here-string or here-document
+and returns a read descriptor (close-on-exec) positioned at
+its start, or -1 with errno set. Nothing touches the
+filesystem: a body of up to HERE_PIPE_MAX bytes is written
+into a pipe, which always has room for it, so the write
+cannot block; a larger one goes into a memfd_create() file
+that is then sealed against writes and size changes, since
+the reader gets a descriptor to the same file.
+***************************************************/
+
+int openHereInput(const char* data, size_t length)
+{
+	int pipeFds[2];
+
+	if (length <= HERE_PIPE_MAX)
+	{
+		if (pipe2(pipeFds, O_CLOEXEC) == -1)
+		{
+			return -1;
+		}
+		if (length > 0 && write(pipeFds[1], data, length) != (ssize_t)length)
+		{
+			int error = errno;
+			close(pipeFds[0]);
+			close(pipeFds[1]);
+			errno = error;
+			return -1;
+		}
+		close(pipeFds[1]);
+		return pipeFds[0];
+	}
+
+	int memFd = memfd_create("smallsh-here", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (memFd == -1)
+	{
+		return -1;
+	}
+
+	size_t written = 0;
+	while (written < length)
+	{
+		ssize_t bytesWritten = write(memFd, data + written, length - written);
+		if (bytesWritten == -1 && errno != EINTR)
+		{
+			int error = errno;
+			close(memFd);
+			errno = error;
+			return -1;
+		}
+		if (bytesWritten > 0)
+		{
+			written += bytesWritten;
+		}
+	}
+
+	fcntl(memFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+	lseek(memFd, 0, SEEK_SET);
+	return memFd;
+}
+
+/**************************************************
+Function: openOutputTarget
+
+Function takes an output target and opens it for writing,
+close-on-exec, creating it if needed: truncated for >, at
+the end for >>. splice() refuses files opened O_APPEND, so
+a spliced (fanned-out) >> target is opened without it and
+positioned at its end instead. Returns the descriptor or -1.
+***************************************************/
+
+int openOutputTarget(struct outputTarget* target, bool spliced)
+{
+	int flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+
+	if (!target->append)
+	{
+		flags |= O_TRUNC;
+	}
+	else if (!spliced)
+	{
+		flags |= O_APPEND;
+	}
+
+	int targetFd = open(target->path, flags, 0760);
+	if (targetFd != -1 && target->append && spliced)
+	{
+		lseek(targetFd, 0, SEEK_END);
+	}
+	return targetFd;
+}
+
+/**************************************************
+Function: fanOutMain
+
+Body of one fan-out process (see startFanOut). Function
+takes the pipe the output arrives on, the pipe to pass it on
+to the next target (-1 for the last target) and the
+target's file and its path. It tee()s what arrives into the
+next pipe and then splice()s exactly those bytes into the
+file, so the data never enters user space; the last target
+only splices. A file that cannot be spliced into (some
+devices) is written with read/write instead, and one that
+fails (full disk, closed pipe) is reported and dropped while
+the data keeps flowing to the others. Never returns.
+***************************************************/
+
+static void fanOutMain(int inFd, int passFd, int fileFd, const char* path)
+{
+	static char buffer[INPUT_CHUNK_SIZE];
+	enum { FILE_SPLICE, FILE_WRITE, FILE_FAILED } fileMode = FILE_SPLICE;
+	int keepFds[3] = { inFd, passFd, fileFd };
+	int nextFd = 3;
+	bool done = false;
+
+	// nothing but these three may stay open, or a pipe elsewhere
+	// in the line would never see its end
+	for (int i = 1; i < 3; i++)
+	{
+		for (int j = i; j > 0 && keepFds[j - 1] > keepFds[j]; j--)
+		{
+			int swap = keepFds[j];
+			keepFds[j] = keepFds[j - 1];
+			keepFds[j - 1] = swap;
+		}
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		if (keepFds[i] >= nextFd)
+		{
+			if (keepFds[i] > nextFd)
+			{
+				close_range(nextFd, keepFds[i] - 1, 0);
+			}
+			nextFd = keepFds[i] + 1;
+		}
+	}
+	close_range(nextFd, ~0U, 0);
+
+	signal(SIGTSTP, SIG_IGN);
+	signal(SIGPIPE, SIG_IGN);
+
+	while (!done)
+	{
+		ssize_t length = FANOUT_CHUNK;
+
+		// the next target gets its copy first
+		if (passFd != -1)
+		{
+			length = tee(inFd, passFd, FANOUT_CHUNK, 0);
+			if (length == -1 && errno == EINTR)
+			{
+				continue;
+			}
+			if (length <= 0)
+			{
+				break;
+			}
+		}
+
+		// then the same bytes leave the pipe for the file (the last
+		// target takes what there is, and stops at end of input)
+		size_t remaining = length;
+		while (remaining > 0)
+		{
+			ssize_t moved;
+			if (fileMode == FILE_SPLICE)
+			{
+				moved = splice(inFd, NULL, fileFd, NULL, remaining, SPLICE_F_MOVE);
+				if (moved == -1 && errno == EINVAL)
+				{
+					fileMode = FILE_WRITE;
+					continue;
+				}
+			}
+			else
+			{
+				moved = read(inFd, buffer, (remaining < sizeof(buffer)) ? remaining : sizeof(buffer));
+				for (ssize_t written = 0; fileMode == FILE_WRITE && written < moved; )
+				{
+					ssize_t bytesWritten = write(fileFd, buffer + written, moved - written);
+					if (bytesWritten == -1 && errno != EINTR)
+					{
+						perror(path);
+						fileMode = FILE_FAILED;
+					}
+					written += (bytesWritten > 0) ? bytesWritten : 0;
+				}
+			}
+
+			if (moved == -1 && errno == EINTR)
+			{
+				continue;
+			}
+			if (moved == -1 && fileMode == FILE_SPLICE)
+			{
+				perror(path);
+				fileMode = FILE_FAILED;
+				continue;
+			}
+			if (moved <= 0)
+			{
+				done = true;
+				break;
+			}
+			remaining -= moved;
+			if (passFd == -1)
+			{
+				break;
+			}
+		}
+	}
+
+	_exit(fileMode == FILE_FAILED ? 1 : 0);
+}
+
+/**************************************************
+Function: startFanOut
+
+Function takes a command with several output targets and
+sends its output to all of them without a tee process: the
+targets are opened first (a bad one fails the command before
+anything starts), and *outFd is set to the write end of a
+new pipe for the command's stdout. A fan-out process per
+target, forked but never exec'd (fanOutMain), tee()s the
+pipe's contents on to the next target's pipe and splices
+them into its own file.
+
+A slow target holds back the others only once they are a
+pipe's worth ahead of it (SMALLSH_TEE_SZ bytes, else the
+default 64 KB): the pipes into and out of each fan-out
+process are that size.
+
+The pids of the fan-out processes are stored in pumpPids
+(room for outputCount), for the caller to wait on with the
+command's own. Returns how many there are, or -1 if a
+target could not be opened.
+***************************************************/
+
+int startFanOut(commandStruct* currentCmdStruct, int* outFd, pid_t* pumpPids)
+{
+	int count = currentCmdStruct->outputCount;
+	int* targetFds = malloc(count * sizeof(int));
+	int pipeFds[2];
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		targetFds[i] = openOutputTarget(&currentCmdStruct->outputTargets[i], true);
+		if (targetFds[i] == -1)
+		{
+			printf("cannot open %s for output \n", currentCmdStruct->outputTargets[i].path);
+			fflush(stdout);
+			while (i-- > 0)
+			{
+				close(targetFds[i]);
+			}
+			free(targetFds);
+			return -1;
+		}
+	}
+
+	if (openPipe(pipeFds) == -1)
+	{
+		for (i = 0; i < count; i++)
+		{
+			close(targetFds[i]);
+		}
+		free(targetFds);
+		return -1;
+	}
+	*outFd = pipeFds[1];
+	if (teeBufferSize > 0)
+	{
+		fcntl(pipeFds[1], F_SETPIPE_SZ, teeBufferSize);
+	}
+
+	// each target passes the output on to the next one
+	int inFd = pipeFds[0];
+	for (i = 0; i < count; i++)
+	{
+		int passFds[2] = { -1, -1 };
+		if (i < count - 1 && pipe2(passFds, O_CLOEXEC) == -1)
+		{
+			perror("pipe()");
+		}
+		if (passFds[1] != -1 && teeBufferSize > 0)
+		{
+			fcntl(passFds[1], F_SETPIPE_SZ, teeBufferSize);
+		}
+
+		fflush(stdout);
+		pumpPids[i] = fork();
+		if (pumpPids[i] == 0)
+		{
+			fanOutMain(inFd, passFds[1], targetFds[i], currentCmdStruct->outputTargets[i].path);
+		}
+		if (pumpPids[i] == -1)
+		{
+			perror("fork()");
+		}
+
+		close(inFd);
+		close(targetFds[i]);
+		if (passFds[1] != -1)
+		{
+			close(passFds[1]);
+		}
+		inFd = passFds[0];
+	}
+
+	free(targetFds);
+	return count;
+}
+
+/**************************************************
+Function: openRedirects
+
+Function takes a pointer to a populated command struct and
+opens the files the command's stdin and stdout should be
+redirected to. Background commands without a redirect are
+pointed at /dev/null, but only on the ends of a pipeline
+(firstStage / lastStage) -- inner stages read and write pipes.
+Files are opened in the parent with O_CLOEXEC so that a bad
+redirect is reported before any process is created, and so
+the descriptors never leak into unrelated children.
+
+A here-string or here-document takes the place of the input
+file (see openHereInput), and no file is opened for it. A
+command with several output targets is left to the caller,
+which fans its output out with startFanOut.
+
+Returns 0 on success, with *inFd and *outFd set to an open
+descriptor or -1 if the stream is left alone. Returns -1 if
+a file could not be opened.
+***************************************************/
+
+int openRedirects(commandStruct* currentCmdStruct, bool firstStage, bool lastStage, int* inFd, int* outFd)
+{
+	*inFd = -1;
+	*outFd = -1;
+
+	//BRANCH: there is a here-document, which replaces any input redirect
+	if (currentCmdStruct->hereData != NULL)
+	{
+		*inFd = openHereInput(currentCmdStruct->hereData, currentCmdStruct->hereLength);
+		if (*inFd == -1)
+		{
+			perror("here-document");
+			return -1;
+		}
+	}
+	//BRANCH: there is input redirect source OR command will run in background
+	else if (currentCmdStruct->inputRedir != NULL || (currentCmdStruct->bkgrdInd && firstStage))
+	{
+		if (currentCmdStruct->inputRedir != NULL)
+		{
+			// open for READ from
+			*inFd = open(currentCmdStruct->inputRedir, O_RDONLY | O_CLOEXEC);
+		}
+		else
+			//open stream will just redirect from nowhere
+			//but stay in background
+		{
+			*inFd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+		}
+
+		if (*inFd == -1) {
+			printf("cannot open %s for input \n", currentCmdStruct->inputRedir);
+			fflush(stdout);
+			return -1;
+		}
+	}
+
+	//BRANCH: there are several output targets, fanned out by startFanOut
+	if (currentCmdStruct->outputCount > 1)
+	{
+	}
+	//BRANCH: there is output redirect target OR command will run in background
+	else if (currentCmdStruct->outputRedir != NULL || (currentCmdStruct->bkgrdInd && lastStage))
+	{
+		if (currentCmdStruct->outputRedir != NULL)
+		{
+			*outFd = openOutputTarget(&currentCmdStruct->outputTargets[0], false);
+		}
+		else
+			//open stream will just redirect to nowhere
+			//but stay in background - no messages on terminal
+		{
+			*outFd = open("/dev/null", O_WRONLY | O_CLOEXEC);
+		}
+
+		if (*outFd == -1) {
+			printf("cannot open %s for output \n", currentCmdStruct->outputRedir);
+			fflush(stdout);
+			if (*inFd != -1)
+			{
+				close(*inFd);
+				*inFd = -1;
+			}
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**************************************************
+Function: hashName
+
+Function takes a command name and returns its FNV-1a hash,
+used to place it in the command location cache.
+***************************************************/
+
+static unsigned int hashName(const char* name)
+{
+	unsigned int hash = 2166136261u;
+
+	while (*name)
+	{
+		hash = (hash ^ (unsigned char)*name++) * 16777619u;
+	}
+	return hash;
+}
+
+/**************************************************
+Function: clearCommandCache
+
+Function empties the command location cache and forgets
+the PATH it was built for. The hit and miss counters are
+kept.
+***************************************************/
+
+void clearCommandCache(void)
+{
+	for (int i = 0; i < commandCache.capacity; i++)
+	{
+		free(commandCache.entries[i].name);
+		commandCache.entries[i].name = NULL;
+	}
+	commandCache.count = 0;
+
+	free(commandCache.pathValue);
+	free(commandCache.dirTimes);
+	commandCache.pathValue = NULL;
+	commandCache.dirTimes = NULL;
+	commandCache.dirCount = 0;
+}
+
+/**************************************************
+Function: statPathDirs
+
+Function takes a PATH value and an array with room for one
+timespec per directory in it (or NULL to only count them),
+stores each directory's mtime (zero if it cannot be
+stat'ed) and returns the number of directories.
+***************************************************/
+
+static int statPathDirs(const char* pathValue, struct timespec* dirTimes)
+{
+	char dirName[PATH_MAX];
+	struct stat dirStat;
+	int dirCount = 0;
+	const char* dirStart = pathValue;
+
+	while (true)
+	{
+		const char* dirEnd = strchrnul(dirStart, ':');
+
+		if (dirTimes != NULL)
+		{
+			size_t length = dirEnd - dirStart;
+			memset(&dirTimes[dirCount], 0, sizeof(struct timespec));
+			if (length < sizeof(dirName))
+			{
+				// an empty entry means the current directory
+				memcpy(dirName, dirStart, length);
+				dirName[length] = '\0';
+				if (stat(length ? dirName : ".", &dirStat) == 0)
+				{
+					dirTimes[dirCount] = dirStat.st_mtim;
+				}
+			}
+		}
+		dirCount++;
+
+		if (*dirEnd == '\0')
+		{
+			return dirCount;
+		}
+		dirStart = dirEnd + 1;
+	}
+}
+
+/**************************************************
+Function: checkCommandCache
+
+Function makes sure the cache matches the current PATH and
+that none of its directories changed since the entries were
+found, clearing it if either is not so. The PATH string is
+compared on every call; the directories are stat'ed at most
+once per PATH_CHECK_INTERVAL_MS.
+***************************************************/
+
+static void checkCommandCache(const char* pathValue)
+{
+	struct timespec now;
+
+	if (commandCache.pathValue == NULL || strcmp(commandCache.pathValue, pathValue) != 0)
+	{
+		clearCommandCache();
+		commandCache.pathValue = strdup(pathValue);
+		commandCache.dirCount = statPathDirs(pathValue, NULL);
+		commandCache.dirTimes = malloc(commandCache.dirCount * sizeof(struct timespec));
+		statPathDirs(pathValue, commandCache.dirTimes);
+		clock_gettime(CLOCK_MONOTONIC_COARSE, &commandCache.lastCheck);
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+	long elapsedMs = (now.tv_sec - commandCache.lastCheck.tv_sec) * 1000
+		+ (now.tv_nsec - commandCache.lastCheck.tv_nsec) / 1000000;
+	if (elapsedMs < PATH_CHECK_INTERVAL_MS)
+	{
+		return;
+	}
+	commandCache.lastCheck = now;
+
+	struct timespec* currentTimes = malloc(commandCache.dirCount * sizeof(struct timespec));
+	statPathDirs(pathValue, currentTimes);
+	if (memcmp(currentTimes, commandCache.dirTimes, commandCache.dirCount * sizeof(struct timespec)) != 0)
+	{
+		// entries may be shadowed or gone: start over for this PATH
+		for (int i = 0; i < commandCache.capacity; i++)
+		{
+			free(commandCache.entries[i].name);
+			commandCache.entries[i].name = NULL;
+		}
+		commandCache.count = 0;
+		memcpy(commandCache.dirTimes, currentTimes, commandCache.dirCount * sizeof(struct timespec));
+	}
+	free(currentTimes);
+}
+
+/**************************************************
+Function: findCommandEntry
+
+Function returns the position of a command name in the
+cache, or of the empty entry where it would go.
+***************************************************/
+
+static int findCommandEntry(const char* commandName)
+{
+	int mask = commandCache.capacity - 1;
+	int position = hashName(commandName) & mask;
+
+	while (commandCache.entries[position].name != NULL
+		&& strcmp(commandCache.entries[position].name, commandName) != 0)
+	{
+		position = (position + 1) & mask;
+	}
+	return position;
+}
+
+/**************************************************
+Function: searchPath
+
+Function takes a command name and a PATH value and walks
+the directories in order, the way execvp does, for the
+first executable regular file with that name. Returns the
+full path (malloc'd) or NULL with errno set: EACCES if
+only non-executable matches were seen, ENOENT otherwise.
+***************************************************/
+
+static char* searchPath(const char* commandName, const char* pathValue)
+{
+	char candidate[PATH_MAX];
+	struct stat fileStat;
+	bool sawDenied = false;
+	const char* dirStart = pathValue;
+
+	while (true)
+	{
+		const char* dirEnd = strchrnul(dirStart, ':');
+		int length = (int)(dirEnd - dirStart);
+
+		if (length == 0)
+		{
+			snprintf(candidate, sizeof(candidate), "./%s", commandName);
+		}
+		else
+		{
+			snprintf(candidate, sizeof(candidate), "%.*s/%s", length, dirStart, commandName);
+		}
+
+		if (stat(candidate, &fileStat) == 0 && S_ISREG(fileStat.st_mode))
+		{
+			if (access(candidate, X_OK) == 0)
+			{
+				return strdup(candidate);
+			}
+			sawDenied = true;
+		}
+
+		if (*dirEnd == '\0')
+		{
+			break;
+		}
+		dirStart = dirEnd + 1;
+	}
+
+	errno = sawDenied ? EACCES : ENOENT;
+	return NULL;
+}
+
+/**************************************************
+Function: resolveCommand
+
+Function takes a command name and returns the path to exec
+for it. Names with a '/' are used as they are. Other names
+are looked up in the command location cache and, on a
+miss, searched for on PATH and added to it.
+
+Returns the path, which stays valid until the cache is
+next changed, or NULL with errno set if there is none.
+***************************************************/
+
+char* resolveCommand(char* commandName)
+{
+	char* pathValue = getenv("PATH");
+	int position;
+
+	if (strchr(commandName, '/') != NULL)
+	{
+		return commandName;
+	}
+	if (pathValue == NULL)
+	{
+		// the same default execvp uses
+		pathValue = "/bin:/usr/bin";
+	}
+
+	if (commandCache.entries == NULL)
+	{
+		commandCache.capacity = 64;
+		commandCache.entries = calloc(commandCache.capacity, sizeof(struct pathEntry));
+	}
+	checkCommandCache(pathValue);
+
+	position = findCommandEntry(commandName);
+	if (commandCache.entries[position].name != NULL)
+	{
+		commandCache.hits++;
+		commandCache.entries[position].hits++;
+		return commandCache.entries[position].path;
+	}
+
+	commandCache.misses++;
+	char* foundPath = searchPath(commandName, pathValue);
+	if (foundPath == NULL)
+	{
+		return NULL;
+	}
+
+	// grow before the table gets more than half full
+	if ((commandCache.count + 1) * 2 > commandCache.capacity)
+	{
+		struct pathEntry* oldEntries = commandCache.entries;
+		int oldCapacity = commandCache.capacity;
+
+		commandCache.capacity *= 2;
+		commandCache.entries = calloc(commandCache.capacity, sizeof(struct pathEntry));
+		for (int i = 0; i < oldCapacity; i++)
+		{
+			if (oldEntries[i].name != NULL)
+			{
+				commandCache.entries[findCommandEntry(oldEntries[i].name)] = oldEntries[i];
+			}
+		}
+		free(oldEntries);
+		position = findCommandEntry(commandName);
+	}
+
+	// name and path in one block
+	size_t nameLength = strlen(commandName) + 1;
+	size_t pathLength = strlen(foundPath) + 1;
+	struct pathEntry* entry = &commandCache.entries[position];
+
+	entry->name = malloc(nameLength + pathLength);
+	entry->path = entry->name + nameLength;
+	memcpy(entry->name, commandName, nameLength);
+	memcpy(entry->path, foundPath, pathLength);
+	entry->hits = 0;
+	commandCache.count++;
+	free(foundPath);
+
+	return entry->path;
+}
+
+/**************************************************
+Function: forgetCommand
+
+Function takes a command name and drops it from the cache,
+for when its cached path turned out to be gone. Later
+entries of its probe run are re-inserted so lookups for
+them still find them.
+***************************************************/
+
+void forgetCommand(char* commandName)
+{
+	if (commandCache.entries == NULL)
+	{
+		return;
+	}
+
+	int mask = commandCache.capacity - 1;
+	int position = findCommandEntry(commandName);
+
+	if (commandCache.entries[position].name == NULL)
+	{
+		return;
+	}
+	free(commandCache.entries[position].name);
+	commandCache.entries[position].name = NULL;
+	commandCache.count--;
+
+	for (position = (position + 1) & mask; commandCache.entries[position].name != NULL; position = (position + 1) & mask)
+	{
+		struct pathEntry moved = commandCache.entries[position];
+		commandCache.entries[position].name = NULL;
+		commandCache.entries[findCommandEntry(moved.name)] = moved;
+	}
+}
+
+/**************************************************
+Function: shellArguments
+
+Function takes the path of a file exec refused with ENOEXEC
+(a script with no #! line) and the command's arguments, and
+returns the argument array that runs it with /bin/sh
+instead, as execvp does: "sh", the path, then the
+arguments after the command name. The array is malloc'd;
+its strings are the caller's.
+***************************************************/
+
+char** shellArguments(char* execPath, char** arguments)
+{
+	int argCount = 0;
+	while (arguments[argCount] != NULL)
+	{
+		argCount++;
+	}
+
+	char** shellArgs = malloc((argCount + 2) * sizeof(char*));
+	if (shellArgs == NULL)
+	{
+		return NULL;
+	}
+	shellArgs[0] = "sh";
+	shellArgs[1] = execPath;
+	for (int i = 1; i <= argCount; i++)
+	{
+		shellArgs[i + 1] = arguments[i];
+	}
+	return shellArgs;
+}
+
+/**************************************************
+Function: hashProcess
+
+Built-in command hash. Takes the command's argument array.
+With no arguments, prints each cached command with the
+number of times the cache supplied its path, then the
+cache's total hits and misses. "hash -r" empties the cache.
+***************************************************/
+
+void hashProcess(char** arguments)
+{
+	if (arguments[1] != NULL && strcmp(arguments[1], "-r") == 0)
+	{
+		clearCommandCache();
+		return;
+	}
+
+	if (commandCache.count > 0)
+	{
+		printf("hits\tcommand\n");
+		for (int i = 0; i < commandCache.capacity; i++)
+		{
+			if (commandCache.entries[i].name != NULL)
+			{
+				printf("%4d\t%s\n", commandCache.entries[i].hits, commandCache.entries[i].path);
+			}
+		}
+	}
+	printf("cache: %d entries, %ld hits, %ld misses\n", commandCache.count, commandCache.hits, commandCache.misses);
+	fflush(stdout);
+}
+
+/**************************************************
+Function: spawnNeedsFork
+
+Function takes a pointer to a populated command struct and
+reports whether the command needs per-child setup that
+posix_spawn cannot express, in which case the fork path is
+used instead. Setting SMALLSH_SPAWN=fork in the environment
+forces the fork path for every command (useful for comparing
+the two engines).
+***************************************************/
+
+bool spawnNeedsFork(commandStruct* currentCmdStruct)
+{
+	(void)currentCmdStruct;
+	return forceForkSpawn;
+}
+
+/**************************************************
+Function: zygoteMain
+
+Body of a zygote helper. Function takes the helper's end of
+its socketpair, already set up by the master the way the
+spawn paths set up a child (shell's SIGCHLD mask undone,
+SIGTSTP ignored), and waits for one command. It moves to the
+shell's working directory, puts the descriptors it was
+sent on stdin/stdout, gives a foreground command default
+SIGINT handling (and, with job control, every command the
+default stop signals) and execs it. If anything fails, errno is
+sent back before exiting; a successful exec closes the
+socket instead (it is close-on-exec). The helper exits
+quietly when the shell closes the socket. Never returns.
+***************************************************/
+
+static void zygoteMain(int socketFd)
+{
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	struct msghdr message = { 0 };
+	struct iovec messageData;
+	int receivedFds[2] = { -1, -1 };
+	int error;
+
+	// find the message size first, so any command line fits
+	ssize_t size;
+	while ((size = recv(socketFd, NULL, 0, MSG_PEEK | MSG_TRUNC)) == -1 && errno == EINTR)
+	{
+	}
+	if (size < (ssize_t)sizeof(struct zygoteRequest))
+	{
+		_exit(0);
+	}
+
+	char* buffer = malloc(size + 1);
+	messageData.iov_base = buffer;
+	messageData.iov_len = size;
+	message.msg_iov = &messageData;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+	if (buffer == NULL || recvmsg(socketFd, &message, 0) != size)
+	{
+		_exit(0);
+	}
+	buffer[size] = '\0';
+
+	struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+	if (header != NULL && header->cmsg_type == SCM_RIGHTS)
+	{
+		memcpy(receivedFds, CMSG_DATA(header), header->cmsg_len - CMSG_LEN(0));
+	}
+
+	// unpack: exec path, working directory, then the arguments
+	struct zygoteRequest request;
+	memcpy(&request, buffer, sizeof(request));
+	char* next = buffer + sizeof(request);
+	char* execPath = next;
+	next += strlen(next) + 1;
+	char* workingDir = next;
+	next += strlen(next) + 1;
+
+	char** arguments = malloc((request.argCount + 1) * sizeof(char*));
+	for (int i = 0; i < request.argCount; i++)
+	{
+		arguments[i] = next;
+		next += strlen(next) + 1;
+	}
+	arguments[request.argCount] = NULL;
+
+	int fdIndex = 0;
+	if (chdir(workingDir) == -1
+		|| (request.hasIn && dup2(receivedFds[fdIndex++], STDIN_FILENO) == -1)
+		|| (request.hasOut && dup2(receivedFds[fdIndex++], STDOUT_FILENO) == -1))
+	{
+		error = errno;
+		write(socketFd, &error, sizeof(error));
+		_exit(2);
+	}
+	for (int i = 0; i < fdIndex; i++)
+	{
+		close(receivedFds[i]);
+	}
+
+	struct sigaction default_action = { {0} };
+	default_action.sa_handler = SIG_DFL;
+	if (!request.background)
+	{
+		sigaction(SIGINT, &default_action, NULL);
+	}
+	if (jobControl)
+	{
+		sigaction(SIGTSTP, &default_action, NULL);
+	}
+	if (shellGroup != 0)
+	{
+		sigaction(SIGTTIN, &default_action, NULL);
+		sigaction(SIGTTOU, &default_action, NULL);
+	}
+
+	execv(execPath, arguments);
+	if (errno == ENOEXEC)
+	{
+		// no #! line: run it with /bin/sh, as execvp would
+		char** shellArgs = shellArguments(execPath, arguments);
+		if (shellArgs != NULL)
+		{
+			execv("/bin/sh", shellArgs);
+		}
+		errno = ENOEXEC;
+	}
+
+	// exec only returns if there is an error
+	error = errno;
+	write(socketFd, &error, sizeof(error));
+	_exit(2);
+}
+
+/**************************************************
+Function: zygoteMaster
+
+Body of the zygote master, a small process forked when the
+shell starts. For each count of helpers the shell asks for
+on the control socket it makes that many: each is cloned
+with CLONE_PARENT, so it is the shell's child (the shell
+waits on it like any command) while its memory is a copy
+of the idle master's rather than of the busy shell's.
+Each helper's pid and the shell's end of its socketpair
+are sent back as they are made. Exits when the shell closes
+the control socket. Never returns.
+***************************************************/
+
+static void zygoteMaster(int controlFd)
+{
+	struct sigaction ignore_action = { {0} };
+	char control[CMSG_SPACE(sizeof(int))];
+	int requested;
+	int sockets[2];
+
+	// helpers start out set up as zygoteMain leaves them
+	sigprocmask(SIG_SETMASK, &childSignalMask, NULL);
+	ignore_action.sa_handler = SIG_IGN;
+	sigaction(SIGTSTP, &ignore_action, NULL);
+
+	while (read(controlFd, &requested, sizeof(requested)) == sizeof(requested))
+	{
+		for (int i = 0; i < requested; i++)
+		{
+			if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) == -1)
+			{
+				break;
+			}
+
+			pid_t helperPid = (pid_t)syscall(SYS_clone, CLONE_PARENT | SIGCHLD, 0, 0, 0, 0);
+			if (helperPid == 0)
+			{
+				close(controlFd);
+				close(sockets[0]);
+				zygoteMain(sockets[1]);
+			}
+
+			// hand the helper to the shell (pid -1: none could be made)
+			struct msghdr message = { 0 };
+			struct iovec messageData = { &helperPid, sizeof(helperPid) };
+			message.msg_iov = &messageData;
+			message.msg_iovlen = 1;
+			if (helperPid != -1)
+			{
+				message.msg_control = control;
+				message.msg_controllen = sizeof(control);
+				struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+				header->cmsg_level = SOL_SOCKET;
+				header->cmsg_type = SCM_RIGHTS;
+				header->cmsg_len = CMSG_LEN(sizeof(int));
+				memcpy(CMSG_DATA(header), &sockets[0], sizeof(int));
+			}
+			sendmsg(controlFd, &message, MSG_NOSIGNAL);
+			close(sockets[0]);
+			close(sockets[1]);
+		}
+	}
+	_exit(0);
+}
+
+/**************************************************
+Function: startZygotes
+
+Function starts the zygote master (SMALLSH_SPAWN=zygote)
+and asks it for the first helper. If the master cannot be
+started the shell uses posix_spawn as usual.
+***************************************************/
+
+void startZygotes(void)
+{
+	int sockets[2];
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sockets) == -1)
+	{
+		zygoteMode = false;
+		return;
+	}
+
+	pid_t masterPid = fork();
+	if (masterPid == -1)
+	{
+		close(sockets[0]);
+		close(sockets[1]);
+		zygoteMode = false;
+		return;
+	}
+	if (masterPid == 0)
+	{
+		close(sockets[0]);
+		zygoteMaster(sockets[1]);
+	}
+
+	close(sockets[1]);
+	zygoteControlFd = sockets[0];
+	zygoteMasterPid = masterPid;
+	requestZygotes(zygoteTarget);
+}
+
+/**************************************************
+Function: requestZygotes
+
+Function asks the zygote master for more helpers. They are
+made while the shell gets on with other things and picked
+up by collectZygotes.
+***************************************************/
+
+static void requestZygotes(int requested)
+{
+	if (requested > 0 && send(zygoteControlFd, &requested, sizeof(requested), MSG_DONTWAIT | MSG_NOSIGNAL) == sizeof(requested))
+	{
+		zygotePending += requested;
+	}
+}
+
+/**************************************************
+Function: collectZygotes
+
+Function adds the helpers the master has made so far to
+the pool, without waiting for the rest.
+***************************************************/
+
+static void collectZygotes(void)
+{
+	char control[CMSG_SPACE(sizeof(int))];
+	pid_t helperPid;
+
+	while (zygotePending > 0)
+	{
+		struct msghdr message = { 0 };
+		struct iovec messageData = { &helperPid, sizeof(helperPid) };
+		message.msg_iov = &messageData;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+
+		ssize_t bytesRead = recvmsg(zygoteControlFd, &message, MSG_DONTWAIT | MSG_CMSG_CLOEXEC);
+		if (bytesRead == 0 || (bytesRead == -1 && errno != EAGAIN && errno != EINTR))
+		{
+			// the master is gone: fall back to posix_spawn for good
+			zygotePending = 0;
+			zygoteMode = zygoteCount > 0;
+			return;
+		}
+		if (bytesRead != sizeof(helperPid))
+		{
+			return;
+		}
+		zygotePending--;
+
+		struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+		if (helperPid == -1 || header == NULL || header->cmsg_type != SCM_RIGHTS)
+		{
+			continue;
+		}
+		if (zygoteCount == ZYGOTE_POOL_MAX)
+		{
+			struct zygote extra;
+			extra.pid = helperPid;
+			memcpy(&extra.socketFd, CMSG_DATA(header), sizeof(int));
+			discardZygote(&extra);
+			continue;
+		}
+		zygotePool[zygoteCount].pid = helperPid;
+		memcpy(&zygotePool[zygoteCount].socketFd, CMSG_DATA(header), sizeof(int));
+		zygoteCount++;
+	}
+}
+
+/**************************************************
+Function: discardZygote
+
+Function takes a helper that is no longer wanted (or whose
+command failed before exec), closes its socket and reaps it.
+***************************************************/
+
+static void discardZygote(struct zygote* helper)
+{
+	close(helper->socketFd);
+	while (waitpid(helper->pid, NULL, 0) == -1 && errno == EINTR)
+	{
+	}
+}
+
+/**************************************************
+Function: refillZygotes
+
+Function brings the zygote pool to its target size. Called
+when the shell goes idle waiting for a command; the master
+makes the missing helpers while the shell sleeps. The target follows how
+many helpers were used per command line (a pipeline uses
+one per stage), smoothed so one burst does not fill the
+pool for good: between 1 and ZYGOTE_POOL_MAX. Helpers over
+the target are let go.
+***************************************************/
+
+void refillZygotes(void)
+{
+	zygoteRate = (zygoteRate * 3 + zygoteDemand * 4) / 4;
+	zygoteDemand = 0;
+
+	zygoteTarget = (zygoteRate + 3) / 4;
+	if (zygoteTarget < 1)
+	{
+		zygoteTarget = 1;
+	}
+	if (zygoteTarget > ZYGOTE_POOL_MAX)
+	{
+		zygoteTarget = ZYGOTE_POOL_MAX;
+	}
+
+	collectZygotes();
+	while (zygoteCount > zygoteTarget)
+	{
+		discardZygote(&zygotePool[--zygoteCount]);
+	}
+	requestZygotes(zygoteTarget - zygoteCount - zygotePending);
+}
+
+/**************************************************
+Function: closeZygotes
+
+Function lets every helper in the pool, and the master,
+go on exit. Helpers still on their way from the master are
+collected first: they are the shell's children too, and
+are reaped like the rest.
+***************************************************/
+
+void closeZygotes(void)
+{
+	if (zygoteControlFd != -1)
+	{
+		// the master finishes what it was asked for, then exits
+		shutdown(zygoteControlFd, SHUT_WR);
+		while (zygotePending > 0 && zygoteMode)
+		{
+			struct pollfd ready = { zygoteControlFd, POLLIN, 0 };
+			poll(&ready, 1, -1);
+			collectZygotes();
+		}
+		close(zygoteControlFd);
+		zygoteControlFd = -1;
+		while (waitpid(zygoteMasterPid, NULL, 0) == -1 && errno == EINTR)
+		{
+		}
+	}
+	while (zygoteCount > 0)
+	{
+		discardZygote(&zygotePool[--zygoteCount]);
+	}
+}
+
+/**************************************************
+Function: zygoteCommand
+
+Function takes a populated command struct, the path
+resolveCommand found for it and the descriptors returned by
+openRedirects, and hands the command to a helper from the
+pool: argv, the shell's working directory and the
+descriptors go over the helper's socket in one message. The
+helper has its own copy of the environment from when it was
+forked. The helper is still waiting for the message, so the
+shell puts it in its process group (see spawnCommand), and
+gives that group the terminal, before sending it. Like
+posix_spawn this waits until the helper has exec'd, so a
+failed start is reported here.
+
+Returns pid of the child (the helper), or -1 with errno set
+if the command could not be started. EAGAIN means the
+helper had gone away and nothing was started.
+***************************************************/
+
+pid_t zygoteCommand(commandStruct* currentCmdStruct, char* execPath, int inFd, int outFd,
+	pid_t processGroup)
+{
+	struct zygote helper = zygotePool[--zygoteCount];
+	struct zygoteRequest request = { 0 };
+	char workingDir[PATH_MAX];
+	char control[CMSG_SPACE(2 * sizeof(int))];
+	struct msghdr message = { 0 };
+	struct iovec messageData;
+	int sentFds[2];
+	int fdCount = 0;
+	int error;
+
+	zygoteDemand++;
+
+	if (getcwd(workingDir, sizeof(workingDir)) == NULL)
+	{
+		strcpy(workingDir, ".");
+	}
+
+	// pack the request into one buffer in the line arena
+	size_t pathLength = strlen(execPath) + 1;
+	size_t dirLength = strlen(workingDir) + 1;
+	size_t size = sizeof(request) + pathLength + dirLength;
+	while (currentCmdStruct->arguments[request.argCount] != NULL)
+	{
+		size += strlen(currentCmdStruct->arguments[request.argCount++]) + 1;
+	}
+
+	char* buffer = arenaAlloc(&lineArena, size);
+	char* next = buffer + sizeof(request);
+	memcpy(next, execPath, pathLength);
+	next += pathLength;
+	memcpy(next, workingDir, dirLength);
+	next += dirLength;
+	for (int i = 0; i < request.argCount; i++)
+	{
+		size_t argLength = strlen(currentCmdStruct->arguments[i]) + 1;
+		memcpy(next, currentCmdStruct->arguments[i], argLength);
+		next += argLength;
+	}
+
+	request.background = currentCmdStruct->bkgrdInd;
+	request.hasIn = (inFd != -1);
+	request.hasOut = (outFd != -1);
+	memcpy(buffer, &request, sizeof(request));
+
+	messageData.iov_base = buffer;
+	messageData.iov_len = size;
+	message.msg_iov = &messageData;
+	message.msg_iovlen = 1;
+
+	if (inFd != -1)
+	{
+		sentFds[fdCount++] = inFd;
+	}
+	if (outFd != -1)
+	{
+		sentFds[fdCount++] = outFd;
+	}
+	if (fdCount > 0)
+	{
+		message.msg_control = control;
+		message.msg_controllen = CMSG_SPACE(fdCount * sizeof(int));
+		struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(fdCount * sizeof(int));
+		memcpy(CMSG_DATA(header), sentFds, fdCount * sizeof(int));
+	}
+
+	if (processGroup != -1)
+	{
+		pid_t group = (processGroup == 0) ? helper.pid : processGroup;
+		setpgid(helper.pid, group);
+		if (jobControl && !currentCmdStruct->bkgrdInd)
+		{
+			tcsetpgrp(terminalFd, group);
+		}
+	}
+
+	if (sendmsg(helper.socketFd, &message, MSG_NOSIGNAL) == -1)
+	{
+		discardZygote(&helper);
+		errno = EAGAIN;
+		return -1;
+	}
+
+	// EOF: the helper exec'd; an int: the errno it failed with
+	ssize_t bytesRead;
+	while ((bytesRead = read(helper.socketFd, &error, sizeof(error))) == -1 && errno == EINTR)
+	{
+	}
+	if (bytesRead == sizeof(error))
+	{
+		discardZygote(&helper);
+		errno = error;
+		return -1;
+	}
+
+	close(helper.socketFd);
+	return helper.pid;
+}
+
+/**************************************************
+Function: spawnCommand
+
+Fast-spawn path. Function takes a populated command struct
+and the descriptors returned by openRedirects and starts the
+command with posix_spawn on the path resolveCommand found
+for it (no PATH walk in the child), which glibc implements with
+clone(CLONE_VM | CLONE_VFORK) so the parent's page tables are
+never copied. A file with no #! line is spawned again as a
+script of /bin/sh, as execvp would run it. Redirects are
+applied with dup2 file actions and the child's signal
+dispositions are set up to match the fork path:
+
+1) SIGINT back to default for foreground commands
+(background commands inherit SIG_IGN from the shell; while
+a loop has its handler in, it is swapped for SIG_IGN as
+SIGTSTP's is below)
+2) SIGTSTP ignored. exec resets caught signals to default, so
+the shell's handler is swapped for SIG_IGN (with SIGTSTP
+blocked, so no Ctrl-Z is lost) for the duration of the call.
+With job control SIGTSTP, SIGTTIN and SIGTTOU are reset to
+default instead, so the job can be stopped.
+3) the signal mask from before the event loop blocked SIGCHLD
+
+processGroup is the process group the child is put in: -1
+leaves it in the shell's, 0 makes it the leader of a new
+one, anything else joins that group. A foreground command
+given a group under job control also takes the terminal
+before it execs.
+
+With SMALLSH_SPAWN=zygote a pre-forked helper from the pool
+runs the command instead (zygoteCommand), when one is ready.
+
+Returns pid of the child, or -1 with errno set if the
+command could not be started.
+***************************************************/
+
+pid_t spawnCommand(commandStruct* currentCmdStruct, int inFd, int outFd, pid_t processGroup)
+{
+	pid_t spawnPid = -1;
+	int spawnResult;
+	posix_spawn_file_actions_t fileActions;
+	posix_spawnattr_t spawnAttr;
+	sigset_t defaultSignals;
+	sigset_t blockSignals;
+	sigset_t oldMask;
+	struct sigaction ignore_action = { {0} };
+	struct sigaction saved_action;
+	struct sigaction saved_interrupt;
+	char* execPath = resolveCommand(currentCmdStruct->command);
+
+	if (execPath == NULL)
+	{
+		return -1;
+	}
+
+	if (zygoteMode && zygoteCount == 0)
+	{
+		collectZygotes();
+	}
+	if (zygoteMode && zygoteCount > 0)
+	{
+		spawnPid = zygoteCommand(currentCmdStruct, execPath, inFd, outFd, processGroup);
+		// a cached path that has gone away: look it up again once
+		if (spawnPid == -1 && errno == ENOENT && execPath != currentCmdStruct->command
+			&& access(execPath, F_OK) != 0)
+		{
+			forgetCommand(currentCmdStruct->command);
+			return spawnCommand(currentCmdStruct, inFd, outFd, processGroup);
+		}
+		// EAGAIN: the helper was gone, use posix_spawn after all
+		if (spawnPid != -1 || errno != EAGAIN)
+		{
+			return spawnPid;
+		}
+	}
+
+	posix_spawn_file_actions_init(&fileActions);
+	// setpgid comes before the file actions, so this is the new group
+	if (processGroup != -1 && jobControl && !currentCmdStruct->bkgrdInd)
+	{
+		posix_spawn_file_actions_addtcsetpgrp_np(&fileActions, terminalFd);
+	}
+	if (inFd != -1)
+	{
+		posix_spawn_file_actions_adddup2(&fileActions, inFd, STDIN_FILENO);
+	}
+	if (outFd != -1)
+	{
+		posix_spawn_file_actions_adddup2(&fileActions, outFd, STDOUT_FILENO);
+	}
+
+	sigemptyset(&defaultSignals);
+	if (!currentCmdStruct->bkgrdInd)
+	{
+		sigaddset(&defaultSignals, SIGINT);
+	}
+	if (jobControl)
+	{
+		sigaddset(&defaultSignals, SIGTSTP);
+	}
+	if (shellGroup != 0)
+	{
+		sigaddset(&defaultSignals, SIGTTIN);
+		sigaddset(&defaultSignals, SIGTTOU);
+	}
+
+	sigemptyset(&blockSignals);
+	sigaddset(&blockSignals, SIGTSTP);
+	sigaddset(&blockSignals, SIGINT);
+	sigprocmask(SIG_BLOCK, &blockSignals, &oldMask);
+
+	posix_spawnattr_init(&spawnAttr);
+	posix_spawnattr_setsigdefault(&spawnAttr, &defaultSignals);
+	posix_spawnattr_setsigmask(&spawnAttr, &childSignalMask);
+	if (processGroup != -1)
+	{
+		posix_spawnattr_setpgroup(&spawnAttr, processGroup);
+	}
+	posix_spawnattr_setflags(&spawnAttr, POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK
+		| ((processGroup != -1) ? POSIX_SPAWN_SETPGROUP : 0));
+
+	ignore_action.sa_handler = SIG_IGN;
+	sigaction(SIGTSTP, &ignore_action, &saved_action);
+	sigaction(SIGINT, &ignore_action, &saved_interrupt);
+
+	spawnResult = posix_spawn(&spawnPid, execPath, &fileActions,
+		&spawnAttr, currentCmdStruct->arguments, environ);
+	if (spawnResult == ENOEXEC)
+	{
+		// no #! line: run it with /bin/sh, as execvp would
+		char** shellArgs = shellArguments(execPath, currentCmdStruct->arguments);
+		if (shellArgs != NULL)
+		{
+			spawnResult = posix_spawn(&spawnPid, "/bin/sh", &fileActions,
+				&spawnAttr, shellArgs, environ);
+			free(shellArgs);
+		}
+	}
+
+	sigaction(SIGTSTP, &saved_action, NULL);
+	sigaction(SIGINT, &saved_interrupt, NULL);
+	sigprocmask(SIG_SETMASK, &oldMask, NULL);
+
+	posix_spawnattr_destroy(&spawnAttr);
+	posix_spawn_file_actions_destroy(&fileActions);
+
+	if (spawnResult != 0)
+	{
+		// a cached path that has gone away: look it up again once
+		if (spawnResult == ENOENT && execPath != currentCmdStruct->command
+			&& access(execPath, F_OK) != 0)
+		{
+			forgetCommand(currentCmdStruct->command);
+			return spawnCommand(currentCmdStruct, inFd, outFd, processGroup);
+		}
+		errno = spawnResult;
+		return -1;
+	}
+	return spawnPid;
+}
+
+/**************************************************
+Function: forkCommand
+
+Fallback spawn path using a full fork(). Function takes a
+populated command struct, the descriptors returned by
+openRedirects, a cgroup directory to start the child in
+(-1 for the shell's own), a process group as for
+spawnCommand and the sigaction struct loaded with the
+SIGTSTP handler, and sets up the child by hand before exec.
+The group is set in both the parent and the child, so it is
+in place whichever runs first.
+
+The child is put in its cgroup by clone3 with
+CLONE_INTO_CGROUP, so it never runs outside it. Kernels
+without it get fork and the child moves itself before exec.
+
+Returns pid of the child to the parent. The child never
+returns: it exits with status 2 if exec fails or the
+command is not on PATH. A file with no #! line is run with
+/bin/sh, as execvp would.
+***************************************************/
+
+pid_t forkCommand(commandStruct* currentCmdStruct, int inFd, int outFd, int cgroupFd, pid_t processGroup,
+	struct sigaction SIGTSTP_action)
+{
+	// look the command up in the parent, so the cache keeps the result
+	char* execPath = resolveCommand(currentCmdStruct->command);
+	pid_t spawnPid = -1;
+	bool moveSelf = false;
+
+	// generate new process
+	if (cgroupFd != -1)
+	{
+		struct clone_args cloneArgs = { 0 };
+		cloneArgs.flags = CLONE_INTO_CGROUP;
+		cloneArgs.exit_signal = SIGCHLD;
+		cloneArgs.cgroup = cgroupFd;
+		spawnPid = (pid_t)syscall(SYS_clone3, &cloneArgs, sizeof(cloneArgs));
+		moveSelf = (spawnPid == -1);
+	}
+	if (spawnPid == -1)
+	{
+		spawnPid = fork();
+	}
+
+	if (spawnPid != 0)
+	{
+		// parent, or fork() failed
+		if (spawnPid != -1 && processGroup != -1)
+		{
+			setpgid(spawnPid, (processGroup == 0) ? spawnPid : processGroup);
+		}
+		return spawnPid;
+	}
+
+	// In the child process
+
+	// no clone3: join the cgroup now, before running anything
+	if (moveSelf)
+	{
+		int procsFd = openat(cgroupFd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+		if (procsFd != -1)
+		{
+			write(procsFd, "0", 1);
+			close(procsFd);
+		}
+	}
+
+	// join the job's process group, and take the terminal for it
+	// while SIGTTOU is still ignored
+	if (processGroup != -1)
+	{
+		setpgid(0, processGroup);
+		if (jobControl && !currentCmdStruct->bkgrdInd)
+		{
+			tcsetpgrp(terminalFd, getpgrp());
+		}
+	}
+
+	// undo the shell's blocked SIGCHLD (see setupEventLoop)
+	sigprocmask(SIG_SETMASK, &childSignalMask, NULL);
+
+	//signal handler defined for child process forcing
+	// it to ignore Ctrl-Z/SIGTSTP spec (unless jobs can be stopped)
+	SIGTSTP_action.sa_handler = jobControl ? SIG_DFL : SIG_IGN;
+	sigaction(SIGTSTP, &SIGTSTP_action, NULL);
+	if (shellGroup != 0)
+	{
+		struct sigaction default_action = { { 0 } };
+		default_action.sa_handler = SIG_DFL;
+		sigaction(SIGTTIN, &default_action, NULL);
+		sigaction(SIGTTOU, &default_action, NULL);
+	}
+
+	//set so that processes set to run in foreground should have the
+	// default behavior (SIG_DFL), and background ones ignore it even
+	// when started from a loop, which catches it (see runLoop)
+	struct sigaction interrupt_action = { { 0 } };
+	interrupt_action.sa_handler = currentCmdStruct->bkgrdInd ? SIG_IGN : SIG_DFL;
+	sigaction(SIGINT, &interrupt_action, NULL);
+
+	//redirects stdin (0) from source file descriptor
+	if (inFd != -1 && dup2(inFd, STDIN_FILENO) == -1)
+	{
+		perror("READ error. New file descriptor could not be allocated\n");
+		fflush(stdout);
+		exit(1);
+	}
+
+	//redirects stdout (1) to target file descriptor
+	if (outFd != -1 && dup2(outFd, STDOUT_FILENO) == -1)
+	{
+		perror("WRITE error. New file descriptor could not be allocated\n");
+		fflush(stdout);
+		exit(1);
+	}
+
+	// Replace the current program
+	if (execPath != NULL)
+	{
+		execv(execPath, currentCmdStruct->arguments);
+		if (errno == ENOEXEC)
+		{
+			// no #! line: run it with /bin/sh, as execvp would
+			char** shellArgs = shellArguments(execPath, currentCmdStruct->arguments);
+			if (shellArgs != NULL)
+			{
+				execv("/bin/sh", shellArgs);
+			}
+			errno = ENOEXEC;
+		}
+	}
+	// exec only returns if there is an error
+	perror(currentCmdStruct->command);
+	fflush(stdout);
+	exit(2);
+}
+
+/**************************************************
+Function: parseLimit
+
+Function takes one key=value setting of the limit builtin
+or prefix and stores it in the policy. Keys are cpu (CPUs,
+e.g. 0.5), mem (bytes, with an optional K, M or G suffix)
+and io (io.weight, 1-10000); any value may be "max".
+Returns false, after printing why, for a bad setting.
+***************************************************/
+
+bool parseLimit(char* setting, struct cgroupPolicy* policy)
+{
+	char* value = strchr(setting, '=');
+	char* end;
+
+	if (value == NULL)
+	{
+		printf("limit: %s: expected key=value\n", setting);
+		fflush(stdout);
+		return false;
+	}
+	value++;
+
+	bool unlimited = (strcmp(value, "max") == 0);
+
+	if (strncmp(setting, "cpu=", 4) == 0)
+	{
+		double cpus = unlimited ? 0 : strtod(value, &end);
+		if (!unlimited && (end == value || *end != '\0' || cpus <= 0))
+		{
+			printf("limit: %s: expected a number of CPUs\n", setting);
+			fflush(stdout);
+			return false;
+		}
+		policy->cpuQuota = unlimited ? -1 : (long)(cpus * CPU_PERIOD_US);
+	}
+	else if (strncmp(setting, "mem=", 4) == 0)
+	{
+		long long bytes = unlimited ? 0 : strtoll(value, &end, 10);
+		if (!unlimited)
+		{
+			switch (*end)
+			{
+			case 'G': case 'g': bytes <<= 10; /* fall through */
+			case 'M': case 'm': bytes <<= 10; /* fall through */
+			case 'K': case 'k': bytes <<= 10; end++;
+			}
+			if (end == value || *end != '\0' || bytes <= 0)
+			{
+				printf("limit: %s: expected a size in bytes\n", setting);
+				fflush(stdout);
+				return false;
+			}
+		}
+		policy->memoryMax = unlimited ? -1 : bytes;
+	}
+	else if (strncmp(setting, "io=", 3) == 0)
+	{
+		long weight = unlimited ? 0 : strtol(value, &end, 10);
+		if (!unlimited && (end == value || *end != '\0' || weight < 1 || weight > 10000))
+		{
+			printf("limit: %s: expected a weight from 1 to 10000\n", setting);
+			fflush(stdout);
+			return false;
+		}
+		policy->ioWeight = unlimited ? -1 : (int)weight;
+	}
+	else
+	{
+		printf("limit: %s: unknown limit (cpu, mem or io)\n", setting);
+		fflush(stdout);
+		return false;
+	}
+	return true;
+}
+
+/**************************************************
+Function: policySet
+
+Function returns whether a policy sets any limit.
+***************************************************/
+
+bool policySet(struct cgroupPolicy* policy)
+{
+	return policy->cpuQuota != 0 || policy->memoryMax != 0 || policy->ioWeight != 0;
+}
+
+/**************************************************
+Function: writeCgroupFile
+
+Function takes a cgroup directory, the name of one of its
+control files and a value, and writes the value to the
+file. Returns 0, or -1 with errno set.
+***************************************************/
+
+static int writeCgroupFile(int cgroupFd, const char* fileName, const char* value)
+{
+	int fileFd = openat(cgroupFd, fileName, O_WRONLY | O_CLOEXEC);
+	if (fileFd == -1)
+	{
+		return -1;
+	}
+
+	ssize_t written = write(fileFd, value, strlen(value));
+	int savedErrno = errno;
+	close(fileFd);
+	errno = savedErrno;
+	return (written == -1) ? -1 : 0;
+}
+
+/**************************************************
+Function: openShellCgroup
+
+Function returns the directory of this shell's cgroup,
+creating it on first use: smallsh-<pid> under the cgroup v2
+group the shell was started in, with the cpu, memory and io
+controllers enabled for the jobs below it where the parent
+allows. Returns -1, after saying so once, when there is no
+writable cgroup v2 hierarchy; jobs then run without limits.
+***************************************************/
+
+int openShellCgroup(void)
+{
+	char mountPoint[PATH_MAX] = "";
+	char groupPath[PATH_MAX] = "";
+	char line[PATH_MAX + 256];
+	char cgroupPath[2 * PATH_MAX];
+	FILE* info;
+
+	if (cgroupState != 0)
+	{
+		return shellCgroupFd;
+	}
+	cgroupState = -1;
+
+	// where cgroup2 is mounted (/sys/fs/cgroup, or .../unified on hybrid systems)
+	info = fopen("/proc/self/mountinfo", "re");
+	while (info != NULL && fgets(line, sizeof(line), info) != NULL)
+	{
+		char* fsType = strstr(line, " - cgroup2 ");
+		char mountDir[PATH_MAX];
+		if (fsType != NULL && sscanf(line, "%*s %*s %*s %*s %4095s", mountDir) == 1)
+		{
+			strcpy(mountPoint, mountDir);
+			break;
+		}
+	}
+	if (info != NULL)
+	{
+		fclose(info);
+	}
+
+	// the shell's own group is the "0::" line
+	info = fopen("/proc/self/cgroup", "re");
+	while (info != NULL && fgets(line, sizeof(line), info) != NULL)
+	{
+		if (strncmp(line, "0::", 3) == 0)
+		{
+			line[strcspn(line, "\n")] = '\0';
+			// a path too long to hold is left unset: no limits
+			if (strlen(line + 3) < sizeof(groupPath))
+			{
+				strcpy(groupPath, line + 3);
+			}
+			break;
+		}
+	}
+	if (info != NULL)
+	{
+		fclose(info);
+	}
+
+	if (mountPoint[0] == '\0' || groupPath[0] == '\0')
+	{
+		printf("limit: no cgroup v2 hierarchy, running jobs without limits\n");
+		fflush(stdout);
+		return -1;
+	}
+
+	snprintf(cgroupPath, sizeof(cgroupPath), "%s%s", mountPoint, groupPath);
+	int parentFd = open(cgroupPath, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	char shellGroup[32];
+	snprintf(shellGroup, sizeof(shellGroup), "smallsh-%d", (int)getpid());
+
+	if (parentFd == -1 || (mkdirat(parentFd, shellGroup, 0755) == -1 && errno != EEXIST))
+	{
+		printf("limit: %s: %s, running jobs without limits\n", cgroupPath, strerror(errno));
+		fflush(stdout);
+		if (parentFd != -1)
+		{
+			close(parentFd);
+		}
+		return -1;
+	}
+
+	// best effort: the parent may not delegate every controller
+	writeCgroupFile(parentFd, "cgroup.subtree_control", "+cpu +memory +io");
+	shellCgroupFd = openat(parentFd, shellGroup, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	close(parentFd);
+	if (shellCgroupFd == -1)
+	{
+		return -1;
+	}
+	writeCgroupFile(shellCgroupFd, "cgroup.subtree_control", "+cpu +memory +io");
+
+	cgroupState = 1;
+	applyPolicy(shellCgroupFd, &shellPolicy);
+	return shellCgroupFd;
+}
+
+/**************************************************
+Function: applyPolicy
+
+Function takes a cgroup directory and a policy and writes
+each limit the policy sets to cpu.max, memory.max and
+io.weight. A limit whose controller is not enabled for the
+cgroup cannot be applied; that is reported (once per
+limit, not for every job) and the rest still are. Returns
+0, or -1 if any limit was not applied.
+***************************************************/
+
+int applyPolicy(int cgroupFd, struct cgroupPolicy* policy)
+{
+	static bool reported[3] = { false, false, false };
+	char value[64];
+	int result = 0;
+
+	if (policy->cpuQuota != 0)
+	{
+		if (policy->cpuQuota == -1)
+		{
+			snprintf(value, sizeof(value), "max %d", CPU_PERIOD_US);
+		}
+		else
+		{
+			snprintf(value, sizeof(value), "%ld %d", policy->cpuQuota, CPU_PERIOD_US);
+		}
+		if (writeCgroupFile(cgroupFd, "cpu.max", value) == -1)
+		{
+			if (!reported[0])
+			{
+				printf("limit: cpu.max: %s, not applied\n", strerror(errno));
+				reported[0] = true;
+			}
+			result = -1;
+		}
+	}
+	if (policy->memoryMax != 0)
+	{
+		if (policy->memoryMax == -1)
+		{
+			strcpy(value, "max");
+		}
+		else
+		{
+			snprintf(value, sizeof(value), "%lld", policy->memoryMax);
+		}
+		if (writeCgroupFile(cgroupFd, "memory.max", value) == -1)
+		{
+			if (!reported[1])
+			{
+				printf("limit: memory.max: %s, not applied\n", strerror(errno));
+				reported[1] = true;
+			}
+			result = -1;
+		}
+	}
+	if (policy->ioWeight != 0)
+	{
+		snprintf(value, sizeof(value), "default %d", policy->ioWeight == -1 ? 100 : policy->ioWeight);
+		if (writeCgroupFile(cgroupFd, "io.weight", value) == -1)
+		{
+			if (!reported[2])
+			{
+				printf("limit: io.weight: %s, not applied\n", strerror(errno));
+				reported[2] = true;
+			}
+			result = -1;
+		}
+	}
+
+	fflush(stdout);
+	return result;
+}
+
+/**************************************************
+Function: createJobCgroup
+
+Function takes the policy for a new job, creates the job's
+cgroup (job-<n> in the shell's cgroup) with that policy
+applied and returns its directory, storing n in cgroupId.
+Returns -1 when cgroups cannot be used; the job then runs
+in the shell's own cgroup, without limits.
+***************************************************/
+
+int createJobCgroup(struct cgroupPolicy* policy, unsigned int* cgroupId)
+{
+	char jobGroup[32];
+
+	if (openShellCgroup() == -1)
+	{
+		return -1;
+	}
+
+	*cgroupId = ++cgroupSequence;
+	snprintf(jobGroup, sizeof(jobGroup), "job-%u", *cgroupId);
+	if (mkdirat(shellCgroupFd, jobGroup, 0755) == -1)
+	{
+		printf("limit: %s: %s\n", jobGroup, strerror(errno));
+		fflush(stdout);
+		return -1;
+	}
+
+	int cgroupFd = openat(shellCgroupFd, jobGroup, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (cgroupFd == -1)
+	{
+		unlinkat(shellCgroupFd, jobGroup, AT_REMOVEDIR);
+		return -1;
+	}
+	applyPolicy(cgroupFd, policy);
+	return cgroupFd;
+}
+
+/**************************************************
+Function: cgroupLimitHit
+
+Function takes the cgroup of a job that has finished and
+returns the name of the limit that killed any of its
+processes ("memory.max" after an OOM kill), or NULL.
+***************************************************/
+
+const char* cgroupLimitHit(int cgroupFd)
+{
+	char events[512];
+	const char* limitHit = NULL;
+
+	int eventsFd = openat(cgroupFd, "memory.events", O_RDONLY | O_CLOEXEC);
+	if (eventsFd == -1)
+	{
+		return NULL;
+	}
+
+	ssize_t length = read(eventsFd, events, sizeof(events) - 1);
+	close(eventsFd);
+	if (length > 0)
+	{
+		events[length] = '\0';
+		char* oomKill = strstr(events, "oom_kill ");
+		if (oomKill != NULL && atol(oomKill + 9) > 0)
+		{
+			limitHit = "memory.max";
+		}
+	}
+	return limitHit;
+}
+
+/**************************************************
+Function: removeJobCgroup
+
+Function takes the directory and number of a finished
+job's cgroup, closes it and removes it.
+***************************************************/
+
+void removeJobCgroup(int cgroupFd, unsigned int cgroupId)
+{
+	char jobGroup[32];
+
+	close(cgroupFd);
+	snprintf(jobGroup, sizeof(jobGroup), "job-%u", cgroupId);
+	unlinkat(shellCgroupFd, jobGroup, AT_REMOVEDIR);
+}
+
+/**************************************************
+Function: closeShellCgroup
+
+Function removes the shell's cgroup on exit, if one was
+made. Jobs still running keep it (and theirs) alive.
+***************************************************/
+
+void closeShellCgroup(void)
+{
+	char cgroupPath[64];
+	char shellGroup[PATH_MAX];
+
+	if (shellCgroupFd == -1)
+	{
+		return;
+	}
+
+	// the directory's own path, from its descriptor
+	snprintf(cgroupPath, sizeof(cgroupPath), "/proc/self/fd/%d", shellCgroupFd);
+	ssize_t length = readlink(cgroupPath, shellGroup, sizeof(shellGroup) - 1);
+	close(shellCgroupFd);
+	shellCgroupFd = -1;
+	if (length > 0)
+	{
+		shellGroup[length] = '\0';
+		rmdir(shellGroup);
+	}
+}
+
+/**************************************************
+Function: limitProcess
+
+Built-in command limit, when it is given no command to
+limit (limit key=value ... cmd is handled by processInput
+as a prefix). Settings set the default limits of every
+background job; with -s they set the limits of the shell's
+cgroup, shared by all its jobs together. -r clears both.
+With no settings the current limits are shown.
+***************************************************/
+
+void limitProcess(char** arguments)
+{
+	struct cgroupPolicy* policy = &jobPolicy;
+	int i = 1;
+
+	if (arguments[1] != NULL && strcmp(arguments[1], "-r") == 0)
+	{
+		memset(&jobPolicy, 0, sizeof(jobPolicy));
+		memset(&shellPolicy, 0, sizeof(shellPolicy));
+		return;
+	}
+	if (arguments[1] != NULL && strcmp(arguments[1], "-s") == 0)
+	{
+		policy = &shellPolicy;
+		i++;
+	}
+
+	if (arguments[i] == NULL)
+	{
+		struct cgroupPolicy* shown[2] = { &jobPolicy, &shellPolicy };
+		for (int p = 0; p < 2; p++)
+		{
+			char cpuValue[32] = "max";
+			char memoryValue[32] = "max";
+			char ioValue[32] = "default";
+
+			if (shown[p]->cpuQuota > 0)
+			{
+				snprintf(cpuValue, sizeof(cpuValue), "%g", (double)shown[p]->cpuQuota / CPU_PERIOD_US);
+			}
+			if (shown[p]->memoryMax > 0)
+			{
+				snprintf(memoryValue, sizeof(memoryValue), "%lld", shown[p]->memoryMax);
+			}
+			if (shown[p]->ioWeight > 0)
+			{
+				snprintf(ioValue, sizeof(ioValue), "%d", shown[p]->ioWeight);
+			}
+			printf("%s: cpu=%s mem=%s io=%s\n", p == 0 ? "job" : "shell", cpuValue, memoryValue, ioValue);
+		}
+		fflush(stdout);
+		return;
+	}
+
+	struct cgroupPolicy updated = *policy;
+	for (; arguments[i] != NULL; i++)
+	{
+		if (!parseLimit(arguments[i], &updated))
+		{
+			return;
+		}
+	}
+	*policy = updated;
+
+	// apply shell limits now (openShellCgroup applies them when
+	// it makes the shell's cgroup)
+	if (policy == &shellPolicy)
+	{
+		if (cgroupState == 1)
+		{
+			applyPolicy(shellCgroupFd, &shellPolicy);
+		}
+		else
+		{
+			openShellCgroup();
+		}
+	}
+}
+
+/**************************************************
+Function: openPipe
+
+Function creates a pipe for joining two pipeline stages.
+Both ends are O_CLOEXEC, so each child keeps only the end
+its file actions dup2 onto stdin/stdout. If SMALLSH_PIPE_SZ
+was set the pipe buffer is resized with F_SETPIPE_SZ (the
+kernel rounds up to a power-of-two number of pages and caps
+unprivileged callers at /proc/sys/fs/pipe-max-size; a
+refused resize keeps the default 64 KB buffer).
+
+Returns 0 on success or -1 if the pipe could not be created.
+***************************************************/
+
+int openPipe(int pipeFds[2])
+{
+	if (pipe2(pipeFds, O_CLOEXEC) == -1)
+	{
+		perror("pipe()");
+		fflush(stdout);
+		return -1;
+	}
+
+	if (pipeBufferSize > 0)
+	{
+		fcntl(pipeFds[1], F_SETPIPE_SZ, pipeBufferSize);
+	}
+	return 0;
+}
+
+/**************************************************
+Function: executeAsChild
+
+Function takes parameters relevant to execution of a 
+child process and exectutes the given command as a child 
+process, instead of as a built in command. Updates
+status code for the executed child process.
+
+A command with a "limit" prefix, and every background job
+while limit has set job or shell limits, runs in a cgroup
+of its own (createJobCgroup) on the fork path; a limit
+that killed it is reported and kept for status.
+
+A command with a timeout (its prefix, or the default set
+with timeout -a) is sent SIGTERM when it runs out of time,
+then SIGKILL after the grace period. A foreground one is
+waited for by waitTimeout on its own timerfd; a background
+job's deadline goes on the shared job timer.
+
+Every stage is reaped with wait4. With the time prefix (or
+always-on timing) a foreground command's summed resource
+usage is printed when it finishes; a background one's is
+added to its "is done" message.
+
+The stages of a background job share a process group of
+their own; so do a foreground job's under job control,
+and that group has the terminal until the job ends or is
+stopped. A stopped foreground job is kept in the job table
+like a background one, for fg and bg.
+
+Each stage of a pipeline is started with spawnCommand
+(posix_spawn) unless spawnNeedsFork says the stage needs
+the forkCommand path. All stages are started before the
+shell waits on any of them, joined by pipes. A file
+redirected into the first stage or out of the last one is
+handed to that stage as the descriptor itself, so no data
+passes through the shell. The status of a pipeline is the
+status of its last stage. A stage with several output
+targets writes into a pipe drained by fan-out processes
+(startFanOut), which are waited on, or tracked with the job,
+along with the stages.
+
+Parameters are:
+1) pointer to populated command struct
+2) int pointer representing status of a child process
+3) int pointer representing last foreground process ID
+4) pointer to the background job table
+5) sigaction struc that is loaded with handler function for
+SIGTSTP
+
+References:
+Based directly on models in Course Module 4 on Process API and
+Module 5 Signal Handling API:
+https://canvas.oregonstate.edu/courses/1830250/pages/
+exploration-process-api-executing-a-new-program?module_item_id=21468874
+
+https://canvas.oregonstate.edu/courses/1830250/pages/
+exploration-signal-handling-api?module_item_id=21468881
+***************************************************/
+
+void executeAsChild(commandStruct* currentCmdStruct, int* statusCode, int* lastForegroundPid, struct jobTable* jobs, struct sigaction SIGTSTP_action)
+
+{
+	int childStatus;
+	int sourceFd;
+	int targetFd;
+	int pipeFds[2];
+	int nextInFd = -1;     // read end of the pipe from the previous stage
+	int stageCount = 0;
+	int stage = 0;
+	pid_t spawnPid;
+	pid_t* stagePids;
+	pid_t* pumpPids;
+	int pumpCount = 0;
+	int outputTotal = 0;
+	commandStruct* currentStage;
+	bool background;
+	struct timespec started;
+	struct rusage stageUsage;
+	struct rusage totalUsage = { { 0 } };
+	int cgroupFd = -1;
+	unsigned int cgroupId = 0;
+	pid_t jobGroup = 0;    // the job's process group, once its first process starts
+	pid_t reportPid = -1;
+	int stoppedStage = -1;
+	int timerFd = -1;
+	int timeoutSignals = 0;   // SIGTERM, then SIGKILL, sent for the timeout
+	
+	// if Foreground Only Mode is on, child processes cannot run in background
+	if (foregroundOnlyMode)
+	{
+		for (currentStage = currentCmdStruct; currentStage != NULL; currentStage = currentStage->nextStage)
+		{
+			currentStage->bkgrdInd = false;
+		}
+	}
+	background = currentCmdStruct->bkgrdInd;
+
+	// background jobs always get a process group of their own;
+	// foreground ones when they take the terminal in turn
+	bool grouped = background || jobControl;
+
+	for (currentStage = currentCmdStruct; currentStage != NULL; currentStage = currentStage->nextStage)
+	{
+		stageCount++;
+		outputTotal += (currentStage->outputCount > 1) ? currentStage->outputCount : 0;
+	}
+	stagePids = malloc(stageCount * sizeof(pid_t));
+	pumpPids = malloc((outputTotal + 1) * sizeof(pid_t));
+	clock_gettime(CLOCK_MONOTONIC, &started);
+
+	// a "limit" prefix, or limits set for background jobs, put
+	// the whole pipeline in a cgroup of its own
+	struct cgroupPolicy* policy = currentCmdStruct->policy;
+	if (policy == NULL && background && (policySet(&jobPolicy) || policySet(&shellPolicy)))
+	{
+		policy = &jobPolicy;
+	}
+	if (policy != NULL)
+	{
+		cgroupFd = createJobCgroup(policy, &cgroupId);
+	}
+
+	// a timeout prefix, or the shell's default; a foreground
+	// command's runs on a timerfd of its own (see waitTimeout)
+	long long timeoutMs = (currentCmdStruct->timeoutMs > 0) ? currentCmdStruct->timeoutMs : defaultTimeoutMs;
+	if (!background && timeoutMs > 0
+		&& (timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) != -1)
+	{
+		startTimer(timerFd, timeoutMs);
+	}
+
+	// start every stage before waiting on any of them
+	for (currentStage = currentCmdStruct; currentStage != NULL; currentStage = currentStage->nextStage, stage++)
+	{
+		bool lastStage = (currentStage->nextStage == NULL);
+		int stageIn = nextInFd;
+		int stageOut = -1;
+
+		stagePids[stage] = -1;
+		nextInFd = -1;
+
+		if (!lastStage && openPipe(pipeFds) == 0)
+		{
+			stageOut = pipeFds[1];
+			nextInFd = pipeFds[0];
+		}
+
+		// a redirect that cannot be opened fails the stage the
+		// same way the child used to: exit value 1
+		int redirected = openRedirects(currentStage, stage == 0, lastStage, &sourceFd, &targetFd);
+		if (redirected == 0 && currentStage->outputCount > 1)
+		{
+			int started = startFanOut(currentStage, &targetFd, &pumpPids[pumpCount]);
+			if (started == -1)
+			{
+				if (sourceFd != -1)
+				{
+					close(sourceFd);
+				}
+				redirected = -1;
+			}
+			else
+			{
+				pumpCount += started;
+			}
+		}
+		if (redirected == -1)
+		{
+			if (lastStage && !background)
+			{
+				*statusCode = W_EXITCODE(1, 0);
+			}
+		}
+		else
+		{
+			// explicit redirects take priority over the pipe
+			if (sourceFd == -1)
+			{
+				sourceFd = stageIn;
+			}
+			if (targetFd == -1)
+			{
+				targetFd = stageOut;
+			}
+
+			long long spawnStart = metricClock();
+			if (cgroupFd != -1 || spawnNeedsFork(currentStage))
+			{
+				spawnPid = forkCommand(currentStage, sourceFd, targetFd, cgroupFd,
+					grouped ? jobGroup : -1, SIGTSTP_action);
+				if (spawnPid == -1)
+				{
+					perror("fork()\n");
+					fflush(stdout);
+					exit(1);
+				}
+			}
+			else
+			{
+				spawnPid = spawnCommand(currentStage, sourceFd, targetFd, grouped ? jobGroup : -1);
+			}
+
+			recordMetric(&metrics.spawnTime, metricClock() - spawnStart);
+			countMetric(spawnPid == -1 ? &metrics.startFailures : &metrics.processesStarted);
+
+			// posix_spawn reports a failed exec to the parent instead of
+			// the child exiting with status 2, so mirror the fork path
+			if (spawnPid == -1)
+			{
+				perror(currentStage->command);
+				fflush(stdout);
+				if (lastStage && !background)
+				{
+					*statusCode = W_EXITCODE(2, 0);
+				}
+			}
+			stagePids[stage] = spawnPid;
+			if (grouped && jobGroup == 0 && spawnPid != -1)
+			{
+				jobGroup = spawnPid;
+				if (jobControl && !background)
+				{
+					tcsetpgrp(terminalFd, jobGroup);
+				}
+			}
+
+			// the child has its own copies of the redirect descriptors
+			if (sourceFd != -1 && sourceFd != stageIn)
+			{
+				close(sourceFd);
+			}
+			if (targetFd != -1 && targetFd != stageOut)
+			{
+				close(targetFd);
+			}
+		}
+
+		if (stageIn != -1)
+		{
+			close(stageIn);
+		}
+		if (stageOut != -1)
+		{
+			close(stageOut);
+		}
+	}
+
+	// The parent process
+
+	// the job is reported under its last stage that started
+	for (stage = 0; stage < stageCount; stage++)
+	{
+		if (stagePids[stage] != -1)
+		{
+			reportPid = stagePids[stage];
+		}
+	}
+
+	//CASE: Child runs in foreground
+	if (!background)
+	{
+		long long waitStart = metricClock();
+
+		//Parent waits while every stage finishes, or until one is stopped
+		for (stage = 0; stage < stageCount; stage++)
+		{
+			if (stagePids[stage] == -1)
+			{
+				continue;
+			}
+			// a background job's deadline may pass while this one runs
+			bool watchTimers = (timerFd != -1 || jobTimerDeadline != 0);
+			if (watchTimers)
+			{
+				spawnPid = waitTimeout(stagePids[stage], &childStatus, &stageUsage, timerFd, &timeoutSignals,
+					grouped ? jobGroup : -1, &stagePids[stage], stageCount - stage, jobs);
+			}
+			// SIGTSTP (foreground-only toggle) interrupts the wait
+			while (!watchTimers && (spawnPid = wait4(stagePids[stage], &childStatus, WUNTRACED, &stageUsage)) == -1
+				&& errno == EINTR)
+			{
+			}
+			if (WIFSTOPPED(childStatus))
+			{
+				stoppedStage = stage;
+				break;
+			}
+			addUsage(&totalUsage, &stageUsage);
+
+			// only the last stage decides the status of the pipeline
+			if (stage < stageCount - 1)
+			{
+				continue;
+			}
+			
+			//statusCode only updates if the child runs as foreground process
+			//updates the external variable -- this supports the status function
+			*statusCode = childStatus;
+
+			//updates the last foreground process, which here is the child
+			*lastForegroundPid = spawnPid;
+
+			// notifies early termination of foreground child process
+			if (childStatus == 2)
+			{
+				printf("terminated by signal %d\n", childStatus);
+				fflush(stdout);
+			}
+		}
+
+		// a stopped pipeline becomes a stopped job, for fg and bg;
+		// its stages still running and its fan-out go with it
+		if (stoppedStage != -1)
+		{
+			int slot = trackJob(jobs, currentCmdStruct, reportPid, &stagePids[stoppedStage],
+				stageCount - stoppedStage, pumpPids, pumpCount);
+			struct jobEntry* job = &jobs->jobs[slot];
+
+			job->pgid = grouped ? jobGroup : -1;
+			job->stopSignal = WSTOPSIG(childStatus);
+			jobs->stoppedCount++;
+			job->started = started;
+			job->usage = totalUsage;
+			job->cgroupFd = cgroupFd;
+			job->cgroupId = cgroupId;
+			job->timedOut = (timeoutSignals > 0);
+			if (timerFd != -1)
+			{
+				// the rest of its time goes on the job timer
+				struct itimerspec remaining;
+				timerfd_gettime(timerFd, &remaining);
+				if (remaining.it_value.tv_sec != 0 || remaining.it_value.tv_nsec != 0)
+				{
+					scheduleTimeout(jobs, slot, metricClock()
+						+ remaining.it_value.tv_sec * 1000000000LL + remaining.it_value.tv_nsec);
+				}
+				close(timerFd);
+			}
+			returnTerminal(job);
+			printJob(jobs, slot, slot);
+
+			*statusCode = W_EXITCODE(128 + job->stopSignal, 0);
+			*lastForegroundPid = reportPid;
+			free(stagePids);
+			free(pumpPids);
+			return;
+		}
+		returnTerminal(NULL);
+
+		lastTimedOut = (timeoutSignals > 0);
+		if (timerFd != -1)
+		{
+			close(timerFd);
+		}
+		if (lastTimedOut)
+		{
+			printf("timed out\n");
+			fflush(stdout);
+		}
+
+		// the fan-out processes finish once the output is written
+		for (int pump = 0; pump < pumpCount; pump++)
+		{
+			if (pumpPids[pump] == -1)
+			{
+				continue;
+			}
+			while (wait4(pumpPids[pump], &childStatus, 0, &stageUsage) == -1 && errno == EINTR)
+			{
+			}
+			addUsage(&totalUsage, &stageUsage);
+		}
+
+		recordMetric(&metrics.foregroundWait, metricClock() - waitStart);
+
+		// report a cgroup limit that killed the command (see status)
+		lastLimitHit = NULL;
+		if (cgroupFd != -1)
+		{
+			lastLimitHit = cgroupLimitHit(cgroupFd);
+			removeJobCgroup(cgroupFd, cgroupId);
+			if (lastLimitHit != NULL)
+			{
+				printf("killed by %s limit\n", lastLimitHit);
+				fflush(stdout);
+			}
+		}
+
+		if (currentCmdStruct->timed)
+		{
+			char usageString[USAGE_STRING_LENGTH];
+			formatUsage(usageString, &started, &totalUsage);
+			printf("%s\n", usageString);
+			fflush(stdout);
+		}
+	}
+	//CASE: Child runs in background
+	else
+	{
+		if (reportPid != -1)
+		{
+			printf("background pid is %d \n", reportPid);
+			fflush(stdout);
+			setBackgroundVariable(reportPid);
+
+			//track every stage under one job in the background job table
+			int slot = trackJob(jobs, currentCmdStruct, reportPid, stagePids, stageCount, pumpPids, pumpCount);
+			jobs->jobs[slot].pgid = jobGroup;
+			if (timeoutMs > 0)
+			{
+				scheduleTimeout(jobs, slot, started.tv_sec * 1000000000LL + started.tv_nsec + timeoutMs * 1000000LL);
+			}
+			jobs->jobs[slot].cgroupFd = cgroupFd;
+			jobs->jobs[slot].cgroupId = cgroupId;
+		}
+		else
+		{
+			if (cgroupFd != -1)
+			{
+				removeJobCgroup(cgroupFd, cgroupId);
+			}
+			// nothing will write to the fan-out processes: they end now
+			for (int pump = 0; pump < pumpCount; pump++)
+			{
+				if (pumpPids[pump] != -1)
+				{
+					waitpid(pumpPids[pump], NULL, 0);
+				}
+			}
+		}
+		
+		//updates last foreground process, which here is the parent
+		*lastForegroundPid = getpid();
+	}
+
+	free(stagePids);
+	free(pumpPids);
+}
+
+/**************************************************
+Function: metricClock
+
+Function returns the time on the monotonic clock in
+nanoseconds, for the metrics.
+***************************************************/
+
+long long metricClock(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**************************************************
+Function: countMetric
+
+Function takes a pointer to a counter of the metrics struct
+and adds one to it.
+***************************************************/
+
+void countMetric(unsigned long* counter)
+{
+	__atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+}
+
+/**************************************************
+Function: recordMetric
+
+Function takes a histogram and a duration in nanoseconds
+and records the duration in the smallest bucket that holds
+it (bucket i holds up to 2^i microseconds).
+***************************************************/
+
+void recordMetric(struct metricHistogram* histogram, long long elapsed)
+{
+	if (elapsed < 0)
+	{
+		elapsed = 0;
+	}
+
+	// round up to whole microseconds, then take the log2 ceiling
+	unsigned long long micros = (elapsed + 999) / 1000;
+	int bucket = (micros <= 1) ? 0 : 64 - __builtin_clzll(micros - 1);
+	if (bucket > METRIC_BUCKETS - 1)
+	{
+		bucket = METRIC_BUCKETS - 1;
+	}
+
+	__atomic_fetch_add(&histogram->buckets[bucket], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&histogram->sum, (unsigned long)elapsed, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+}
+
+/**************************************************
+Function: setupMetrics
+
+Function starts the periodic metrics dump when
+SMALLSH_METRICS names a file: a timerfd that fires every
+METRICS_INTERVAL_S seconds (SMALLSH_METRICS_INTERVAL
+overrides it) is added to the event loop.
+***************************************************/
+
+void setupMetrics(void)
+{
+	struct epoll_event event = { 0 };
+	struct itimerspec interval = { { 0 } };
+
+	if (metricsPath == NULL)
+	{
+		return;
+	}
+
+	metricsTimerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if (metricsTimerFd == -1)
+	{
+		perror("timerfd_create()");
+		fflush(stdout);
+		return;
+	}
+
+	char* intervalValue = getenv("SMALLSH_METRICS_INTERVAL");
+	interval.it_interval.tv_sec = (intervalValue != NULL && atoi(intervalValue) > 0) ? atoi(intervalValue) : METRICS_INTERVAL_S;
+	interval.it_value = interval.it_interval;
+	timerfd_settime(metricsTimerFd, 0, &interval, NULL);
+
+	if (eventPollFd != -1)
+	{
+		event.events = EPOLLIN;
+		event.data.fd = metricsTimerFd;
+		epoll_ctl(eventPollFd, EPOLL_CTL_ADD, metricsTimerFd, &event);
+	}
+}
+
+/**************************************************
+Function: writeHistogram
+
+Function writes one histogram in the Prometheus text
+format: cumulative buckets with "le" bounds in seconds,
+then _sum (seconds) and _count.
+***************************************************/
+
+static void writeHistogram(FILE* output, const char* name, const char* help, struct metricHistogram* histogram)
+{
+	unsigned long cumulative = 0;
+	int i;
+
+	fprintf(output, "# HELP %s %s\n# TYPE %s histogram\n", name, help, name);
+	for (i = 0; i < METRIC_BUCKETS - 1; i++)
+	{
+		cumulative += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+		fprintf(output, "%s_bucket{le=\"%g\"} %lu\n", name, (double)(1UL << i) / 1e6, cumulative);
+	}
+	cumulative += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+	fprintf(output, "%s_bucket{le=\"+Inf\"} %lu\n", name, cumulative);
+	fprintf(output, "%s_sum %.9f\n", name, __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED) / 1e9);
+	fprintf(output, "%s_count %lu\n", name, __atomic_load_n(&histogram->count, __ATOMIC_RELAXED));
+}
+
+/**************************************************
+Function: writeCounter
+
+Function writes one counter or gauge in the Prometheus
+text format.
+***************************************************/
+
+static void writeCounter(FILE* output, const char* name, const char* type, const char* help, unsigned long value)
+{
+	fprintf(output, "# HELP %s %s\n# TYPE %s %s\n%s %lu\n", name, help, name, type, name, value);
+}
+
+/**************************************************
+Function: writeMetrics
+
+Function takes an open stream and the background job table
+and writes every metric to the stream in the Prometheus
+text exposition format.
+***************************************************/
+
+void writeMetrics(FILE* output, struct jobTable* jobs)
+{
+	writeCounter(output, "smallsh_lines_parsed_total", "counter",
+		"Command lines parsed.", __atomic_load_n(&metrics.linesParsed, __ATOMIC_RELAXED));
+	writeCounter(output, "smallsh_processes_started_total", "counter",
+		"Processes started.", __atomic_load_n(&metrics.processesStarted, __ATOMIC_RELAXED));
+	writeCounter(output, "smallsh_process_start_failures_total", "counter",
+		"Processes that failed to start.", __atomic_load_n(&metrics.startFailures, __ATOMIC_RELAXED));
+	writeCounter(output, "smallsh_background_jobs_started_total", "counter",
+		"Background jobs started.", __atomic_load_n(&metrics.jobsStarted, __ATOMIC_RELAXED));
+	writeCounter(output, "smallsh_background_jobs_finished_total", "counter",
+		"Background jobs finished.", __atomic_load_n(&metrics.jobsFinished, __ATOMIC_RELAXED));
+	writeCounter(output, "smallsh_background_jobs", "gauge",
+		"Background jobs still running.", (unsigned long)jobs->jobCount);
+
+	writeHistogram(output, "smallsh_parse_seconds",
+		"Time to parse a command line.", &metrics.parseTime);
+	writeHistogram(output, "smallsh_spawn_seconds",
+		"Time to start a process.", &metrics.spawnTime);
+	writeHistogram(output, "smallsh_foreground_wait_seconds",
+		"Time spent waiting on a foreground command.", &metrics.foregroundWait);
+	writeHistogram(output, "smallsh_background_job_seconds",
+		"Lifetime of a background job.", &metrics.jobLifetime);
+}
+
+/**************************************************
+Function: dumpMetrics
+
+Function takes the background job table and writes the
+metrics to the SMALLSH_METRICS file. They are written to
+a temporary file next to it that is then renamed over it,
+so a collector reading the file never sees half of a dump.
+***************************************************/
+
+void dumpMetrics(struct jobTable* jobs)
+{
+	char tempPath[PATH_MAX];
+
+	snprintf(tempPath, sizeof(tempPath), "%s.%d.tmp", metricsPath, (int)getpid());
+
+	int tempFd = open(tempPath, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (tempFd == -1)
+	{
+		perror(tempPath);
+		fflush(stdout);
+		return;
+	}
+
+	FILE* output = fdopen(tempFd, "w");
+	writeMetrics(output, jobs);
+	if (fclose(output) != 0 || rename(tempPath, metricsPath) == -1)
+	{
+		perror(metricsPath);
+		fflush(stdout);
+		unlink(tempPath);
+	}
+}
+
+/**************************************************
+Function: checkMetricsTimer
+
+Function takes the background job table and dumps the
+metrics if the dump timer has fired since the last check.
+Called from the event loop while the shell waits for input,
+and after every command for input that is never waited on
+(a mapped script).
+***************************************************/
+
+void checkMetricsTimer(struct jobTable* jobs)
+{
+	uint64_t expirations;
+
+	if (metricsTimerFd != -1 && read(metricsTimerFd, &expirations, sizeof(expirations)) > 0)
+	{
+		dumpMetrics(jobs);
+	}
+}
+
+/**************************************************
+Function: metricsProcess
+
+Built-in command metrics. Dumps the metrics to the
+SMALLSH_METRICS file right away, or prints them when no
+file is set.
+***************************************************/
+
+void metricsProcess(struct jobTable* jobs)
+{
+	if (metricsPath != NULL)
+	{
+		dumpMetrics(jobs);
+		return;
+	}
+
+	writeMetrics(stdout, jobs);
+	fflush(stdout);
+}
+
+/**************************************************
+Function: putFrameHeader, getFrameHeader
+
+Functions write and read the SERVE_HEADER_SIZE byte header
+of a server frame: the frame type, then the request id and
+the length of the payload that follows, both 32-bit
+big-endian.
+***************************************************/
+
+static void putFrameHeader(char* header, char type, uint32_t id, uint32_t length)
+{
+	uint32_t fields[2] = { htonl(id), htonl(length) };
+
+	header[0] = type;
+	memcpy(&header[1], fields, sizeof(fields));
+}
+
+static void getFrameHeader(const char* header, char* type, uint32_t* id, uint32_t* length)
+{
+	uint32_t fields[2];
+
+	memcpy(fields, &header[1], sizeof(fields));
+	*type = header[0];
+	*id = ntohl(fields[0]);
+	*length = ntohl(fields[1]);
+}
+
+/**************************************************
+Function: reserveOutput
+
+Function takes a client and a size and returns where size
+more bytes of output for it can be put, after dropping the
+output already sent and growing the buffer as needed. The
+caller adds what it puts there to outputLength.
+***************************************************/
+
+static char* reserveOutput(struct serveClient* client, size_t size)
+{
+	if (client->outputSent > 0)
+	{
+		memmove(client->output, client->output + client->outputSent, client->outputLength - client->outputSent);
+		client->outputLength -= client->outputSent;
+		client->outputSent = 0;
+	}
+	while (client->outputCapacity - client->outputLength < size)
+	{
+		client->outputCapacity = (client->outputCapacity == 0) ? INPUT_CHUNK_SIZE * 2 : client->outputCapacity * 2;
+		client->output = realloc(client->output, client->outputCapacity);
+	}
+	return client->output + client->outputLength;
+}
+
+/**************************************************
+Function: watchClient
+
+Function takes the index of a client and sets what the
+server's epoll waits for on it: more requests until it has
+shut down its side, and room to write while output is
+waiting. A client that went away is no longer watched.
+***************************************************/
+
+static void watchClient(int index)
+{
+	struct serveClient* client = &server.clients[index];
+	struct epoll_event event = { 0 };
+
+	if (client->broken)
+	{
+		epoll_ctl(server.pollFd, EPOLL_CTL_DEL, client->fd, NULL);
+		return;
+	}
+	event.events = (client->readClosed ? 0 : EPOLLIN) | (client->writeWaiting ? EPOLLOUT : 0);
+	event.data.u64 = SERVE_EVENT(SERVE_CLIENT, index);
+	epoll_ctl(server.pollFd, EPOLL_CTL_MOD, client->fd, &event);
+}
+
+/**************************************************
+Function: flushClient
+
+Function takes the index of a client and sends it as much
+of its waiting output as the socket takes without blocking,
+watching for room when some is left. Workers held back for
+the client are let go again once it has fallen less than
+SERVE_OUTPUT_LIMIT bytes behind.
+***************************************************/
+
+static void flushClient(int index)
+{
+	struct serveClient* client = &server.clients[index];
+
+	while (!client->broken && client->outputSent < client->outputLength)
+	{
+		ssize_t sent = send(client->fd, client->output + client->outputSent,
+			client->outputLength - client->outputSent, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (sent > 0)
+		{
+			client->outputSent += sent;
+		}
+		else if (sent == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		{
+			break;
+		}
+		else if (sent == -1 && errno != EINTR)
+		{
+			client->broken = true;
+		}
+	}
+	if (client->broken)
+	{
+		client->outputLength = client->outputSent = 0;
+	}
+
+	bool waiting = (client->outputSent < client->outputLength);
+	if (waiting != client->writeWaiting)
+	{
+		client->writeWaiting = waiting;
+		watchClient(index);
+	}
+
+	if (client->outputLength - client->outputSent < SERVE_OUTPUT_LIMIT)
+	{
+		for (int slot = 0; slot < server.limit; slot++)
+		{
+			struct serveRequest* request = server.running[slot];
+			if (request != NULL && request->held && request->client == index)
+			{
+				struct epoll_event event = { 0 };
+				event.events = EPOLLIN;
+				event.data.u64 = SERVE_EVENT(SERVE_OUTPUT, slot);
+				epoll_ctl(server.pollFd, EPOLL_CTL_MOD, request->outputFd, &event);
+				request->held = false;
+			}
+		}
+	}
+}
+
+/**************************************************
+Function: sendFrame
+
+Function takes the index of a client, a frame type, a
+request id and a payload, queues the frame for the client
+and sends what it can right away. Nothing is queued for a
+client that went away.
+***************************************************/
+
+static void sendFrame(int index, char type, uint32_t id, const void* data, size_t length)
+{
+	struct serveClient* client = &server.clients[index];
+
+	if (client->broken)
+	{
+		return;
+	}
+	char* frame = reserveOutput(client, SERVE_HEADER_SIZE + length);
+	putFrameHeader(frame, type, id, length);
+	memcpy(frame + SERVE_HEADER_SIZE, data, length);
+	client->outputLength += SERVE_HEADER_SIZE + length;
+	flushClient(index);
+}
+
+/**************************************************
+Function: closeClient
+
+Function takes the index of a client and closes the
+connection if the client has shut down its side (or went
+away), none of its requests is queued or running, and all
+of its output has been sent. The slot is then free.
+***************************************************/
+
+static void closeClient(int index)
+{
+	struct serveClient* client = &server.clients[index];
+
+	if (client->fd == -1 || !client->readClosed || client->outstanding > 0
+		|| client->outputSent < client->outputLength)
+	{
+		return;
+	}
+	close(client->fd);
+	free(client->input);
+	free(client->output);
+	memset(client, 0, sizeof(struct serveClient));
+	client->fd = -1;
+}
+
+/**************************************************
+Function: dropQueued
+
+Function takes the index of a client, or -1 for every
+client, and removes its requests from the queue without
+running them, answering each with an error frame saying
+why (a client that went away gets nothing).
+***************************************************/
+
+static void dropQueued(int index, const char* reason)
+{
+	struct serveRequest** link = &server.queueHead;
+
+	server.queueTail = NULL;
+	while (*link != NULL)
+	{
+		struct serveRequest* request = *link;
+		if (index == -1 || request->client == index)
+		{
+			*link = request->next;
+			sendFrame(request->client, FRAME_ERROR, request->id, reason, strlen(reason));
+			server.clients[request->client].outstanding--;
+			closeClient(request->client);
+			free(request->line);
+			free(request);
+		}
+		else
+		{
+			server.queueTail = request;
+			link = &request->next;
+		}
+	}
+}
+
+/**************************************************
+Function: queueRequest
+
+Function takes the index of a client and one request frame
+it sent (its type, id and command line) and adds the
+request to the end of the shared queue. A trailing newline
+is dropped from the line.
+***************************************************/
+
+static void queueRequest(int index, char type, uint32_t id, const char* line, size_t length)
+{
+	struct serveRequest* request = calloc(1, sizeof(struct serveRequest));
+
+	if (length > 0 && line[length - 1] == '\n')
+	{
+		length--;
+	}
+	request->client = index;
+	request->id = id;
+	request->capture = (type == FRAME_CAPTURE);
+	request->line = malloc(length + 1);
+	memcpy(request->line, line, length);
+	request->line[length] = '\0';
+	request->outputFd = -1;
+
+	if (server.queueTail != NULL)
+	{
+		server.queueTail->next = request;
+	}
+	else
+	{
+		server.queueHead = request;
+	}
+	server.queueTail = request;
+	server.clients[index].outstanding++;
+}
+
+/**************************************************
+Function: readClient
+
+Function takes the index of a client whose socket is
+readable, reads what it sent and queues every complete
+request frame. A frame that is not a request, or a line
+longer than argMax, is answered with an error and ends the
+client's requests, since the stream cannot be followed past
+it. End of file, or an error, ends them too; a client that
+went away also loses its queued requests.
+***************************************************/
+
+static void readClient(int index)
+{
+	struct serveClient* client = &server.clients[index];
+	size_t used = 0;
+
+	if (client->inputCapacity - client->inputLength < INPUT_CHUNK_SIZE / 4)
+	{
+		client->inputCapacity = (client->inputCapacity == 0) ? INPUT_CHUNK_SIZE : client->inputCapacity * 2;
+		client->input = realloc(client->input, client->inputCapacity);
+	}
+	ssize_t bytesRead = read(client->fd, client->input + client->inputLength,
+		client->inputCapacity - client->inputLength);
+	if (bytesRead == -1 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK))
+	{
+		return;
+	}
+	if (bytesRead <= 0)
+	{
+		client->readClosed = true;
+		client->broken = (bytesRead == -1);
+	}
+	else
+	{
+		client->inputLength += bytesRead;
+	}
+
+	while (!client->readClosed && client->inputLength - used >= SERVE_HEADER_SIZE)
+	{
+		char type;
+		uint32_t id;
+		uint32_t length;
+		getFrameHeader(client->input + used, &type, &id, &length);
+		if ((type != FRAME_RUN && type != FRAME_CAPTURE) || length > (uint32_t)argMax)
+		{
+			sendFrame(index, FRAME_ERROR, id, "bad request", strlen("bad request"));
+			client->readClosed = true;
+			break;
+		}
+		if (client->inputLength - used - SERVE_HEADER_SIZE < length)
+		{
+			break;
+		}
+		queueRequest(index, type, id, client->input + used + SERVE_HEADER_SIZE, length);
+		used += SERVE_HEADER_SIZE + length;
+	}
+	memmove(client->input, client->input + used, client->inputLength - used);
+	client->inputLength -= used;
+
+	if (client->readClosed)
+	{
+		if (client->broken)
+		{
+			dropQueued(index, "");
+		}
+		watchClient(index);
+		closeClient(index);
+	}
+}
+
+/**************************************************
+Function: acceptClients
+
+Function accepts every connection waiting on the listening
+socket, giving each a free client slot (the table doubles
+when none is free) and watching it for requests.
+***************************************************/
+
+static void acceptClients(void)
+{
+	int clientFd;
+
+	while ((clientFd = accept4(server.listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+	{
+		struct epoll_event event = { 0 };
+		int index = 0;
+
+		while (index < server.clientCapacity && server.clients[index].fd != -1)
+		{
+			index++;
+		}
+		if (index == server.clientCapacity)
+		{
+			int capacity = (server.clientCapacity == 0) ? 16 : server.clientCapacity * 2;
+			server.clients = realloc(server.clients, capacity * sizeof(struct serveClient));
+			memset(&server.clients[server.clientCapacity], 0,
+				(capacity - server.clientCapacity) * sizeof(struct serveClient));
+			for (int i = server.clientCapacity; i < capacity; i++)
+			{
+				server.clients[i].fd = -1;
+			}
+			server.clientCapacity = capacity;
+		}
+
+		server.clients[index].fd = clientFd;
+		event.events = EPOLLIN;
+		event.data.u64 = SERVE_EVENT(SERVE_CLIENT, index);
+		epoll_ctl(server.pollFd, EPOLL_CTL_ADD, clientFd, &event);
+	}
+}
+
+/**************************************************
+Function: serveWorker
+
+Function runs one request in a worker process forked from
+the server. Nothing of the server's stays open in it; stdin
+is /dev/null and stdout and stderr go to outFd (the write
+end of the request's output pipe) or to /dev/null, so every
+message the shell prints reaches the client along with the
+command's output. The line goes through processInput and
+runCommandList like a line typed at the prompt, and the
+worker exits with its status.
+***************************************************/
+
+static void serveWorker(struct serveRequest* request, int pipeFds[2], struct shellState* shell)
+{
+	int nullFd = open("/dev/null", O_RDWR);
+
+	close(server.listenFd);
+	close(server.pollFd);
+	close(server.signalFd);
+	for (int i = 0; i < server.clientCapacity; i++)
+	{
+		if (server.clients[i].fd != -1)
+		{
+			close(server.clients[i].fd);
+		}
+	}
+	for (int slot = 0; slot < server.limit; slot++)
+	{
+		if (server.running[slot] != NULL && server.running[slot]->outputFd != -1)
+		{
+			close(server.running[slot]->outputFd);
+		}
+	}
+	sigprocmask(SIG_SETMASK, &server.shellMask, NULL);
+
+	dup2(nullFd, STDIN_FILENO);
+	dup2((pipeFds[1] != -1) ? pipeFds[1] : nullFd, STDOUT_FILENO);
+	dup2(STDOUT_FILENO, STDERR_FILENO);
+	close(nullFd);
+	if (pipeFds[1] != -1)
+	{
+		close(pipeFds[0]);
+		close(pipeFds[1]);
+	}
+	zygoteMode = false;
+	jobControl = false;
+
+	commandStruct* commandLine = processInput(request->line);
+	if (commandLine != NULL && strcmp(commandLine->command, " ") != 0)
+	{
+		runCommandList(commandLine, shell);
+	}
+	fflush(stdout);
+	_exit(lastExitStatus(shell->childStatus));
+}
+
+/**************************************************
+Function: startQueued
+
+Function starts requests from the head of the queue while
+fewer than the limit are running. Each gets a free slot, a
+worker process (see serveWorker) and, when the client asked
+for the output, a pipe the server reads it from. A request
+whose worker cannot be forked is answered with an error.
+***************************************************/
+
+static void startQueued(struct shellState* shell)
+{
+	while (server.queueHead != NULL && server.runningCount < server.limit)
+	{
+		struct serveRequest* request = server.queueHead;
+		int pipeFds[2] = { -1, -1 };
+		int slot = 0;
+
+		server.queueHead = request->next;
+		if (server.queueHead == NULL)
+		{
+			server.queueTail = NULL;
+		}
+		while (server.running[slot] != NULL)
+		{
+			slot++;
+		}
+
+		if (request->capture && pipe2(pipeFds, O_CLOEXEC) == -1)
+		{
+			perror("pipe()");
+		}
+		fflush(stdout);
+		request->pid = fork();
+		if (request->pid == 0)
+		{
+			serveWorker(request, pipeFds, shell);
+		}
+		if (pipeFds[1] != -1)
+		{
+			close(pipeFds[1]);
+		}
+		if (request->pid == -1)
+		{
+			perror("fork()");
+			fflush(stdout);
+			if (pipeFds[0] != -1)
+			{
+				close(pipeFds[0]);
+			}
+			sendFrame(request->client, FRAME_ERROR, request->id, "fork failed", strlen("fork failed"));
+			server.clients[request->client].outstanding--;
+			closeClient(request->client);
+			free(request->line);
+			free(request);
+			continue;
+		}
+
+		request->outputFd = pipeFds[0];
+		if (request->outputFd != -1)
+		{
+			struct epoll_event event = { 0 };
+			fcntl(request->outputFd, F_SETFL, O_NONBLOCK);
+			event.events = EPOLLIN;
+			event.data.u64 = SERVE_EVENT(SERVE_OUTPUT, slot);
+			epoll_ctl(server.pollFd, EPOLL_CTL_ADD, request->outputFd, &event);
+		}
+		server.running[slot] = request;
+		server.runningCount++;
+	}
+}
+
+/**************************************************
+Function: finishRequest
+
+Function takes a worker slot and, once its worker has
+exited and its output has ended, answers the request with
+its status (32-bit big-endian, as $? would show it) and
+frees the slot.
+***************************************************/
+
+static void finishRequest(int slot)
+{
+	struct serveRequest* request = server.running[slot];
+
+	if (!request->exited || request->outputFd != -1)
+	{
+		return;
+	}
+	uint32_t status = htonl(request->status);
+	sendFrame(request->client, FRAME_STATUS, request->id, &status, sizeof(status));
+	server.clients[request->client].outstanding--;
+	closeClient(request->client);
+
+	server.running[slot] = NULL;
+	server.runningCount--;
+	free(request->line);
+	free(request);
+}
+
+/**************************************************
+Function: readOutput
+
+Function takes a worker slot whose output pipe is readable
+and sends what it reads to the client as one output frame,
+read straight into the client's buffer after room for the
+header. While the client is SERVE_OUTPUT_LIMIT bytes or
+more behind, the pipe is held instead (the worker blocks on
+it) until flushClient lets it go. At the end of the output
+the request may be finished.
+***************************************************/
+
+static void readOutput(int slot)
+{
+	struct serveRequest* request = server.running[slot];
+	struct serveClient* client = &server.clients[request->client];
+
+	if (client->outputLength - client->outputSent >= SERVE_OUTPUT_LIMIT)
+	{
+		struct epoll_event event = { 0 };
+		event.data.u64 = SERVE_EVENT(SERVE_OUTPUT, slot);
+		epoll_ctl(server.pollFd, EPOLL_CTL_MOD, request->outputFd, &event);
+		request->held = true;
+		return;
+	}
+
+	char* frame = reserveOutput(client, SERVE_HEADER_SIZE + INPUT_CHUNK_SIZE);
+	ssize_t bytesRead = read(request->outputFd, frame + SERVE_HEADER_SIZE, INPUT_CHUNK_SIZE);
+	if (bytesRead > 0)
+	{
+		if (!client->broken)
+		{
+			putFrameHeader(frame, FRAME_OUTPUT, request->id, bytesRead);
+			client->outputLength += SERVE_HEADER_SIZE + bytesRead;
+			flushClient(request->client);
+		}
+		return;
+	}
+	if (bytesRead == -1 && (errno == EINTR || errno == EAGAIN))
+	{
+		return;
+	}
+	close(request->outputFd);
+	request->outputFd = -1;
+	finishRequest(slot);
+}
+
+/**************************************************
+Function: reapWorkers
+
+Function drains the server's signalfd and reaps every
+worker that has exited, finishing its request. SIGTERM
+stops the server: the listening socket is closed and
+removed, queued requests are answered with an error, no
+more requests are read, and the server exits once the
+running ones are answered.
+***************************************************/
+
+static void reapWorkers(void)
+{
+	struct signalfd_siginfo info;
+	pid_t processId;
+	int status;
+
+	while (read(server.signalFd, &info, sizeof(info)) == sizeof(info))
+	{
+		if (info.ssi_signo == SIGTERM && !server.stopping)
+		{
+			server.stopping = true;
+			close(server.listenFd);
+			server.listenFd = -1;
+			unlink(server.path);
+			dropQueued(-1, "server stopping");
+			for (int i = 0; i < server.clientCapacity; i++)
+			{
+				if (server.clients[i].fd != -1)
+				{
+					server.clients[i].readClosed = true;
+					watchClient(i);
+					closeClient(i);
+				}
+			}
+		}
+	}
+
+	while ((processId = waitpid(-1, &status, WNOHANG)) > 0)
+	{
+		for (int slot = 0; slot < server.limit; slot++)
+		{
+			struct serveRequest* request = server.running[slot];
+			if (request != NULL && request->pid == processId)
+			{
+				request->exited = true;
+				request->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+				finishRequest(slot);
+				break;
+			}
+		}
+	}
+}
+
+/**************************************************
+Function: serveClients
+
+Function runs the shell as a server (smallsh --serve PATH
+[jobs]): it listens on the UNIX domain socket PATH and runs
+the command lines clients send, at most limit at a time
+(default: the number of CPUs), taking them from one queue
+in the order they arrived. A socket file left by a server
+that is gone is replaced.
+
+The protocol is framed both ways. Each frame is a
+SERVE_HEADER_SIZE byte header (see putFrameHeader) and a
+payload. A client sends FRAME_RUN or FRAME_CAPTURE frames,
+each a command line with an id of its choice, and shuts
+down its side when it has no more; they may run
+concurrently. The server answers each with FRAME_OUTPUT
+frames carrying the output (FRAME_CAPTURE only, as it is
+produced, stdout and stderr together), then one
+FRAME_STATUS frame, or with a FRAME_ERROR frame when it
+cannot run it.
+
+Each line runs in a worker forked from the server (see
+serveWorker), so it goes through processInput and
+executeAsChild like a line at the prompt, with the server's
+settings, but what it changes (cd, variables, ...) is gone
+with the worker. Returns the exit status for main.
+***************************************************/
+
+int serveClients(const char* path, int limit, struct shellState* shell)
+{
+	struct sockaddr_un address = { 0 };
+	struct epoll_event event = { 0 };
+	struct epoll_event events[MAX_EVENTS];
+	sigset_t serverSignals;
+
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		printf("%s: socket path too long\n", path);
+		fflush(stdout);
+		return 1;
+	}
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	server.listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	bool bound = (bind(server.listenFd, (struct sockaddr*)&address, sizeof(address)) == 0);
+	if (!bound && errno == EADDRINUSE)
+	{
+		// nothing answering on it: a server that is gone left it
+		int probeFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (connect(probeFd, (struct sockaddr*)&address, sizeof(address)) == -1 && errno == ECONNREFUSED)
+		{
+			unlink(path);
+			bound = (bind(server.listenFd, (struct sockaddr*)&address, sizeof(address)) == 0);
+		}
+		else
+		{
+			errno = EADDRINUSE;
+		}
+		close(probeFd);
+	}
+	if (!bound || listen(server.listenFd, SOMAXCONN) == -1)
+	{
+		perror(path);
+		fflush(stdout);
+		return 1;
+	}
+
+	sigemptyset(&serverSignals);
+	sigaddset(&serverSignals, SIGCHLD);
+	sigaddset(&serverSignals, SIGTERM);
+	sigprocmask(SIG_BLOCK, &serverSignals, &server.shellMask);
+	server.signalFd = signalfd(-1, &serverSignals, SFD_NONBLOCK | SFD_CLOEXEC);
+	server.pollFd = epoll_create1(EPOLL_CLOEXEC);
+	if (server.signalFd == -1 || server.pollFd == -1)
+	{
+		perror("epoll_create1()");
+		fflush(stdout);
+		unlink(path);
+		return 1;
+	}
+	event.events = EPOLLIN;
+	event.data.u64 = SERVE_EVENT(SERVE_LISTEN, 0);
+	epoll_ctl(server.pollFd, EPOLL_CTL_ADD, server.listenFd, &event);
+	event.data.u64 = SERVE_EVENT(SERVE_SIGNAL, 0);
+	epoll_ctl(server.pollFd, EPOLL_CTL_ADD, server.signalFd, &event);
+
+	server.path = path;
+	server.limit = (limit > 0) ? limit : (int)sysconf(_SC_NPROCESSORS_ONLN);
+	if (server.limit < 1)
+	{
+		server.limit = 1;
+	}
+	server.running = calloc(server.limit, sizeof(struct serveRequest*));
+	printf("serving on %s, %d commands at a time\n", path, server.limit);
+	fflush(stdout);
+
+	while (!server.stopping || server.runningCount > 0)
+	{
+		int ready = epoll_wait(server.pollFd, events, MAX_EVENTS, -1);
+		if (ready == -1 && errno != EINTR)
+		{
+			perror("epoll_wait()");
+			fflush(stdout);
+			break;
+		}
+		for (int i = 0; i < ready; i++)
+		{
+			int kind = (int)(events[i].data.u64 >> 32);
+			int index = (int)(uint32_t)events[i].data.u64;
+
+			if (kind == SERVE_LISTEN && server.listenFd != -1)
+			{
+				acceptClients();
+			}
+			else if (kind == SERVE_SIGNAL)
+			{
+				reapWorkers();
+			}
+			else if (kind == SERVE_OUTPUT && server.running[index] != NULL
+				&& server.running[index]->outputFd != -1)
+			{
+				readOutput(index);
+			}
+			else if (kind == SERVE_CLIENT && server.clients[index].fd != -1)
+			{
+				if (!server.clients[index].readClosed && (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+				{
+					readClient(index);
+				}
+				else if (events[i].events & (EPOLLHUP | EPOLLERR))
+				{
+					// gone before its answers were sent
+					server.clients[index].broken = true;
+					watchClient(index);
+					dropQueued(index, "");
+				}
+				if (server.clients[index].fd != -1)
+				{
+					flushClient(index);
+					closeClient(index);
+				}
+			}
+		}
+		startQueued(shell);
+	}
+
+	for (int i = 0; i < server.clientCapacity; i++)
+	{
+		if (server.clients[i].fd != -1)
+		{
+			close(server.clients[i].fd);
+			free(server.clients[i].input);
+			free(server.clients[i].output);
+		}
+	}
+	if (server.listenFd != -1)
+	{
+		close(server.listenFd);
+		unlink(path);
+	}
+	close(server.pollFd);
+	close(server.signalFd);
+	free(server.clients);
+	free(server.running);
+	sigprocmask(SIG_SETMASK, &server.shellMask, NULL);
+	return 0;
+}
+
+/**************************************************
+Function: connectServer, writeFull, readFull
+
+Client side of the server protocol: connectServer returns a
+socket connected to the server at path, or -1; writeFull
+and readFull move exactly length bytes, returning false on
+an error or (readFull) end of file.
+***************************************************/
+
+int connectServer(const char* path)
+{
+	struct sockaddr_un address = { 0 };
+	int socketFd;
+
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	address.sun_family = AF_UNIX;
+	strcpy(address.sun_path, path);
+
+	socketFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (socketFd != -1 && connect(socketFd, (struct sockaddr*)&address, sizeof(address)) == -1)
+	{
+		close(socketFd);
+		return -1;
+	}
+	return socketFd;
+}
+
+static bool writeFull(int fd, const char* data, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t written = send(fd, data, length, MSG_NOSIGNAL);
+		if (written == -1 && errno != EINTR)
+		{
+			return false;
+		}
+		if (written > 0)
+		{
+			data += written;
+			length -= written;
+		}
+	}
+	return true;
+}
+
+static bool readFull(int fd, char* data, size_t length)
+{
+	while (length > 0)
+	{
+		ssize_t bytesRead = read(fd, data, length);
+		if (bytesRead == 0 || (bytesRead == -1 && errno != EINTR))
+		{
+			return false;
+		}
+		if (bytesRead > 0)
+		{
+			data += bytesRead;
+			length -= bytesRead;
+		}
+	}
+	return true;
+}
+
+/**************************************************
+Function: runClient
+
+Test client for the server (smallsh --client PATH [-o]):
+sends every line of stdin as a request, its id the line
+number, with -o asking for the output, then prints the
+answers as they come: the output as it is, and one
+"[id] exit value N" (or "[id] error: ...") line per request.
+Returns the status of the last line (1 for an error), or 1
+if the server cannot be reached.
+***************************************************/
+
+int runClient(const char* path, bool capture)
+{
+	char header[SERVE_HEADER_SIZE];
+	char* line = NULL;
+	size_t lineCapacity = 0;
+	ssize_t lineLength;
+	uint32_t sent = 0;
+	uint32_t lastId = 0;
+	int lastStatus = 0;
+
+	int socketFd = connectServer(path);
+	if (socketFd == -1)
+	{
+		perror(path);
+		fflush(stdout);
+		return 1;
+	}
+
+	while ((lineLength = getline(&line, &lineCapacity, stdin)) != -1)
+	{
+		putFrameHeader(header, capture ? FRAME_CAPTURE : FRAME_RUN, ++sent, lineLength);
+		if (!writeFull(socketFd, header, SERVE_HEADER_SIZE) || !writeFull(socketFd, line, lineLength))
+		{
+			perror(path);
+			break;
+		}
+	}
+	shutdown(socketFd, SHUT_WR);
+
+	while (readFull(socketFd, header, SERVE_HEADER_SIZE))
+	{
+		char type;
+		uint32_t id;
+		uint32_t length;
+		getFrameHeader(header, &type, &id, &length);
+		if (length + 1 > lineCapacity)
+		{
+			lineCapacity = length + 1;
+			line = realloc(line, lineCapacity);
+		}
+		if (!readFull(socketFd, line, length))
+		{
+			break;
+		}
+
+		if (type == FRAME_OUTPUT)
+		{
+			fwrite(line, 1, length, stdout);
+		}
+		else if (type == FRAME_STATUS && length == sizeof(uint32_t))
+		{
+			uint32_t status;
+			memcpy(&status, line, sizeof(status));
+			printf("[%u] exit value %d\n", id, (int)ntohl(status));
+			if (id >= lastId)
+			{
+				lastId = id;
+				lastStatus = (int)ntohl(status);
+			}
+		}
+		else if (type == FRAME_ERROR)
+		{
+			printf("[%u] error: %.*s\n", id, (int)length, line);
+			if (id >= lastId)
+			{
+				lastId = id;
+				lastStatus = 1;
+			}
+		}
+	}
+	fflush(stdout);
+
+	free(line);
+	close(socketFd);
+	return lastStatus;
+}
+
+/**************************************************
+Function: benchClock
+
+Function returns the time on the monotonic clock in
+nanoseconds, for the benchmark suite.
+***************************************************/
+
+static long long benchClock(void)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (long long)now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+/**************************************************
+Function: benchReport
+
+Function writes one benchmark result as a JSON line: the
+benchmark name, how many operations were timed, nanoseconds
+per operation, operations per second and, when bytes is
+not zero, the input throughput in MB/s.
+***************************************************/
+
+static void benchReport(FILE* results, const char* name, long operations, long long elapsed, size_t bytes)
+{
+	double perOp = (double)elapsed / operations;
+
+	fprintf(results, "{\"bench\": \"%s\", \"ops\": %ld, \"ns_per_op\": %.1f, \"ops_per_sec\": %.1f",
+		name, operations, perOp, 1e9 / perOp);
+	if (bytes > 0)
+	{
+		fprintf(results, ", \"mb_per_sec\": %.1f", (double)bytes * operations / elapsed * 1e3);
+	}
+	fprintf(results, "}\n");
+	fflush(results);
+}
+
+/**************************************************
+Function: benchParse
+
+Function times lexInput on its own and the whole of
+processInput (lexing, $$ expansion and building the
+commandStruct, then freeCommandLine) on one corpus line, and
+reports both. Each iteration copies the line first because
+lexing terminates tokens in place.
+***************************************************/
+
+static void benchParse(FILE* results, const char* corpus, const char* line, int iterations)
+{
+	char name[64];
+	size_t length = strlen(line);
+	char* copy = malloc(length + 1);
+	struct lexToken* tokens = malloc(tokenCapacity(line) * sizeof(struct lexToken));
+	long long start;
+	int i;
+
+	start = benchClock();
+	for (i = 0; i < iterations; i++)
+	{
+		memcpy(copy, line, length + 1);
+		lexInput(copy, tokens);
+		freeCommandLine();
+	}
+	snprintf(name, sizeof(name), "lex_%s", corpus);
+	benchReport(results, name, iterations, benchClock() - start, length);
+
+	start = benchClock();
+	for (i = 0; i < iterations; i++)
+	{
+		memcpy(copy, line, length + 1);
+		processInput(copy);
+		freeCommandLine();
+	}
+	snprintf(name, sizeof(name), "parse_%s", corpus);
+	benchReport(results, name, iterations, benchClock() - start, length);
+
+	free(tokens);
+	free(copy);
+}
+
+/**************************************************
+Function: benchLine
+
+Function builds a benchmark corpus line in buffer by
+repeating pattern until the line is as close to length
+bytes as whole patterns allow, after a leading command word.
+***************************************************/
+
+static void benchLine(char* buffer, const char* command, const char* pattern, size_t length)
+{
+	size_t used = strlen(command);
+	size_t patternLength = strlen(pattern);
+
+	memcpy(buffer, command, used);
+	while (used + patternLength + 1 < length)
+	{
+		memcpy(&buffer[used], pattern, patternLength);
+		used += patternLength;
+	}
+	buffer[used++] = '\n';
+	buffer[used] = '\0';
+}
+
+/**************************************************
+Function: benchReap
+
+Function starts count background /bin/true jobs through
+executeAsChild, then sleeps in epoll_wait and reaps them
+with processCheck the way the prompt does, and reports the
+time from the last spawn until every job was reported.
+***************************************************/
+
+static void benchReap(FILE* results, int count, struct jobTable* jobs, int* statusCode, int* lastForegroundPid, struct sigaction SIGTSTP_action)
+{
+	char name[64];
+	char line[64];
+	struct epoll_event events[MAX_EVENTS];
+	int i;
+
+	for (i = 0; i < count; i++)
+	{
+		strcpy(line, "/bin/true &\n");
+		executeAsChild(processInput(line), statusCode, lastForegroundPid, jobs, SIGTSTP_action);
+		freeCommandLine();
+	}
+
+	long long start = benchClock();
+	while (jobs->jobCount > 0)
+	{
+		epoll_wait(eventPollFd, events, MAX_EVENTS, 1000);
+		processCheck(jobs);
+	}
+
+	snprintf(name, sizeof(name), "reap_%d_background_jobs", count);
+	benchReport(results, name, count, benchClock() - start, 0);
+}
+
+/**************************************************
+Function: benchBuiltins
+
+Function times the utility builtins against the programs
+they stand in for, run through executeAsChild: echo and
+true (iterations times in the shell, spawnCount times as
+processes), and cat copying a 1 MB file to a file. It also
+times an iteration of a for loop running true, to set
+against a whole line of true.
+***************************************************/
+
+static void benchBuiltins(FILE* results, int iterations, int spawnCount, struct jobTable* jobs, int* statusCode, int* lastForegroundPid, struct sigaction SIGTSTP_action)
+{
+	static const char* commands[][3] = {
+		{ "echo", "echo hello world\n", "/bin/echo hello world\n" },
+		{ "true", "true\n", "/bin/true\n" },
+	};
+	struct shellState shell = { statusCode, lastForegroundPid, jobs, SIGTSTP_action, false };
+	char line[PATH_MAX * 2 + 64];
+	char name[64];
+	long long start;
+	int i;
+
+	for (size_t c = 0; c < sizeof(commands) / sizeof(commands[0]); c++)
+	{
+		start = benchClock();
+		for (i = 0; i < iterations; i++)
+		{
+			strcpy(line, commands[c][1]);
+			runBuiltin(processInput(line), &shell);
+			freeCommandLine();
+		}
+		snprintf(name, sizeof(name), "builtin_%s", commands[c][0]);
+		benchReport(results, name, iterations, benchClock() - start, 0);
+
+		start = benchClock();
+		for (i = 0; i < spawnCount; i++)
+		{
+			strcpy(line, commands[c][2]);
+			executeAsChild(processInput(line), statusCode, lastForegroundPid, jobs, SIGTSTP_action);
+			freeCommandLine();
+		}
+		snprintf(name, sizeof(name), "forked_%s", commands[c][0]);
+		benchReport(results, name, spawnCount, benchClock() - start, 0);
+	}
+
+	// a for loop of true over 1000 words, per iteration
+	int loopRuns = iterations / 1000 + 1;
+	start = benchClock();
+	for (i = 0; i < loopRuns; i++)
+	{
+		strcpy(line, "for x in");
+		for (int w = 0; w < 1000; w++)
+		{
+			strcat(line, " w");
+		}
+		strcat(line, "; do true $x; done\n");
+		runCommandList(processInput(line), &shell);
+		freeCommandLine();
+	}
+	benchReport(results, "loop_true", loopRuns * 1000L, benchClock() - start, 0);
+
+	// a builtin whose words all come from the variable table
+	start = benchClock();
+	for (i = 0; i < iterations; i++)
+	{
+		strcpy(line, "true $HOME ${PATH} $? x$!y $$\n");
+		runCommandList(processInput(line), &shell);
+		freeCommandLine();
+	}
+	benchReport(results, "expand_variables", iterations, benchClock() - start, 0);
+
+	// cat: a 1 MB file copied to another file
+	char source[] = "/tmp/smallsh-bench-XXXXXX";
+	int sourceFd = mkstemp(source);
+	if (sourceFd == -1)
+	{
+		return;
+	}
+	char* block = calloc(1, 1 << 20);
+	write(sourceFd, block, 1 << 20);
+	free(block);
+	close(sourceFd);
+
+	int catCount = (spawnCount < 1000) ? spawnCount : 1000;
+	for (int forked = 0; forked < 2; forked++)
+	{
+		start = benchClock();
+		for (i = 0; i < catCount; i++)
+		{
+			snprintf(line, sizeof(line), "%s %s > %s.out\n", forked ? "/bin/cat" : "cat", source, source);
+			commandStruct* commandLine = processInput(line);
+			if (forked || !runBuiltin(commandLine, &shell))
+			{
+				executeAsChild(commandLine, statusCode, lastForegroundPid, jobs, SIGTSTP_action);
+			}
+			freeCommandLine();
+		}
+		benchReport(results, forked ? "forked_cat_1mb" : "builtin_cat_1mb", catCount, benchClock() - start, 1 << 20);
+	}
+
+	snprintf(line, sizeof(line), "%s.out", source);
+	unlink(line);
+	unlink(source);
+}
+
+/**************************************************
+Function: benchServe
+
+Function starts a server (see serveClients) on a socket in
+/tmp, then sends it count copies of line, all at once over
+one connection, and reports the time until every answer
+(and, with capture, all the output) has been read. The
+server runs its default number of commands at a time.
+***************************************************/
+
+static void benchServe(FILE* results, const char* name, const char* line, bool capture, int count, struct shellState* shell)
+{
+	char path[64];
+	char header[SERVE_HEADER_SIZE];
+	char payload[INPUT_CHUNK_SIZE];
+	size_t length = strlen(line);
+	int answered = 0;
+	int socketFd = -1;
+	int i;
+
+	snprintf(path, sizeof(path), "/tmp/smallsh-bench-%d.sock", getpid());
+	pid_t serverPid = fork();
+	if (serverPid == 0)
+	{
+		_exit(serveClients(path, 0, shell));
+	}
+	for (i = 0; i < 1000 && (socketFd = connectServer(path)) == -1; i++)
+	{
+		usleep(1000);
+	}
+	if (serverPid == -1 || socketFd == -1)
+	{
+		return;
+	}
+
+	long long start = benchClock();
+	char* requests = malloc(count * (SERVE_HEADER_SIZE + length));
+	for (i = 0; i < count; i++)
+	{
+		char* frame = requests + i * (SERVE_HEADER_SIZE + length);
+		putFrameHeader(frame, capture ? FRAME_CAPTURE : FRAME_RUN, i + 1, length);
+		memcpy(frame + SERVE_HEADER_SIZE, line, length);
+	}
+	writeFull(socketFd, requests, count * (SERVE_HEADER_SIZE + length));
+	shutdown(socketFd, SHUT_WR);
+	while (readFull(socketFd, header, SERVE_HEADER_SIZE))
+	{
+		char type;
+		uint32_t id;
+		uint32_t payloadLength;
+		getFrameHeader(header, &type, &id, &payloadLength);
+		if (payloadLength > sizeof(payload) || !readFull(socketFd, payload, payloadLength))
+		{
+			break;
+		}
+		answered += (type != FRAME_OUTPUT);
+	}
+	long long elapsed = benchClock() - start;
+	if (answered == count)
+	{
+		benchReport(results, name, count, elapsed, 0);
+	}
+
+	free(requests);
+	close(socketFd);
+	kill(serverPid, SIGTERM);
+	waitpid(serverPid, NULL, 0);
+}
+
+/**************************************************
+Function: runBenchmarks
+
+Runs the benchmark suite (smallsh --bench [iterations]) and
+writes one JSON line per result to stdout, so runs can be
+saved and compared:
+
+1) lex_* / parse_*: lexInput and processInput throughput on
+short lines, 2 KB lines, lines with 1024 arguments, and
+2 KB lines dense in $$
+2) spawn_foreground / spawn_background: commands per second
+through executeAsChild for /bin/true, waited for in the
+foreground, or started in the background and reaped at
+the end
+3) reap_N_background_jobs: time to reap and report N
+background jobs that finish together
+4) builtin_* / forked_*: echo, true and cat run as builtins
+against the same programs run as processes
+5) serve_true / serve_echo_captured: requests per second
+through a server (smallsh --serve), /bin/true answered with
+its status and the echo builtin with its output too
+
+iterations scales the parse benchmarks (default 100000);
+the spawn benchmarks run a tenth as many commands. Messages
+the shell prints while commands run are sent to /dev/null.
+Returns the shell's exit status.
+***************************************************/
+
+int runBenchmarks(int iterations, struct sigaction SIGTSTP_action)
+{
+	char line[8192];
+	struct jobTable jobs;
+	int statusCode = 0;
+	int lastForegroundPid = 0;
+	int spawnCount;
+	int i;
+
+	if (iterations <= 0)
+	{
+		iterations = 100000;
+	}
+	spawnCount = (iterations / 10 > 0) ? iterations / 10 : 1;
+
+	// results go to the real stdout, shell messages nowhere
+	FILE* results = fdopen(dup(STDOUT_FILENO), "w");
+	int nullFd = open("/dev/null", O_WRONLY);
+	fflush(stdout);
+	dup2(nullFd, STDOUT_FILENO);
+	close(nullFd);
+
+	initJobTable(&jobs);
+
+	benchParse(results, "short", "ls -la > out.txt &\n", iterations);
+
+	benchLine(line, "echo", " word", 2048);
+	benchParse(results, "2k", line, iterations);
+
+	benchLine(line, "echo", " a", 2 * 1024 + 6);
+	benchParse(results, "1k_args", line, iterations);
+
+	benchLine(line, "echo", " $$a$$", 2048);
+	benchParse(results, "2k_dollar_dollar", line, iterations);
+
+	long long start = benchClock();
+	for (i = 0; i < spawnCount; i++)
+	{
+		strcpy(line, "/bin/true\n");
+		executeAsChild(processInput(line), &statusCode, &lastForegroundPid, &jobs, SIGTSTP_action);
+		freeCommandLine();
+	}
+	benchReport(results, "spawn_foreground", spawnCount, benchClock() - start, 0);
+
+	benchBuiltins(results, iterations, spawnCount, &jobs, &statusCode, &lastForegroundPid, SIGTSTP_action);
+
+	start = benchClock();
+	for (i = 0; i < spawnCount; i++)
+	{
+		strcpy(line, "/bin/true &\n");
+		executeAsChild(processInput(line), &statusCode, &lastForegroundPid, &jobs, SIGTSTP_action);
+		freeCommandLine();
+	}
+	while (jobs.jobCount > 0)
+	{
+		struct epoll_event events[MAX_EVENTS];
+		epoll_wait(eventPollFd, events, MAX_EVENTS, 1000);
+		processCheck(&jobs);
+	}
+	benchReport(results, "spawn_background", spawnCount, benchClock() - start, 0);
+
+	benchReap(results, 16, &jobs, &statusCode, &lastForegroundPid, SIGTSTP_action);
+	benchReap(results, 256, &jobs, &statusCode, &lastForegroundPid, SIGTSTP_action);
+
+	struct shellState shell = { &statusCode, &lastForegroundPid, &jobs, SIGTSTP_action, false };
+	benchServe(results, "serve_true", "/bin/true\n", false, spawnCount, &shell);
+	benchServe(results, "serve_echo_captured", "echo hello world\n", true, spawnCount, &shell);
+
+	free(jobs.jobs);
+	free(jobs.index);
+	fclose(results);
+	return 0;
+}